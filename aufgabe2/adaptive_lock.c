@@ -0,0 +1,143 @@
+/** ****************************************************************
+ * @file    aufgabe2/adaptive_lock.c
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    16.12.2016
+ * @brief   Implementation for the Adaptive lock module
+ ******************************************************************
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "adaptive_lock.h"
+
+/**
+ * @brief States of a lock
+ */
+enum {
+    LOCK_FREE,   //!< unlocked
+    LOCK_TAKEN,  //!< locked, nobody parked
+    LOCK_PARKED  //!< locked, maybe somebody parked
+};
+
+/**
+ * @brief Tells the CPU that we are spinning
+ */
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#else
+    atomic_signal_fence(memory_order_seq_cst);
+#endif
+}
+
+/**
+ * @brief Tries to take a free lock
+ *
+ * @param[in] lock the lock
+ * @return true if the lock was taken
+ */
+static inline bool try_take(AdaptiveLock *lock) {
+    int expected = LOCK_FREE;
+    return atomic_compare_exchange_strong_explicit(&lock->state, &expected,
+            LOCK_TAKEN, memory_order_acquire, memory_order_relaxed);
+}
+
+/**
+ * @brief Spins until the lock could be taken or the budget is used up
+ *
+ * @param[in] lock   the lock
+ * @param[in] budget pause instructions to spend at most
+ * @return pause instructions needed to take the lock, -1 if it was not taken
+ */
+static int spin(AdaptiveLock *lock, int budget) {
+    int spins = 0;
+    int backoff = 1;
+    while (spins < budget) {
+        for (int i = 0; i < backoff; i++) {
+            cpu_relax();
+        }
+        spins += backoff;
+        if (backoff < ADAPTIVE_LOCK_MAX_BACKOFF) {
+            backoff *= 2;
+        }
+        // only try the CAS when it can succeed, to keep the line shared
+        if (atomic_load_explicit(&lock->state, memory_order_relaxed)
+                == LOCK_FREE && try_take(lock)) {
+            return spins;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Stores a new spin budget, within the bounds
+ *
+ * @param[in] lock   the lock
+ * @param[in] budget the new budget
+ */
+static void set_budget(AdaptiveLock *lock, int budget) {
+    if (budget < ADAPTIVE_LOCK_MIN_SPINS) {
+        budget = ADAPTIVE_LOCK_MIN_SPINS;
+    } else if (budget > ADAPTIVE_LOCK_MAX_SPINS) {
+        budget = ADAPTIVE_LOCK_MAX_SPINS;
+    }
+    atomic_store_explicit(&lock->spin_budget, budget, memory_order_relaxed);
+}
+
+/*
+ * Initializes a lock, unlocked
+ */
+void adaptive_lock_init(AdaptiveLock *lock) {
+    atomic_init(&lock->state, LOCK_FREE);
+    atomic_init(&lock->spin_budget,
+            sysconf(_SC_NPROCESSORS_ONLN) > 1 ? ADAPTIVE_LOCK_INITIAL_SPINS : 0);
+}
+
+/*
+ * Acquires a lock
+ */
+void adaptive_lock(AdaptiveLock *lock) {
+    if (try_take(lock)) {
+        return;
+    }
+
+    // the budget is only a hint, so races on it don't matter
+    int budget = atomic_load_explicit(&lock->spin_budget,
+            memory_order_relaxed);
+    if (budget > 0) {
+        // moving average: a spinning acquisition pulls the budget towards
+        // twice what it needed, a parking one shrinks it by an eighth
+        int spins = spin(lock, budget);
+        if (spins >= 0) {
+            set_budget(lock, budget + (2 * spins - budget) / 8);
+            return;
+        }
+        set_budget(lock, budget - budget / 8);
+    }
+
+    // park. Whoever takes the lock from here on marks it parked, as there
+    // may be others sleeping.
+    while (atomic_exchange_explicit(&lock->state, LOCK_PARKED,
+            memory_order_acquire) != LOCK_FREE) {
+        syscall(SYS_futex, &lock->state, FUTEX_WAIT_PRIVATE, LOCK_PARKED, NULL,
+                NULL, 0);
+    }
+}
+
+/*
+ * Releases a lock held by the caller
+ */
+void adaptive_unlock(AdaptiveLock *lock) {
+    if (atomic_exchange_explicit(&lock->state, LOCK_FREE, memory_order_release)
+            == LOCK_PARKED) {
+        syscall(SYS_futex, &lock->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
@@ -0,0 +1,81 @@
+/** ****************************************************************
+ * @file    aufgabe2/adaptive_lock.h
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    16.12.2016
+ * @brief   Header for the Adaptive lock module
+ *
+ * Mutual exclusion lock that spins for a while before it parks the thread on
+ * a futex. Spinning uses exponential backoff (1, 2, 4, ... pause
+ * instructions between attempts, at most ADAPTIVE_LOCK_MAX_BACKOFF). How
+ * long a thread spins adapts to the hold times of the lock: every
+ * acquisition that succeeded while spinning moves the spin budget towards
+ * twice the spins it needed, every acquisition that had to park shrinks it.
+ * So short critical sections are waited out without a syscall and a context
+ * switch, long ones park almost right away.
+ *
+ * On a single CPU the holder can not run while somebody spins, so the lock
+ * never spins there.
+ *
+ * The futex protocol is the one from "Futexes Are Tricky" (U. Drepper):
+ * 0 unlocked, 1 locked, 2 locked and maybe somebody parked.
+ ******************************************************************
+ */
+
+#ifndef ADAPTIVE_LOCK_H_
+#define ADAPTIVE_LOCK_H_
+
+#include <stdatomic.h>
+
+/**
+ * @brief Spin budget (in pause instructions) a lock starts with
+ */
+#define ADAPTIVE_LOCK_INITIAL_SPINS 256
+
+/**
+ * @brief Lower bound of the spin budget, so a lock can find out that
+ *        spinning pays off again
+ */
+#define ADAPTIVE_LOCK_MIN_SPINS 16
+
+/**
+ * @brief Upper bound of the spin budget (several microseconds)
+ */
+#define ADAPTIVE_LOCK_MAX_SPINS 8192
+
+/**
+ * @brief Longest pause between two attempts while spinning
+ */
+#define ADAPTIVE_LOCK_MAX_BACKOFF 64
+
+/**
+ * @brief An adaptive lock
+ */
+typedef struct {
+    atomic_int state;       //!< 0 unlocked, 1 locked, 2 locked with waiters
+    atomic_int spin_budget; //!< how long to spin before parking
+} AdaptiveLock;
+
+/**
+ * @brief Initializes a lock, unlocked
+ *
+ * @param[out] lock the lock
+ */
+void adaptive_lock_init(AdaptiveLock *lock);
+
+/**
+ * @brief Acquires a lock
+ *
+ * @param[in] lock the lock
+ */
+void adaptive_lock(AdaptiveLock *lock);
+
+/**
+ * @brief Releases a lock held by the caller
+ *
+ * @param[in] lock the lock
+ */
+void adaptive_unlock(AdaptiveLock *lock);
+
+#endif /* ADAPTIVE_LOCK_H_ */
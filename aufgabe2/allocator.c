@@ -0,0 +1,321 @@
+/** ****************************************************************
+ * @file    aufgabe2/allocator.c
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    16.12.2016
+ * @brief   Implementation for the Allocator module
+ ******************************************************************
+ */
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "allocator.h"
+#include "errors.h"
+
+/**
+ * @brief State of an allocator
+ *
+ * Waiters are kept in FIFO order in slots 0 to waiter_count - 1. The demand
+ * of the waiter in slot s for class c is needs[c * waiter_capacity + s],
+ * 0 for exact-sum requests. Served and cancelled waiters leave a hole (no
+ * waiter, a demand nobody can meet), the slots are only compacted once half
+ * of them are holes, so a grant does not have to move every column.
+ */
+struct Allocator {
+    int classes;               //!< number of resource classes
+    int *available;            //!< available units per class
+    AllocatorSplit split;      //!< turns exact-sum requests into units
+    void *context;             //!< passed to split
+    int waiter_count;          //!< number of used slots
+    int hole_count;            //!< number of used slots without a waiter
+    int waiter_capacity;       //!< number of slots
+    int *needs;                //!< demands, one column per class
+    AllocatorWaiter **waiters; //!< the waiter of every slot
+    unsigned char *fits;       //!< scratch for allocator_grant, per slot
+    AllocatorWaiter **served;  //!< scratch for allocator_grant, per slot
+};
+
+/**
+ * @brief Checks whether a vector request fits into the available units
+ *
+ * @param[in] allocator the allocator
+ * @param[in] request   units per class
+ * @return true if every class has enough units
+ */
+static bool fits(const Allocator *allocator, const int request[]) {
+    for (int c = 0; c < allocator->classes; c++) {
+        if (request[c] > allocator->available[c]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Takes units
+ *
+ * @param[in] allocator the allocator
+ * @param[in] counts    units per class, must be available
+ */
+static void take(Allocator *allocator, const int counts[]) {
+    for (int c = 0; c < allocator->classes; c++) {
+        allocator->available[c] -= counts[c];
+    }
+}
+
+/**
+ * @brief Turns the slot of a waiter into a hole
+ *
+ * @param[in] allocator the allocator
+ * @param[in] slot      the slot
+ */
+static void remove_slot(Allocator *allocator, int slot) {
+    allocator->waiters[slot] = NULL;
+    allocator->needs[slot] = INT_MAX;
+    allocator->hole_count++;
+}
+
+/**
+ * @brief Moves all waiters to the front, keeping their order
+ *
+ * @param[in] allocator the allocator
+ */
+static void compact(Allocator *allocator) {
+    int count = allocator->waiter_count;
+    AllocatorWaiter **waiters = allocator->waiters;
+    for (int c = 0; c < allocator->classes; c++) {
+        int *column = &allocator->needs[c * allocator->waiter_capacity];
+        int to = 0;
+        for (int s = 0; s < count; s++) {
+            column[to] = column[s];
+            to += waiters[s] != NULL;
+        }
+    }
+    int to = 0;
+    for (int s = 0; s < count; s++) {
+        if (waiters[s] != NULL) {
+            waiters[to++] = waiters[s];
+        }
+    }
+    allocator->waiter_count = to;
+    allocator->hole_count = 0;
+}
+
+/**
+ * @brief Doubles the number of slots
+ *
+ * @param[in] allocator the allocator
+ */
+static void grow(Allocator *allocator) {
+    int old_capacity = allocator->waiter_capacity;
+    int capacity = old_capacity * 2;
+
+    int *needs = malloc(sizeof(int) * allocator->classes * capacity);
+    AllocatorWaiter **waiters = realloc(allocator->waiters,
+            sizeof(AllocatorWaiter*) * capacity);
+    unsigned char *fits = realloc(allocator->fits, capacity);
+    AllocatorWaiter **served = realloc(allocator->served,
+            sizeof(AllocatorWaiter*) * capacity);
+    FATAL_ERROR_HANDLING(
+            needs == NULL || waiters == NULL || fits == NULL || served == NULL,
+            "[allocator] Failed to grow waiters")
+
+    // the columns get longer, so every one of them moves
+    for (int c = 0; c < allocator->classes; c++) {
+        memcpy(&needs[c * capacity], &allocator->needs[c * old_capacity],
+                sizeof(int) * allocator->waiter_count);
+    }
+    free(allocator->needs);
+    allocator->needs = needs;
+    allocator->waiters = waiters;
+    allocator->fits = fits;
+    allocator->served = served;
+    allocator->waiter_capacity = capacity;
+}
+
+/*
+ * Creates an allocator with all units available
+ */
+Allocator* allocator_create(int classes, const int capacity[],
+        AllocatorSplit split, void *context) {
+    FATAL_ERROR_HANDLING(classes <= 0,
+            "[allocator_create] Need at least one resource class")
+    Allocator *allocator = calloc(1, sizeof(Allocator));
+    FATAL_ERROR_HANDLING(allocator == NULL,
+            "[allocator_create] Failed to allocate allocator")
+
+    allocator->classes = classes;
+    allocator->split = split;
+    allocator->context = context;
+    allocator->waiter_capacity = ALLOCATOR_INITIAL_WAITERS;
+    allocator->available = malloc(sizeof(int) * classes);
+    allocator->needs = malloc(
+            sizeof(int) * classes * allocator->waiter_capacity);
+    allocator->waiters = malloc(
+            sizeof(AllocatorWaiter*) * allocator->waiter_capacity);
+    allocator->fits = malloc(allocator->waiter_capacity);
+    allocator->served = malloc(
+            sizeof(AllocatorWaiter*) * allocator->waiter_capacity);
+    FATAL_ERROR_HANDLING(
+            allocator->available == NULL || allocator->needs == NULL
+                    || allocator->waiters == NULL || allocator->fits == NULL
+                    || allocator->served == NULL,
+            "[allocator_create] Failed to allocate allocator")
+    memcpy(allocator->available, capacity, sizeof(int) * classes);
+    return allocator;
+}
+
+/*
+ * Destroys an allocator
+ */
+void allocator_destroy(Allocator *allocator) {
+    free(allocator->available);
+    free(allocator->needs);
+    free(allocator->waiters);
+    free(allocator->fits);
+    free(allocator->served);
+    free(allocator);
+}
+
+/*
+ * Gets the available units
+ */
+const int* allocator_available(const Allocator *allocator) {
+    return allocator->available;
+}
+
+/*
+ * Takes the units of a vector request, if all of them are available
+ */
+bool allocator_try(Allocator *allocator, const int request[], int counts[]) {
+    if (!fits(allocator, request)) {
+        return false;
+    }
+    take(allocator, request);
+    if (counts != request) {
+        memcpy(counts, request, sizeof(int) * allocator->classes);
+    }
+    return true;
+}
+
+/*
+ * Takes the units of an exact-sum request, if the total can be served
+ */
+bool allocator_try_sum(Allocator *allocator, int total, int counts[]) {
+    if (!allocator->split(allocator->context, allocator->available, total,
+            counts)) {
+        return false;
+    }
+    take(allocator, counts);
+    return true;
+}
+
+/*
+ * Gives units back
+ */
+void allocator_release(Allocator *allocator, int counts[]) {
+    for (int c = 0; c < allocator->classes; c++) {
+        allocator->available[c] += counts[c];
+        counts[c] = 0;
+    }
+}
+
+/*
+ * Queues a waiter behind all others
+ */
+void allocator_wait(Allocator *allocator, AllocatorWaiter *waiter) {
+    if (allocator->waiter_count == allocator->waiter_capacity) {
+        if (allocator->hole_count > 0) {
+            compact(allocator);
+        } else {
+            grow(allocator);
+        }
+    }
+
+    int slot = allocator->waiter_count++;
+    allocator->waiters[slot] = waiter;
+    for (int c = 0; c < allocator->classes; c++) {
+        allocator->needs[c * allocator->waiter_capacity + slot] =
+                waiter->request != NULL ? waiter->request[c] : 0;
+    }
+}
+
+/*
+ * Removes a waiter that was not granted
+ */
+bool allocator_cancel(Allocator *allocator, AllocatorWaiter *waiter) {
+    int slot = 0;
+    while (slot < allocator->waiter_count
+            && allocator->waiters[slot] != waiter) {
+        slot++;
+    }
+    if (slot == allocator->waiter_count) {
+        return false;
+    }
+    remove_slot(allocator, slot);
+    return true;
+}
+
+/*
+ * Serves the queued waiters that fit into the available units
+ */
+int allocator_grant(Allocator *allocator, AllocatorGranted granted,
+        void *context) {
+    int count = allocator->waiter_count;
+    int capacity = allocator->waiter_capacity;
+    unsigned char *fit = allocator->fits;
+
+    // coarse check of everybody against what is available now, one class at
+    // a time (holes never fit). Serving a waiter only makes the others fit
+    // less, so a waiter that fails here can not be served in this round.
+    memset(fit, 1, count);
+    for (int c = 0; c < allocator->classes; c++) {
+        const int *column = &allocator->needs[c * capacity];
+        int available = allocator->available[c];
+        for (int s = 0; s < count; s++) {
+            fit[s] &= column[s] <= available;
+        }
+    }
+
+    // exact check and grant in FIFO order
+    AllocatorWaiter **served = allocator->served;
+    int served_count = 0;
+    for (int s = 0; s < count; s++) {
+        AllocatorWaiter *waiter = allocator->waiters[s];
+        if (!fit[s] || waiter == NULL) {
+            continue;
+        }
+        if (waiter->request != NULL ?
+                allocator_try(allocator, waiter->request, waiter->counts) :
+                allocator_try_sum(allocator, waiter->total, waiter->counts)) {
+            served[served_count++] = waiter;
+            remove_slot(allocator, s);
+        }
+    }
+    if (allocator->hole_count * 2 > allocator->waiter_count) {
+        compact(allocator);
+    }
+
+    // callbacks last, they may queue again (and grow the scratch arrays)
+    allocator->served = NULL;
+    for (int s = 0; s < served_count; s++) {
+        granted(served[s], context);
+    }
+    if (allocator->served == NULL) {
+        allocator->served = served;
+    } else {
+        free(served);
+    }
+    return served_count;
+}
+
+/*
+ * Gets the number of queued waiters
+ */
+int allocator_waiters(const Allocator *allocator) {
+    return allocator->waiter_count - allocator->hole_count;
+}
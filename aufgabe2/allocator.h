@@ -0,0 +1,173 @@
+/** ****************************************************************
+ * @file    aufgabe2/allocator.h
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    16.12.2016
+ * @brief   Header for the Allocator module
+ *
+ * Multi-unit resource allocator for any number of resource classes, the
+ * bookkeeping behind the gym, usable for other quotas (connections,
+ * buffers, ...) as well. A request either names the units of every class
+ * it needs (vector request, banker's style) or only a total that a split
+ * function turns into units (exact-sum request, like the weights of the
+ * gym). Requests are all or nothing.
+ *
+ * Requests that can not be served right away can be queued as waiters.
+ * allocator_grant serves them in FIFO order, a waiter that does not fit is
+ * overtaken by later ones that do. The demands of the waiters are kept as
+ * structure of arrays (one column per class), so the first, coarse check of
+ * all waiters against the available units is a straight loop per class that
+ * the compiler can vectorize.
+ *
+ * An allocator does no locking and no waiting itself, callers must
+ * serialize all calls for the same allocator.
+ ******************************************************************
+ */
+
+#ifndef ALLOCATOR_H_
+#define ALLOCATOR_H_
+
+#include <stdbool.h>
+
+/**
+ * @brief Number of waiters an allocator has room for before it grows
+ */
+#define ALLOCATOR_INITIAL_WAITERS 64
+
+/**
+ * @brief An allocator
+ */
+typedef struct Allocator Allocator;
+
+/**
+ * @brief Turns an exact-sum request into units
+ *
+ * @param[in]  context   as passed to allocator_create
+ * @param[in]  available the available units of every class
+ * @param[in]  total     the requested total
+ * @param[out] split     will contain the units if true is returned
+ * @return true if the total can be served from available
+ */
+typedef bool (*AllocatorSplit)(void *context, const int available[],
+        int total, int split[]);
+
+/**
+ * @brief A queued request
+ *
+ * Owned by the caller, who has to keep it alive while it is queued.
+ */
+typedef struct {
+    const int *request; //!< units per class, NULL for an exact-sum request
+    int total;          //!< the total of an exact-sum request
+    int *counts;        //!< receives the units once granted
+    void *owner;        //!< free for the caller
+} AllocatorWaiter;
+
+/**
+ * @brief Called for every waiter allocator_grant served
+ *
+ * @param[in] waiter  the waiter, its units are in waiter->counts
+ * @param[in] context as passed to allocator_grant
+ */
+typedef void (*AllocatorGranted)(AllocatorWaiter *waiter, void *context);
+
+/**
+ * @brief Creates an allocator with all units available
+ *
+ * @param[in] classes  number of resource classes
+ * @param[in] capacity number of units of every class
+ * @param[in] split    turns exact-sum requests into units, NULL if there
+ *                     are none
+ * @param[in] context  passed to split
+ * @return the allocator
+ */
+Allocator* allocator_create(int classes, const int capacity[],
+        AllocatorSplit split, void *context);
+
+/**
+ * @brief Destroys an allocator
+ *
+ * @param[in] allocator the allocator, queued waiters are dropped
+ */
+void allocator_destroy(Allocator *allocator);
+
+/**
+ * @brief Gets the available units
+ *
+ * The array stays valid for the life of the allocator.
+ *
+ * @param[in] allocator the allocator
+ * @return the units of every class
+ */
+const int* allocator_available(const Allocator *allocator);
+
+/**
+ * @brief Takes the units of a vector request, if all of them are available
+ *
+ * @param[in]  allocator the allocator
+ * @param[in]  request   units per class
+ * @param[out] counts    receives the units if true is returned (may be
+ *                       request)
+ * @return true if the units were taken
+ */
+bool allocator_try(Allocator *allocator, const int request[], int counts[]);
+
+/**
+ * @brief Takes the units of an exact-sum request, if the total can be served
+ *
+ * @param[in]  allocator the allocator
+ * @param[in]  total     the requested total
+ * @param[out] counts    receives the units if true is returned
+ * @return true if the units were taken
+ */
+bool allocator_try_sum(Allocator *allocator, int total, int counts[]);
+
+/**
+ * @brief Gives units back
+ *
+ * Does not serve waiters, call allocator_grant for that.
+ *
+ * @param[in]     allocator the allocator
+ * @param[in,out] counts    the units, all 0 afterwards
+ */
+void allocator_release(Allocator *allocator, int counts[]);
+
+/**
+ * @brief Queues a waiter behind all others
+ *
+ * @param[in] allocator the allocator
+ * @param[in] waiter    the waiter, request, total and counts must be set
+ */
+void allocator_wait(Allocator *allocator, AllocatorWaiter *waiter);
+
+/**
+ * @brief Removes a waiter that was not granted, e.g. after a timeout
+ *
+ * @param[in] allocator the allocator
+ * @param[in] waiter    the waiter
+ * @return false if the waiter was not queued
+ */
+bool allocator_cancel(Allocator *allocator, AllocatorWaiter *waiter);
+
+/**
+ * @brief Serves the queued waiters that fit into the available units
+ *
+ * @param[in] allocator the allocator
+ * @param[in] granted   called for every served waiter, after it was removed
+ *                      from the queue
+ * @param[in] context   passed to granted
+ * @return the number of served waiters
+ */
+int allocator_grant(Allocator *allocator, AllocatorGranted granted,
+        void *context);
+
+/**
+ * @brief Gets the number of queued waiters
+ *
+ * @param[in] allocator the allocator
+ * @return the number of waiters
+ */
+int allocator_waiters(const Allocator *allocator);
+
+#endif /* ALLOCATOR_H_ */
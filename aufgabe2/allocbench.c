@@ -0,0 +1,179 @@
+/** ****************************************************************
+ * @file    aufgabe2/allocbench.c
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    16.12.2016
+ * @brief   Micro benchmark for the allocator with many classes and waiters
+ *
+ * A single thread plays a closed system of clients with random vector
+ * requests: every client needs 1 to ALLOCBENCH_MAX_NEED units of about a
+ * quarter of the classes, and there are only enough units for about one in
+ * ALLOCBENCH_SHARE clients. All clients start waiting. Then the client that
+ * has held its units the longest releases them, allocator_grant serves the
+ * waiters that fit and the released client waits again, until the time is up.
+ *
+ * Prints the grants per second and the time per waiter a grant pass took.
+ *
+ * Usage: allocbench CLASSES WAITERS SECONDS
+ ******************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "allocator.h"
+#include "errors.h"
+
+/**
+ * @brief A client needs at most this many units of a class
+ */
+#define ALLOCBENCH_MAX_NEED 4
+
+/**
+ * @brief About one in this many clients can hold units at the same time
+ */
+#define ALLOCBENCH_SHARE 8
+
+/**
+ * @brief Number of nanoseconds per second
+ */
+#define NS_PER_SECOND 1000000000L
+
+/**
+ * @brief A client
+ */
+typedef struct {
+    AllocatorWaiter waiter; //!< queued while waiting
+    int *request;           //!< units per class it needs
+    int *counts;            //!< units it holds
+} Client;
+
+/**
+ * @brief Clients holding units, oldest first (ring buffer)
+ */
+static Client **holders = NULL;
+
+/**
+ * @brief Index of the oldest holder and number of holders
+ */
+static int holders_head = 0, holders_count = 0;
+
+/**
+ * @brief Number of clients
+ */
+static int client_count = 0;
+
+/**
+ * @brief State of the random number generator
+ */
+static unsigned long random_state = 1;
+
+/**
+ * @brief Gets the next random number (splitmix64)
+ *
+ * @return 64 random bits
+ */
+static unsigned long next_random() {
+    unsigned long z = (random_state += 0x9E3779B97F4A7C15UL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9UL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBUL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Gets the CLOCK_MONOTONIC time
+ *
+ * @return the time in nanoseconds
+ */
+static long now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NS_PER_SECOND + now.tv_nsec;
+}
+
+/**
+ * @brief Makes a served client the youngest holder
+ */
+static void granted(AllocatorWaiter *waiter, void *context) {
+    holders[(holders_head + holders_count++) % client_count] = waiter->owner;
+}
+
+/**
+ * @brief Program entry
+ */
+int main(int argc, char **argv) {
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s CLASSES WAITERS SECONDS\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int classes = atoi(argv[1]);
+    client_count = atoi(argv[2]);
+    int seconds = atoi(argv[3]);
+    if (classes <= 0 || client_count <= 0 || seconds <= 0) {
+        fprintf(stderr, "Usage: %s CLASSES WAITERS SECONDS\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    Client *clients = malloc(sizeof(Client) * client_count);
+    holders = malloc(sizeof(Client*) * client_count);
+    int *capacity = calloc(classes, sizeof(int));
+    FATAL_ERROR_HANDLING(clients == NULL || holders == NULL || capacity == NULL,
+            "Failed to allocate clients")
+    for (int i = 0; i < client_count; i++) {
+        clients[i].request = calloc(classes, sizeof(int));
+        clients[i].counts = calloc(classes, sizeof(int));
+        FATAL_ERROR_HANDLING(
+                clients[i].request == NULL || clients[i].counts == NULL,
+                "Failed to allocate clients")
+        for (int c = 0; c < classes; c++) {
+            if (next_random() % 4 == 0) {
+                clients[i].request[c] = 1 + next_random() % ALLOCBENCH_MAX_NEED;
+                capacity[c] += clients[i].request[c];
+            }
+        }
+        clients[i].waiter.request = clients[i].request;
+        clients[i].waiter.counts = clients[i].counts;
+        clients[i].waiter.owner = &clients[i];
+    }
+    for (int c = 0; c < classes; c++) {
+        // everybody must fit on their own
+        capacity[c] = capacity[c] / ALLOCBENCH_SHARE + ALLOCBENCH_MAX_NEED;
+    }
+
+    Allocator *allocator = allocator_create(classes, capacity, NULL, NULL);
+    for (int i = 0; i < client_count; i++) {
+        allocator_wait(allocator, &clients[i].waiter);
+    }
+    allocator_grant(allocator, granted, NULL);
+
+    long grants = 0;
+    long passes = 0;
+    long scanned = 0;
+    long start = now_ns();
+    long end = start + seconds * NS_PER_SECOND;
+    long now = start;
+    while (now < end) {
+        // check the clock only now and then, it is not free
+        for (int i = 0; i < 64; i++) {
+            Client *client = holders[holders_head];
+            holders_head = (holders_head + 1) % client_count;
+            holders_count--;
+            allocator_release(allocator, client->counts);
+            allocator_wait(allocator, &client->waiter);
+            scanned += allocator_waiters(allocator);
+            grants += allocator_grant(allocator, granted, NULL);
+            passes++;
+        }
+        now = now_ns();
+    }
+
+    double elapsed = (double) (now - start) / NS_PER_SECOND;
+    printf("classes,waiters,grants_per_second,grants_per_pass,"
+            "ns_per_waiter_scanned\n");
+    printf("%d,%d,%.0f,%.2f,%.2f\n", classes, client_count, grants / elapsed,
+            (double) grants / passes, (now - start) / (double) scanned);
+
+    allocator_destroy(allocator);
+    return 0;
+}
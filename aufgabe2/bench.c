@@ -0,0 +1,243 @@
+/** ****************************************************************
+ * @file    aufgabe2/bench.c
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    09.12.2016
+ * @brief   Headless benchmark of the philosophers and the gym
+ *
+ * Runs the real philosophers (workout, rest and all) without status display
+ * and without console input for a fixed time, then prints one CSV line:
+ * gym acquisitions per second, the p50/p99/p999 time spent in
+ * gym_get_weights and the p50/p99 time the gym monitor was held per
+ * operation plus the share of the run it was held at all, and the cache
+ * misses per acquisition (empty if the CPU has no counters for it or
+ * perf_event_paranoid forbids them), how long philosophers_init took
+ * until all philosophers were running and the share of requests served with
+ * a cached kit (empty for the lock-free gym). The gym and the
+ * philosophers have to be compiled with -DGYM_STATS (see "make bench").
+ *
+ * If BENCH_PHILOSOPHERS_CSV names a file, one line per philosopher with its
+ * own wait percentiles is appended to it.
+ *
+ * Usage: bench_<engine> SECONDS [philosophen_training options]
+ ******************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include "config.h"
+#include "gym.h"
+#include "philosophers.h"
+#include "stats.h"
+#include "status.h"
+#include "trace.h"
+#include "errors.h"
+
+/**
+ * @brief Time the philosophers run before measuring starts in milliseconds
+ */
+#define BENCH_WARMUP_MS 200
+
+/**
+ * @brief Nanoseconds per microsecond, for the output
+ */
+#define NS_PER_US 1000.0
+
+/**
+ * @brief Nanoseconds per millisecond, for the startup time
+ */
+#define NS_PER_MS 1000000.0
+
+/**
+ * @brief Environment variable naming the per-philosopher CSV file
+ */
+#define BENCH_PHILOSOPHERS_CSV "BENCH_PHILOSOPHERS_CSV"
+
+/*
+ * The status display is not benchmarked, so it is a no-op here
+ */
+void status_init(int philo_count, const int training_weights[]) {
+}
+
+void status_quit() {
+}
+
+void status_push_state(int philo_id, char state) {
+}
+
+void status_push_command(int philo_id, char command) {
+}
+
+void status_push_weights(int philo_id, const int weights[],
+        const int gym_weights[]) {
+}
+
+/**
+ * @brief Starts counting cache misses of this process and all threads it
+ *        creates from now on
+ *
+ * @return the perf event file descriptor, -1 if cache misses can not be
+ *         counted
+ */
+static int open_cache_miss_counter() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/**
+ * @brief Prints engine, philosopher count, inventory, fairness and CPUs of a
+ *        run
+ *
+ * @param[in] file    where to print
+ * @param[in] program the name of the benchmark binary
+ * @param[in] config  the configuration of the run
+ */
+static void print_run(FILE *file, const char *program, const Config *config) {
+    fprintf(file, "%s,%d,", program, config->philo_count);
+    for (int i = 0; i < config->weight_classes; i++) {
+        fprintf(file, i == 0 ? "%d" : "/%d", config->weights_inventory[i]);
+    }
+    fprintf(file, ",%d,", config->fairness);
+    if (config->cpu_count == 0) {
+        fprintf(file, "none");
+    }
+    for (int i = 0; i < config->cpu_count; i++) {
+        fprintf(file, i == 0 ? "%d" : "/%d", config->cpus[i]);
+    }
+}
+
+/**
+ * @brief Appends the wait percentiles of every philosopher to a CSV file
+ *
+ * Covers the whole life of the philosophers, warmup included, so it has to
+ * be called after philosophers_quit.
+ *
+ * @param[in]  path     the file
+ * @param[in]  program  the name of the benchmark binary
+ * @param[in]  config   the configuration of the run
+ * @param[out] snapshot scratch memory
+ */
+static void print_philosophers(const char *path, const char *program,
+        const Config *config, StatsSnapshot *snapshot) {
+    FILE *file = fopen(path, "a");
+    FATAL_ERROR_HANDLING(file == NULL, "Failed to open philosophers CSV")
+
+    for (int id = 0; id < config->philo_count; id++) {
+        stats_snapshot(snapshot, id);
+        print_run(file, program, config);
+        fprintf(file, ",%d,%d,%ld,%.2f,%.2f,%.2f\n", id,
+                config->training_weights[id],
+                stats_count(snapshot, STATS_GYM_WAIT),
+                stats_percentile(snapshot, STATS_GYM_WAIT, 50) / NS_PER_US,
+                stats_percentile(snapshot, STATS_GYM_WAIT, 99) / NS_PER_US,
+                stats_percentile(snapshot, STATS_GYM_WAIT, 100) / NS_PER_US);
+    }
+    fclose(file);
+}
+
+/**
+ * @brief Program entry
+ */
+int main(int argc, char **argv) {
+    if (argc < 2 || atoi(argv[1]) <= 0) {
+        fprintf(stderr, "Usage: %s SECONDS [options]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int seconds = atoi(argv[1]);
+
+    // the remaining arguments are the same as for philosophen_training
+    argv[1] = argv[0];
+    Config config;
+    config_load(&config, argc - 1, argv + 1);
+
+    gym_init(config.weight_classes, config.weight_masses,
+            config.weights_inventory);
+    gym_set_fairness(config.fairness);
+    if (config.trace_path != NULL) {
+        trace_init(config.trace_path,
+                config.workers > 0 ? config.workers : config.philo_count);
+    }
+    philosophers_set_affinity(config.cpu_count, config.cpus);
+    philosophers_set_workers(config.workers);
+    philosophers_set_durations(config.workout_ms, config.rest_ms);
+
+    // threads inherit the counter, their counts are added when they exit
+    int cache_misses = open_cache_miss_counter();
+    long startup = stats_now();
+    philosophers_init(config.philo_count, config.training_weights);
+    startup = stats_now() - startup;
+    usleep(BENCH_WARMUP_MS * 1000);
+
+    StatsSnapshot *before = malloc(sizeof(StatsSnapshot));
+    StatsSnapshot *after = malloc(sizeof(StatsSnapshot));
+    FATAL_ERROR_HANDLING(before == NULL || after == NULL,
+            "Failed to allocate snapshots")
+
+    long start = stats_now();
+    stats_snapshot(before, STATS_ALL_LABELS);
+    sleep(seconds);
+    stats_snapshot(after, STATS_ALL_LABELS);
+    long end = stats_now();
+
+    philosophers_quit();
+    trace_dump();
+
+    // cache misses can only be read after the threads have exited, so they
+    // cover the whole run and are divided by all acquisitions
+    long misses = -1;
+    if (cache_misses >= 0) {
+        if (read(cache_misses, &misses, sizeof(misses)) != sizeof(misses)) {
+            misses = -1;
+        }
+        close(cache_misses);
+    }
+
+    stats_subtract(after, before);
+    double elapsed = end - start;
+    long acquisitions = stats_count(after, STATS_GYM_WAIT);
+
+    stats_snapshot(before, STATS_ALL_LABELS);
+    long all_acquisitions = stats_count(before, STATS_GYM_WAIT);
+
+    print_run(stdout, argv[0], &config);
+    printf(",%.0f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,",
+            acquisitions / elapsed * 1e9,
+            stats_percentile(after, STATS_GYM_WAIT, 50) / NS_PER_US,
+            stats_percentile(after, STATS_GYM_WAIT, 99) / NS_PER_US,
+            stats_percentile(after, STATS_GYM_WAIT, 99.9) / NS_PER_US,
+            stats_percentile(after, STATS_GYM_HOLD, 50) / NS_PER_US,
+            stats_percentile(after, STATS_GYM_HOLD, 99) / NS_PER_US,
+            after->sum[STATS_GYM_HOLD] / elapsed * 100.0);
+    if (misses >= 0 && all_acquisitions > 0) {
+        printf("%.1f", (double) misses / all_acquisitions);
+    }
+    printf(",%.2f,", startup / NS_PER_MS);
+    long kit_hits = after->counters[STATS_GYM_KIT_HITS];
+    long kit_lookups = kit_hits + after->counters[STATS_GYM_KIT_MISSES];
+    if (kit_lookups > 0) {
+        printf("%.1f", 100.0 * kit_hits / kit_lookups);
+    }
+    printf("\n");
+
+    const char *philosophers_csv = getenv(BENCH_PHILOSOPHERS_CSV);
+    if (philosophers_csv != NULL) {
+        print_philosophers(philosophers_csv, argv[0], &config, after);
+    }
+
+    free(before);
+    free(after);
+    config_free(&config);
+    return 0;
+}
@@ -0,0 +1,424 @@
+/** ****************************************************************
+ * @file    aufgabe2/config.c
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    09.12.2016
+ * @brief   Implementation of the Configuration module
+ ******************************************************************
+ */
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "errors.h"
+#include "gym.h"
+#include "philosophers.h"
+
+/**
+ * @brief Maximum length of a line in the config file
+ */
+#define CONFIG_LINE_SIZE 4096
+
+/**
+ * @brief Option string for getopt
+ */
+#define CONFIG_OPTIONS "c:n:w:m:i:W:R:f:a:t:T:S:"
+
+/**
+ * @brief A list of numbers as read from the command line or config file
+ */
+typedef struct {
+    int count;   //!< number of values, 0 if not configured
+    int *values; //!< the values
+} ConfigList;
+
+/**
+ * @brief Value of -a that pins to all online CPUs
+ */
+#define CONFIG_ALL_CPUS "all"
+
+/**
+ * @brief Raw values before defaults are applied
+ */
+typedef struct {
+    int philo_count;
+    int workout_ms;
+    int rest_ms;
+    int fairness;
+    int workers;
+    char *trace_path;
+    char *socket_path;
+    ConfigList weights;
+    ConfigList masses;
+    ConfigList inventory;
+    ConfigList cpus;
+} RawConfig;
+
+/**
+ * @brief Prints the usage and exits the program
+ *
+ * @param[in] program the name of the program
+ * @param[in] message what was wrong
+ */
+static void usage(const char *program, const char *message) {
+    fprintf(stderr, "%s\n", message);
+    fprintf(stderr, "Usage: %s [-c FILE] [-n COUNT] [-w W1,W2,...] "
+            "[-m M1,M2,...] [-i I1,I2,...] [-W MS] [-R MS] [-f N] "
+            "[-a all|C1,C2,...] [-t WORKERS] [-T FILE] [-S SOCKET]\n", program);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Parses a number
+ *
+ * @param[in]  text    the text to parse
+ * @param[in]  minimum the smallest valid number
+ * @param[out] value   will contain the number
+ * @return true if text was a number >= minimum
+ */
+static bool parse_number(const char *text, int minimum, int *value) {
+    char *end;
+    long number = strtol(text, &end, 10);
+    while (isspace((unsigned char) *end)) {
+        end++;
+    }
+    if (end == text || *end != '\0' || number < minimum || number > 1000000000) {
+        return false;
+    }
+    *value = (int) number;
+    return true;
+}
+
+/**
+ * @brief Parses a comma separated list of numbers
+ *
+ * @param[in]  text    the text to parse
+ * @param[in]  minimum the smallest valid number
+ * @param[out] list    will contain the numbers (replaces previous content)
+ * @return true if text was a valid list
+ */
+static bool parse_list(const char *text, int minimum, ConfigList *list) {
+    // count the entries to size the list
+    int count = 1;
+    for (const char *c = text; *c != '\0'; c++) {
+        count += *c == ',';
+    }
+
+    int *values = malloc(sizeof(int) * count);
+    FATAL_ERROR_HANDLING(values == NULL, "[config] Failed to allocate list")
+
+    char *copy = strdup(text);
+    FATAL_ERROR_HANDLING(copy == NULL, "[config] Failed to allocate list")
+
+    char *save;
+    int index = 0;
+    for (char *token = strtok_r(copy, ",", &save); token != NULL;
+            token = strtok_r(NULL, ",", &save)) {
+        if (index >= count || !parse_number(token, minimum, &values[index])) {
+            free(copy);
+            free(values);
+            return false;
+        }
+        index++;
+    }
+    free(copy);
+
+    if (index != count) {
+        free(values);
+        return false;
+    }
+
+    free(list->values);
+    list->values = values;
+    list->count = count;
+    return true;
+}
+
+/**
+ * @brief Applies one option to the raw configuration
+ *
+ * @param[in]     program the name of the program (for error messages)
+ * @param[in]     key     the option (one of n, w, m, i, W, R, f, a, t, T)
+ * @param[in]     value   the value of the option
+ * @param[in,out] raw     the configuration to change
+ */
+static void apply_option(const char *program, char key, const char *value,
+        RawConfig *raw) {
+    bool valid = false;
+    switch (key) {
+        case 'n':
+            valid = parse_number(value, 1, &raw->philo_count);
+            break;
+        case 'W':
+            valid = parse_number(value, 0, &raw->workout_ms);
+            break;
+        case 'R':
+            valid = parse_number(value, 0, &raw->rest_ms);
+            break;
+        case 'f':
+            valid = parse_number(value, 0, &raw->fairness);
+            break;
+        case 't':
+            valid = parse_number(value, 0, &raw->workers);
+            break;
+        case 'T':
+            free(raw->trace_path);
+            raw->trace_path = strdup(value);
+            FATAL_ERROR_HANDLING(raw->trace_path == NULL,
+                    "[config] Failed to copy trace path")
+            valid = *value != '\0';
+            break;
+        case 'S':
+            free(raw->socket_path);
+            raw->socket_path = strdup(value);
+            FATAL_ERROR_HANDLING(raw->socket_path == NULL,
+                    "[config] Failed to copy socket path")
+            valid = *value != '\0';
+            break;
+        case 'w':
+            valid = parse_list(value, 1, &raw->weights);
+            break;
+        case 'm':
+            valid = parse_list(value, 1, &raw->masses);
+            break;
+        case 'i':
+            valid = parse_list(value, 1, &raw->inventory);
+            break;
+        case 'a':
+            if (strcmp(value, CONFIG_ALL_CPUS) == 0) {
+                // round robin over all online CPUs
+                int online = sysconf(_SC_NPROCESSORS_ONLN);
+                free(raw->cpus.values);
+                raw->cpus.values = malloc(sizeof(int) * online);
+                FATAL_ERROR_HANDLING(raw->cpus.values == NULL,
+                        "[config] Failed to allocate list")
+                for (int i = 0; i < online; i++) {
+                    raw->cpus.values[i] = i;
+                }
+                raw->cpus.count = online;
+                valid = online > 0;
+            } else {
+                valid = parse_list(value, 0, &raw->cpus);
+            }
+            break;
+    }
+    if (!valid) {
+        fprintf(stderr, "Invalid value \"%s\" for option %c\n", value, key);
+        usage(program, "All values must be positive numbers "
+                "(durations, fairness, CPUs and workers may be 0).");
+    }
+}
+
+/**
+ * @brief Reads a config file into the raw configuration
+ *
+ * @param[in]     program the name of the program (for error messages)
+ * @param[in]     path    the config file
+ * @param[in,out] raw     the configuration to change
+ */
+static void read_file(const char *program, const char *path, RawConfig *raw) {
+    FILE *file = fopen(path, "r");
+    FATAL_ERROR_HANDLING(file == NULL, "Failed to open config file")
+
+    static const struct {
+        const char *name;
+        char option;
+    } keys[] = { { "philosophers", 'n' }, { "weights", 'w' }, { "masses", 'm' },
+            { "inventory", 'i' }, { "workout", 'W' }, { "rest", 'R' },
+            { "fairness", 'f' }, { "cpus", 'a' },
+            { "workers", 't' }, { "trace", 'T' }, { "socket", 'S' } };
+
+    char line[CONFIG_LINE_SIZE];
+    int line_number = 0;
+    while (fgets(line, CONFIG_LINE_SIZE, file) != NULL) {
+        line_number++;
+
+        // strip comments and whitespace
+        line[strcspn(line, "#\n")] = '\0';
+        char *name = line;
+        while (isspace((unsigned char) *name)) {
+            name++;
+        }
+        if (*name == '\0') {
+            continue;
+        }
+
+        char *value = strchr(name, '=');
+        if (value == NULL) {
+            fprintf(stderr, "%s:%d: expected \"key = value\"\n", path,
+                    line_number);
+            exit(EXIT_FAILURE);
+        }
+        *value++ = '\0';
+        name[strcspn(name, " \t")] = '\0';
+        while (isspace((unsigned char) *value)) {
+            value++;
+        }
+
+        // spaces are allowed in lists
+        char *to = value;
+        for (char *from = value; *from != '\0'; from++) {
+            if (!isspace((unsigned char) *from)) {
+                *to++ = *from;
+            }
+        }
+        *to = '\0';
+
+        bool known = false;
+        for (size_t k = 0; k < sizeof(keys) / sizeof(keys[0]); k++) {
+            if (strcmp(name, keys[k].name) == 0) {
+                apply_option(program, keys[k].option, value, raw);
+                known = true;
+            }
+        }
+        if (!known) {
+            fprintf(stderr, "%s:%d: unknown key \"%s\"\n", path, line_number,
+                    name);
+            exit(EXIT_FAILURE);
+        }
+    }
+    fclose(file);
+}
+
+/**
+ * @brief Copies a list or the defaults, if the list is empty
+ *
+ * @param[in] list           the configured list
+ * @param[in] defaults       the default values
+ * @param[in] defaults_count number of default values
+ * @param[in] count          the number of values needed, values are repeated
+ *                           if there are less
+ * @return newly allocated array with count values
+ */
+static int* list_or_default(const ConfigList *list, const int defaults[],
+        int defaults_count, int count) {
+    const int *source = list->count > 0 ? list->values : defaults;
+    int source_count = list->count > 0 ? list->count : defaults_count;
+
+    int *values = malloc(sizeof(int) * count);
+    FATAL_ERROR_HANDLING(values == NULL, "[config] Failed to allocate list")
+    for (int i = 0; i < count; i++) {
+        values[i] = source[i % source_count];
+    }
+    return values;
+}
+
+/*
+ * Builds the configuration from defaults, config file and command line
+ */
+void config_load(Config *config, int argc, char **argv) {
+    static const int default_weights[] = { PHILOSOPHERS_WEIGHTS };
+    static const int default_masses[] = { GYM_DEFAULT_WEIGHT_MASSES };
+    static const int default_inventory[] = { GYM_DEFAULT_WEIGHTS_INVENTORY };
+
+    RawConfig raw = { .workout_ms = PHILOSOPHERS_WORKOUT_MS, .rest_ms =
+            PHILOSOPHERS_REST_MS };
+
+    // config file first, so the command line can override it
+    int option;
+    while ((option = getopt(argc, argv, CONFIG_OPTIONS)) != -1) {
+        if (option == 'c') {
+            read_file(argv[0], optarg, &raw);
+        } else if (option == '?') {
+            usage(argv[0], "Unknown option.");
+        }
+    }
+    optind = 1;
+    while ((option = getopt(argc, argv, CONFIG_OPTIONS)) != -1) {
+        if (option != 'c') {
+            apply_option(argv[0], option, optarg, &raw);
+        }
+    }
+    if (optind < argc) {
+        usage(argv[0], "Unexpected argument.");
+    }
+
+    // apply defaults
+    config->workout_ms = raw.workout_ms;
+    config->rest_ms = raw.rest_ms;
+    config->fairness = raw.fairness;
+    config->workers = raw.workers;
+    config->trace_path = raw.trace_path;
+    config->socket_path = raw.socket_path;
+    config->cpu_count = raw.cpus.count;
+    config->cpus = raw.cpus.values;
+    int default_weights_count = sizeof(default_weights) / sizeof(int);
+    config->philo_count = raw.philo_count;
+    if (config->philo_count == 0) {
+        config->philo_count =
+                raw.weights.count > 0 ? raw.weights.count : default_weights_count;
+    }
+    config->training_weights = list_or_default(&raw.weights, default_weights,
+            default_weights_count, config->philo_count);
+
+    if (raw.masses.count != raw.inventory.count
+            && (raw.masses.count > 0 || raw.inventory.count > 0)) {
+        if (raw.masses.count == 0 || raw.inventory.count == 0) {
+            usage(argv[0], "Masses and inventory must be configured together.");
+        }
+        usage(argv[0], "Masses and inventory must have the same length.");
+    }
+    config->weight_classes =
+            raw.masses.count > 0 ?
+                    raw.masses.count : GYM_DEFAULT_WEIGHT_CLASSES;
+    config->weight_masses = list_or_default(&raw.masses, default_masses,
+            GYM_DEFAULT_WEIGHT_CLASSES, config->weight_classes);
+    config->weights_inventory = list_or_default(&raw.inventory,
+            default_inventory, GYM_DEFAULT_WEIGHT_CLASSES,
+            config->weight_classes);
+    if (gym_solver_total_mass(config->weight_classes, config->weight_masses,
+            config->weights_inventory) == -1) {
+        char message[CONFIG_LINE_SIZE];
+        snprintf(message, sizeof(message), "Inventory too big, the total mass "
+                "(masses times counts) must not exceed %d.",
+                GYM_SOLVER_MAX_TOTAL);
+        usage(argv[0], message);
+    }
+
+    // a philosopher whose weight can never be handed out would wait forever
+    long mass = gym_solver_total_mass(config->weight_classes,
+            config->weight_masses, config->weights_inventory);
+    bool *reachable = malloc(sizeof(bool) * (mass + 1));
+    FATAL_ERROR_HANDLING(reachable == NULL,
+            "[config] Failed to allocate reachable totals")
+    gym_solver_reachable_totals(config->weight_classes, config->weight_masses,
+            config->weights_inventory, reachable);
+    for (int i = 0; i < config->philo_count; i++) {
+        int weight = config->training_weights[i];
+        if (weight > mass || !reachable[weight]) {
+            char message[CONFIG_LINE_SIZE];
+            snprintf(message, sizeof(message), "Training weight %d can not be "
+                    "made up from the inventory.", weight);
+            usage(argv[0], message);
+        }
+    }
+    free(reachable);
+
+    free(raw.weights.values);
+    free(raw.masses.values);
+    free(raw.inventory.values);
+}
+
+/*
+ * Frees the memory held by a configuration
+ */
+void config_free(Config *config) {
+    free(config->training_weights);
+    free(config->weight_masses);
+    free(config->weights_inventory);
+    free(config->cpus);
+    free(config->trace_path);
+    free(config->socket_path);
+    config->training_weights = NULL;
+    config->trace_path = NULL;
+    config->socket_path = NULL;
+    config->cpus = NULL;
+    config->weight_masses = NULL;
+    config->weights_inventory = NULL;
+}
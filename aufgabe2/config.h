@@ -0,0 +1,77 @@
+/** ****************************************************************
+ * @file    aufgabe2/config.h
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    09.12.2016
+ * @brief   Header for the Configuration module
+ *
+ * Philosophers and gym inventory can be configured on the command line or in
+ * a config file. Command line options override the config file.
+ *
+ * Options:
+ *   -c FILE         read configuration from FILE
+ *   -n COUNT        number of philosophers (training weights are repeated)
+ *   -w W1,W2,...    training weights of the philosophers
+ *   -m M1,M2,...    mass of every kind of weight
+ *   -i I1,I2,...    how many weights of every kind the gym has
+ *   -W MS           duration of the workout phase in milliseconds
+ *   -R MS           duration of the rest phase in milliseconds
+ *   -f N            fair gym, nobody is overtaken more than N times (0: off)
+ *   -a C1,C2,...    pin the philosophers round robin to these CPUs, "all"
+ *                   for all online CPUs
+ *   -t WORKERS      run the philosophers as tasks on WORKERS threads (0: one
+ *                   thread per philosopher)
+ *   -T FILE         trace state changes and commands, written to FILE on
+ *                   quit (see trace.h, convert with trace2json)
+ *   -S SOCKET       also accept commands on the Unix domain socket SOCKET
+ *                   (see control.h)
+ *
+ * Config file: one "key = value" per line, keys are philosophers, weights,
+ * masses, inventory, workout, rest, fairness, cpus, workers, trace and
+ * socket, values as for the options.
+ * '#' starts a comment.
+ ******************************************************************
+ */
+
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+/**
+ * @brief Complete configuration of the program
+ */
+typedef struct {
+    int philo_count;          //!< number of philosophers
+    int workout_ms;           //!< duration of the workout phase
+    int rest_ms;              //!< duration of the rest phase
+    int fairness;             //!< overtaking bound of the gym, 0 if not fair
+    int cpu_count;            //!< number of CPUs to pin to, 0 for no pinning
+    int *cpus;                //!< the CPUs to pin the philosophers to
+    int workers;              //!< worker threads for tasks, 0 for threads
+    char *trace_path;         //!< where to write the trace, NULL for none
+    char *socket_path;        //!< control socket, NULL for stdin only
+    int *training_weights;    //!< training weight of every philosopher
+    int weight_classes;       //!< number of different kinds of weights
+    int *weight_masses;       //!< mass of every kind of weight
+    int *weights_inventory;   //!< number of weights of every kind
+} Config;
+
+/**
+ * @brief Builds the configuration from defaults, config file and command line
+ *
+ * Prints a message and exits the program on invalid options.
+ *
+ * @param[out] config will contain the configuration
+ * @param[in]  argc   command line argument count
+ * @param[in]  argv   command line arguments
+ */
+void config_load(Config *config, int argc, char **argv);
+
+/**
+ * @brief Frees the memory held by a configuration
+ *
+ * @param[in] config the configuration to free
+ */
+void config_free(Config *config);
+
+#endif /* CONFIG_H_ */
@@ -0,0 +1,707 @@
+/** ****************************************************************
+ * @file    aufgabe2/control.c
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    16.12.2016
+ * @brief   Implementation for the Control module
+ ******************************************************************
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "control.h"
+#include "gym.h"
+#include "philosophers.h"
+#include "stats.h"
+#include "errors.h"
+
+/**
+ * @brief Command used to block philosophers
+ */
+#define BLOCK_CMD 'b'
+
+/**
+ * @brief Command used to unblock philosophers
+ */
+#define UNBLOCK_CMD 'u'
+
+/**
+ * @brief Command used to proceed philosophers
+ */
+#define PROCEED_CMD 'p'
+
+/**
+ * @brief Command used to set the duration of the workout phase
+ */
+#define WORKOUT_CMD 'w'
+
+/**
+ * @brief Command used to set the duration of the rest phase
+ */
+#define REST_CMD 'r'
+
+/**
+ * @brief Command used to get the status of philosophers
+ */
+#define INFO_CMD 'i'
+
+/**
+ * @brief Command used to print the gym statistics (build with GYM_STATS=1)
+ */
+#define STATS_CMD 's'
+
+/**
+ * @brief Command used to quit all philosopher threads
+ */
+#define QUIT_CMD 'q'
+
+/**
+ * @brief Alternative Command used to quit all philosopher threads
+ */
+#define ALTERNATIVE_QUIT_CMD 'Q'
+
+/**
+ * @brief Separates the commands of a line
+ */
+#define COMMAND_SEPARATOR ';'
+
+/**
+ * @brief IDs of all philosophers
+ */
+#define ALL_IDS '*'
+
+/**
+ * @brief Where commands come from: stdin or a socket client
+ */
+typedef struct Connection {
+    int fd;                       //!< the file descriptor to read
+    bool console;                 //!< true for stdin, replies go to stdout
+    int used;                     //!< bytes in line
+    char line[CONTROL_LINE_MAX];  //!< input not yet executed
+    struct Connection *next;      //!< next socket client
+} Connection;
+
+/**
+ * @brief Cleared by the quit command
+ */
+static bool running = true;
+
+/**
+ * @brief All socket clients
+ */
+static Connection *clients = NULL;
+
+/**
+ * @brief Reports a failed command
+ *
+ * @param[in] connection where the command came from
+ * @param[in] out        where the reply goes
+ * @param[in] format     printf format of the message
+ */
+static void reply_error(const Connection *connection, FILE *out,
+        const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    fprintf(out, connection->console ? "\n!!! " : "error ");
+    vfprintf(out, format, args);
+    fprintf(out, connection->console ? " !!!\n\n" : "\n");
+    va_end(args);
+}
+
+/**
+ * @brief Reports a successful command (socket clients only)
+ *
+ * @param[in] connection where the command came from
+ * @param[in] out        where the reply goes
+ * @param[in] count      the number of philosophers affected
+ */
+static void reply_ok(const Connection *connection, FILE *out, int count) {
+    if (!connection->console) {
+        fprintf(out, "ok %d\n", count);
+    }
+}
+
+/**
+ * @brief Prints the commands
+ *
+ * @param[in] out where to print them
+ */
+static void print_help(FILE *out) {
+    int last = philosophers_get_count() - 1;
+    fprintf(out, "\n!!! Commands have structure \"CMD [ID]\" !!!\n");
+    fprintf(out, "Use \"%c[0-%d]\" for blocking \n", BLOCK_CMD, last);
+    fprintf(out, "Use \"%c[0-%d]\" for unblocking \n", UNBLOCK_CMD, last);
+    fprintf(out, "Use \"%c[0-%d]\" for proceeding \n", PROCEED_CMD, last);
+    fprintf(out, "IDs can be ranges and lists (\"%c0-3,7\"), \"%c\" is "
+            "everybody \n", BLOCK_CMD, ALL_IDS);
+    fprintf(out, "Use \"%cMS\" / \"%cMS\" for setting the workout / rest "
+            "duration \n", WORKOUT_CMD, REST_CMD);
+    fprintf(out, "Use \"%c\" or \"%c[IDS]\" for the status \n", INFO_CMD,
+            INFO_CMD);
+    fprintf(out, "Use \"%c\" for statistics \n", STATS_CMD);
+    fprintf(out, "Use \"%c\" or \"%c\" for quitting \n", QUIT_CMD,
+            ALTERNATIVE_QUIT_CMD);
+    fprintf(out, "Separate several commands with \"%c\" \n",
+            COMMAND_SEPARATOR);
+    fprintf(out, "\n");
+}
+
+/**
+ * @brief Parses a number that is known to start with a digit
+ *
+ * @param[in]  text the text
+ * @param[out] end  will point behind the number
+ * @return the number, INT_MAX if it is bigger
+ */
+static int parse_number(const char *text, char **end) {
+    long number = strtol(text, end, 10);
+    return number > INT_MAX ? INT_MAX : number;
+}
+
+/**
+ * @brief Parses the next ID or range of an ID list
+ *
+ * @param[in]  ids   the rest of the list
+ * @param[out] first the first ID of the range
+ * @param[out] last  the last ID of the range
+ * @return the rest of the list behind the range, NULL if it is malformed
+ */
+static const char* next_range(const char *ids, int *first, int *last) {
+    if (*ids == ALL_IDS) {
+        *first = 0;
+        *last = philosophers_get_count() - 1;
+        ids++;
+    } else {
+        char *end;
+        if (!isdigit((unsigned char) *ids)) {
+            return NULL;
+        }
+        *first = *last = parse_number(ids, &end);
+        ids = end;
+        if (*ids == '-') {
+            ids++;
+            if (!isdigit((unsigned char) *ids)) {
+                return NULL;
+            }
+            *last = parse_number(ids, &end);
+            ids = end;
+        }
+    }
+
+    if (*ids == ',') {
+        ids++;
+        return *ids == '\0' ? NULL : ids;
+    }
+    return *ids == '\0' ? ids : NULL;
+}
+
+/**
+ * @brief Checks an ID list
+ *
+ * @param[in] connection where the command came from
+ * @param[in] out        where errors go
+ * @param[in] ids        the list
+ * @return true if the list is well formed and all IDs exist
+ */
+static bool check_ids(const Connection *connection, FILE *out,
+        const char *ids) {
+    int first, last;
+    int count = philosophers_get_count();
+    if (*ids == '\0') {
+        reply_error(connection, out, "Missing ID - valid ids are [0-%d]",
+                count - 1);
+        return false;
+    }
+    while (*ids != '\0') {
+        ids = next_range(ids, &first, &last);
+        if (ids == NULL) {
+            reply_error(connection, out, "Malformed ID list - use e.g. "
+                    "\"3\", \"0-999\", \"1,5,10-20\" or \"%c\"", ALL_IDS);
+            return false;
+        }
+        if (first > last) {
+            reply_error(connection, out, "Empty range %d-%d", first, last);
+            return false;
+        }
+        int invalid = first >= count ? first : last;
+        if (invalid >= count) {
+            reply_error(connection, out, "There is no Philosopher with id %d "
+                    "- valid ids are [0-%d]", invalid, count - 1);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Applies a command to every philosopher of an ID list
+ *
+ * @param[in] connection where the command came from
+ * @param[in] out        where the reply goes
+ * @param[in] ids        the list
+ * @param[in] apply      philosophers_block, philosophers_unblock or
+ *                       philosophers_proceed
+ */
+static void apply_to_ids(const Connection *connection, FILE *out,
+        const char *ids, int (*apply)(int)) {
+    if (!check_ids(connection, out, ids)) {
+        return;
+    }
+
+    int applied = 0;
+    int first, last;
+    while (*ids != '\0') {
+        ids = next_range(ids, &first, &last);
+        for (int id = first; id <= last; id++) {
+            apply(id);
+            applied++;
+        }
+    }
+    reply_ok(connection, out, applied);
+}
+
+/**
+ * @brief Sets the duration of the workout or the rest phase
+ *
+ * @param[in] connection where the command came from
+ * @param[in] out        where the reply goes
+ * @param[in] command    WORKOUT_CMD or REST_CMD
+ * @param[in] value      the duration in milliseconds
+ */
+static void set_duration(const Connection *connection, FILE *out,
+        char command, const char *value) {
+    char *end;
+    int ms = isdigit((unsigned char) *value) ? parse_number(value, &end) : -1;
+    if (ms < 0 || *end != '\0') {
+        reply_error(connection, out, "Durations are milliseconds, e.g. "
+                "\"%c500\"", command);
+        return;
+    }
+
+    int workout, rest;
+    philosophers_get_durations(&workout, &rest);
+    if (command == WORKOUT_CMD) {
+        workout = ms;
+    } else {
+        rest = ms;
+    }
+    philosophers_set_durations(workout, rest);
+    reply_ok(connection, out, philosophers_get_count());
+}
+
+/**
+ * @brief Prints weight counts as a comma separated list
+ *
+ * @param[in] out    where to print them
+ * @param[in] counts gym_weight_classes counts, NULL to print "?"
+ */
+static void print_counts(FILE *out, const int counts[]) {
+    if (counts == NULL) {
+        fprintf(out, "?");
+        return;
+    }
+    for (int i = 0; i < gym_weight_classes; i++) {
+        fprintf(out, i == 0 ? "%d" : ",%d", counts[i]);
+    }
+}
+
+/**
+ * @brief Prints the status of philosophers
+ *
+ * @param[in] connection where the command came from
+ * @param[in] out        where the reply goes
+ * @param[in] ids        the philosophers, empty for a summary of everybody
+ */
+static void print_status(const Connection *connection, FILE *out,
+        const char *ids) {
+    char state, command;
+    int weight;
+    int count = philosophers_get_count();
+
+    // the weights come from a snapshot, so they always add up to the
+    // inventory. The rest is read philosopher by philosopher.
+    int *gym_weights = malloc(sizeof(int) * gym_weight_classes * (count + 1));
+    FATAL_ERROR_HANDLING(gym_weights == NULL,
+            "[print_status] Failed to allocate memory")
+    int *weight_counts = gym_weights + gym_weight_classes;
+    bool consistent = philosophers_snapshot(gym_weights, weight_counts);
+
+    if (*ids == '\0') {
+        static const char states[] = "GWPRU";
+        int per_state[sizeof(states)] = { 0 };
+        int blocked = 0;
+        for (int id = 0; id < count; id++) {
+            philosophers_get_status(id, &state, &command, &weight);
+            per_state[strchr(states, state) - states]++;
+            blocked += command == BLOCK_CMD;
+        }
+        int workout, rest;
+        philosophers_get_durations(&workout, &rest);
+        fprintf(out, "philosophers=%d", count);
+        for (int s = 0; states[s] != '\0'; s++) {
+            fprintf(out, " %c=%d", states[s], per_state[s]);
+        }
+        fprintf(out, " blocked=%d workout_ms=%d rest_ms=%d gym=", blocked,
+                workout, rest);
+        print_counts(out, consistent ? gym_weights : NULL);
+        // held weights summed up over all philosophers
+        for (int id = 1; consistent && id < count; id++) {
+            for (int i = 0; i < gym_weight_classes; i++) {
+                weight_counts[i] += weight_counts[id * gym_weight_classes + i];
+            }
+        }
+        fprintf(out, " held=");
+        print_counts(out, consistent && count > 0 ? weight_counts : NULL);
+        fprintf(out, "\n");
+        free(gym_weights);
+        reply_ok(connection, out, count);
+        return;
+    }
+
+    if (!check_ids(connection, out, ids)) {
+        free(gym_weights);
+        return;
+    }
+    int listed = 0;
+    int first, last;
+    while (*ids != '\0') {
+        ids = next_range(ids, &first, &last);
+        for (int id = first; id <= last; id++, listed++) {
+            philosophers_get_status(id, &state, &command, &weight);
+            fprintf(out, "%d %d %c %c ", id, weight, state, command);
+            print_counts(out, consistent
+                    ? weight_counts + id * gym_weight_classes : NULL);
+            fprintf(out, "\n");
+        }
+    }
+    free(gym_weights);
+    reply_ok(connection, out, listed);
+}
+
+/**
+ * @brief Executes one command
+ *
+ * @param[in] connection where the command came from
+ * @param[in] out        where the reply goes
+ * @param[in] command    the command without spaces
+ */
+static void execute_command(const Connection *connection, FILE *out,
+        const char *command) {
+    switch (command[0]) {
+        case QUIT_CMD:
+        case ALTERNATIVE_QUIT_CMD:
+            running = false;
+            reply_ok(connection, out, philosophers_get_count());
+            break;
+        case BLOCK_CMD:
+            apply_to_ids(connection, out, &command[1], philosophers_block);
+            break;
+        case UNBLOCK_CMD:
+            apply_to_ids(connection, out, &command[1], philosophers_unblock);
+            break;
+        case PROCEED_CMD:
+            apply_to_ids(connection, out, &command[1], philosophers_proceed);
+            break;
+        case WORKOUT_CMD:
+        case REST_CMD:
+            set_duration(connection, out, command[0], &command[1]);
+            break;
+        case INFO_CMD:
+            print_status(connection, out, &command[1]);
+            break;
+        case STATS_CMD:
+            if (connection->console) {
+                fprintf(out, "\n");
+            }
+            if (!control_print_stats(out)) {
+                reply_error(connection, out, "Statistics are not compiled in, "
+                        "build with \"make GYM_STATS=1\"");
+            } else if (connection->console) {
+                fprintf(out, "\n");
+            } else {
+                reply_ok(connection, out, 0);
+            }
+            break;
+        default: /* Unknown command */
+            if (connection->console) {
+                print_help(out);
+            } else {
+                reply_error(connection, out, "Unknown command \"%s\"", command);
+            }
+    }
+}
+
+/**
+ * @brief Executes all commands of a line
+ *
+ * @param[in]     connection where the line came from
+ * @param[in]     out        where the replies go
+ * @param[in,out] line       the line, is changed
+ */
+static void execute_line(const Connection *connection, FILE *out,
+        char *line) {
+    char *command = line;
+    while (running && command != NULL) {
+        char *next = strchr(command, COMMAND_SEPARATOR);
+        if (next != NULL) {
+            *next++ = '\0';
+        }
+
+        // spaces are allowed anywhere ("b 3")
+        char *to = command;
+        for (char *from = command; *from != '\0'; from++) {
+            if (!isspace((unsigned char) *from)) {
+                *to++ = *from;
+            }
+        }
+        *to = '\0';
+        if (*command != '\0') {
+            execute_command(connection, out, command);
+        }
+        command = next;
+    }
+}
+
+/**
+ * @brief Sends a reply to a socket client
+ *
+ * @param[in] fd     the socket
+ * @param[in] reply  the reply
+ * @param[in] length its length in bytes
+ * @return false if the client is gone
+ */
+static bool send_reply(int fd, const char *reply, size_t length) {
+    while (length > 0) {
+        // no SIGPIPE if the client has gone away
+        ssize_t sent = send(fd, reply, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0) {
+            return false;
+        }
+        reply += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+/**
+ * @brief Reads from a connection and executes all complete lines
+ *
+ * @param[in] connection the connection
+ * @return false if the connection is closed
+ */
+static bool handle_input(Connection *connection) {
+    ssize_t length = read(connection->fd, &connection->line[connection->used],
+            CONTROL_LINE_MAX - connection->used);
+    if (length < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return true;
+    }
+    bool open = length > 0;
+    if (open) {
+        connection->used += length;
+    } else if (connection->used < CONTROL_LINE_MAX) {
+        // the last line may lack its newline
+        connection->line[connection->used++] = '\n';
+    }
+
+    char *reply = NULL;
+    size_t reply_length = 0;
+    FILE *out = connection->console ?
+            stdout : open_memstream(&reply, &reply_length);
+    FATAL_ERROR_HANDLING(out == NULL, "[control] Failed to open reply")
+
+    char *line = connection->line;
+    char *end = &connection->line[connection->used];
+    char *newline;
+    while (running && (newline = memchr(line, '\n', end - line)) != NULL) {
+        *newline = '\0';
+        execute_line(connection, out, line);
+        line = newline + 1;
+    }
+    connection->used = end - line;
+    memmove(connection->line, line, connection->used);
+    if (connection->used == CONTROL_LINE_MAX) {
+        reply_error(connection, out, "Lines are limited to %d characters",
+                CONTROL_LINE_MAX - 1);
+        connection->used = 0;
+    }
+
+    if (connection->console) {
+        fflush(stdout);
+        return open;
+    }
+    fclose(out);
+    open = send_reply(connection->fd, reply, reply_length) && open;
+    free(reply);
+    return open;
+}
+
+/**
+ * @brief Adds a file descriptor to the epoll set
+ *
+ * @param[in] epoll      the epoll instance
+ * @param[in] fd         the file descriptor
+ * @param[in] connection the connection of fd, NULL for the listening socket
+ * @return false if fd can not be watched (regular files)
+ */
+static bool watch(int epoll, int fd, Connection *connection) {
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = connection };
+    return epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+/**
+ * @brief Creates the listening socket
+ *
+ * @param[in] path where to create it
+ * @return the socket
+ */
+static int open_socket(const char *path) {
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    FATAL_ERROR_HANDLING(strlen(path) >= sizeof(address.sun_path),
+            "[control] Socket path is too long")
+    strcpy(address.sun_path, path);
+
+    // replace the socket of an earlier run, but nothing else
+    struct stat info;
+    if (lstat(path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+        unlink(path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    FATAL_ERROR_HANDLING(fd < 0, "[control] Failed to create socket")
+    FATAL_ERROR_HANDLING(
+            bind(fd, (struct sockaddr*) &address, sizeof(address)) != 0
+                    || listen(fd, CONTROL_BACKLOG) != 0,
+            "[control] Failed to listen on socket")
+    return fd;
+}
+
+/**
+ * @brief Accepts a socket client
+ *
+ * @param[in] epoll  the epoll instance
+ * @param[in] listen the listening socket
+ */
+static void accept_client(int epoll, int listen) {
+    int fd = accept4(listen, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    Connection *client = malloc(sizeof(Connection));
+    FATAL_ERROR_HANDLING(client == NULL, "[control] Failed to allocate client")
+    client->fd = fd;
+    client->console = false;
+    client->used = 0;
+    client->next = clients;
+    clients = client;
+    FATAL_ERROR_HANDLING(!watch(epoll, fd, client),
+            "[control] Failed to watch client")
+}
+
+/**
+ * @brief Closes a socket client
+ *
+ * @param[in] client the client
+ */
+static void close_client(Connection *client) {
+    Connection **link = &clients;
+    while (*link != client) {
+        link = &(*link)->next;
+    }
+    *link = client->next;
+    close(client->fd);
+    free(client);
+}
+
+/*
+ * Reads and executes commands until one of them is quit
+ */
+void control_run(const char *socket_path) {
+    int epoll = epoll_create1(EPOLL_CLOEXEC);
+    FATAL_ERROR_HANDLING(epoll < 0, "[control] Failed to create epoll")
+
+    int listen = -1;
+    if (socket_path != NULL) {
+        listen = open_socket(socket_path);
+        FATAL_ERROR_HANDLING(!watch(epoll, listen, NULL),
+                "[control] Failed to watch socket")
+    }
+
+    // stdin redirected from a file can't be watched, it is read right away
+    Connection *console = malloc(sizeof(Connection));
+    FATAL_ERROR_HANDLING(console == NULL,
+            "[control] Failed to allocate console")
+    console->fd = STDIN_FILENO;
+    console->console = true;
+    console->used = 0;
+    bool console_open = true;
+    if (!watch(epoll, STDIN_FILENO, console)) {
+        while (running && handle_input(console)) {
+        }
+        console_open = false;
+    }
+
+    struct epoll_event events[CONTROL_MAX_EVENTS];
+    while (running && (console_open || listen >= 0)) {
+        int count = epoll_wait(epoll, events, CONTROL_MAX_EVENTS, -1);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        FATAL_ERROR_HANDLING(count < 0, "[control] Failed to wait for input")
+
+        for (int e = 0; e < count && running; e++) {
+            Connection *connection = events[e].data.ptr;
+            if (connection == NULL) {
+                accept_client(epoll, listen);
+            } else if (!handle_input(connection)) {
+                if (connection == console) {
+                    epoll_ctl(epoll, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+                    console_open = false;
+                } else {
+                    close_client(connection);
+                }
+            }
+        }
+    }
+
+    while (clients != NULL) {
+        close_client(clients);
+    }
+    if (listen >= 0) {
+        close(listen);
+        unlink(socket_path);
+    }
+    free(console);
+    close(epoll);
+}
+
+/*
+ * Prints the gym statistics of all philosophers so far
+ */
+bool control_print_stats(FILE *file) {
+#ifdef GYM_STATS
+    StatsSnapshot *snapshot = malloc(sizeof(StatsSnapshot));
+    FATAL_ERROR_HANDLING(snapshot == NULL, "Failed to allocate snapshot")
+    stats_snapshot(snapshot, STATS_ALL_LABELS);
+    stats_print(file, snapshot);
+    free(snapshot);
+    return true;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,79 @@
+/** ****************************************************************
+ * @file    aufgabe2/control.h
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    16.12.2016
+ * @brief   Header for the Control module
+ *
+ * Reads commands from stdin and, if configured (-S), from any number of
+ * clients of a Unix domain socket. All of them are multiplexed with epoll on
+ * the main thread.
+ *
+ * A line holds one or more commands separated by ';', spaces are ignored:
+ *   bIDS    block the philosophers
+ *   uIDS    unblock the philosophers
+ *   pIDS    proceed the philosophers
+ *   wMS     set the duration of the workout phase
+ *   rMS     set the duration of the rest phase
+ *   i[IDS]  status: without IDS a summary line
+ *           "philosophers=N G=N W=N P=N R=N U=N blocked=N workout_ms=N
+ *           rest_ms=N gym=W,W,W held=W,W,W" (weights in the gym and held by
+ *           all philosophers), with IDS one line
+ *           "ID WEIGHT STATE COMMAND W,W,W" (weights held) per philosopher.
+ *           The weights are a snapshot (see philosophers_snapshot) and "?"
+ *           if there was none.
+ *   s       gym statistics (build with GYM_STATS=1)
+ *   q, Q    quit
+ * IDS is a comma separated list of IDs and ranges, "*" is everybody:
+ * "b3", "b0-999", "u*", "p1,5,10-20". A list with an invalid ID is rejected
+ * as a whole.
+ *
+ * Socket clients get a reply for every command: "ok N" (N philosophers were
+ * affected or listed, after the status lines) or "error MESSAGE". The
+ * replies to everything one read returned are sent with a single write, so
+ * a script can send thousands of commands at once and then read all
+ * replies. On stdin nothing is printed on success, as before.
+ ******************************************************************
+ */
+
+#ifndef CONTROL_H_
+#define CONTROL_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/**
+ * @brief Longest command line, including the newline
+ */
+#define CONTROL_LINE_MAX 4096
+
+/**
+ * @brief Events handled per epoll_wait
+ */
+#define CONTROL_MAX_EVENTS 16
+
+/**
+ * @brief Connections the socket queues before they are accepted
+ */
+#define CONTROL_BACKLOG 16
+
+/**
+ * @brief Reads and executes commands until one of them is quit
+ *
+ * Also returns when stdin is closed and there is no socket.
+ *
+ * @param[in] socket_path the Unix domain socket to listen on, NULL for stdin
+ *                        only. An old socket at this path is replaced.
+ */
+void control_run(const char *socket_path);
+
+/**
+ * @brief Prints the gym statistics of all philosophers so far
+ *
+ * @param[in] file where to print them
+ * @return false if statistics are not compiled in (build with GYM_STATS=1)
+ */
+bool control_print_stats(FILE *file);
+
+#endif /* CONTROL_H_ */
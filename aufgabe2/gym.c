@@ -9,99 +9,123 @@
  */
 
 #include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "gym.h"
+#include "gym_admission.h"
+#ifdef GYM_ADAPTIVE_LOCK
+#include "adaptive_lock.h"
+#endif
 #include "philosophers.h"
+#include "seqlock.h"
+#include "stats.h"
+#include "tasks.h"
 #include "errors.h"
 
+#ifdef GYM_ADAPTIVE_LOCK
+/**
+ * @brief Lock used to guard Monitor methods (spins, then parks)
+ */
+static AdaptiveLock mtx;
+#else
 /**
  * @brief Mutex used to guard Monitor methods
  */
 static pthread_mutex_t mtx;
+#endif
 
 /**
- * @brief Condition variable
+ * @brief Odd while a monitor method may be changing weights, see gym_snapshot
+ *
+ * Only written while holding mtx.
  */
-static pthread_cond_t no_weights;
+static SeqLock snapshot_lock;
 
-/*
- * Array used to store how many of the different kinds of weights are
- *        available
+/**
+ * @brief A philosopher waiting for weights
+ *
+ * Lives on the stack of the waiting thread (or task). gym_return_weights only
+ * posts the semaphores of waiters whose total has become possible, instead of
+ * waking everybody.
  */
-const int gym_weights_availiable[GYM_WEIGHTS_AVAILIABLE_SIZE] = { 4, 4, 5 };
+typedef struct {
+    GymTicket ticket;  //!< place in the wait queue, must be the first member
+    TaskSem wakeup;    //!< posted once the total has become possible
+} GymWaiter;
 
 /**
- * @brief Array used to store how many of the different kinds of weights are
- *        available
+ * @brief Enters the monitor
+ *
+ * @return 0 on success, an error number otherwise
  */
-static int weights_availiable[GYM_WEIGHTS_AVAILIABLE_SIZE];
+static inline int lock_monitor() {
+#ifdef GYM_ADAPTIVE_LOCK
+    adaptive_lock(&mtx);
+    int res = 0;
+#else
+    int res = pthread_mutex_lock(&mtx);
+#endif
+    if (res == 0) {
+        seqlock_write_begin(&snapshot_lock);
+    }
+    return res;
+}
 
 /**
- * @brief The mass of the different kinds of weights
+ * @brief Leaves the monitor
  */
-static int weight_masses[GYM_WEIGHTS_AVAILIABLE_SIZE] = { 2, 3, 5 };
+static inline void unlock_monitor() {
+    seqlock_write_end(&snapshot_lock);
+#ifdef GYM_ADAPTIVE_LOCK
+    adaptive_unlock(&mtx);
+#else
+    pthread_mutex_unlock(&mtx);
+#endif
+}
 
 /**
- * @brief Checks whether the amount specified can be achieved
+ * @brief Wakes up a waiter taken out of its queue by gym_admission_wake
  *
- * Assumes that weights is empty and has the same size and structure as
- * weights_availiable
+ * Must be called while holding mtx.
  *
- * @param[in]  total         the total weight requested
- * @param[out] weight_counts will contain weights if message returns true
- * @param[in]  current_index the current index to search for weights
- * @return true, if total can be achieved
+ * @param[in] ticket  the ticket of the waiter
+ * @param[in] context unused
  */
-static bool is_combination_possible(int total, int weight_counts[],
-        int current_index) {
-    if (current_index < 0 || current_index >= GYM_WEIGHTS_AVAILIABLE_SIZE) {
-        return false;
-    }
-    if (total == 0) {
-        return true;
-    }
-
-    if (total < weight_masses[current_index]
-            || weights_availiable[current_index] == 0) {
-        return is_combination_possible(total, weight_counts, current_index - 1);
-    } else {
-        // "transfer" 1 weight from gym to philosopher
-        total -= weight_masses[current_index];
-        weight_counts[current_index]++;
-        weights_availiable[current_index]--;
-
-        if (is_combination_possible(total, weight_counts, current_index)) {
-            return true;
-        } else {
-            // "transfer" 1 weight back from philosopher to gym
-            total += weight_masses[current_index];
-            weight_counts[current_index]--;
-            weights_availiable[current_index]++;
-
-            // try again one weight class deeper
-            return is_combination_possible(total, weight_counts,
-                    current_index - 1);
-        }
+static void wake_waiter(GymTicket *ticket, void *context) {
+    GymWaiter *waiter = (GymWaiter*) ticket;
+    if (ticket->granted) {
+        philosophers_weights_changed(ticket->weight_counts,
+                gym_admission_availiable());
     }
+    tasks_sem_post(&waiter->wakeup);
 }
 
 /*
  * Initializes the Gym
  */
-void gym_init() {
-    // init weight counts
-    for(int i = 0; i < GYM_WEIGHTS_AVAILIABLE_SIZE; i++){
-        weights_availiable[i] = gym_weights_availiable[i];
-    }
+void gym_init(int classes, const int masses[], const int inventory[]) {
+    gym_admission_init(classes, masses, inventory);
+    seqlock_init(&snapshot_lock);
 
     // init monitor
+#ifdef GYM_ADAPTIVE_LOCK
+    adaptive_lock_init(&mtx);
+#else
     int res = pthread_mutex_init(&mtx, NULL);
     FATAL_ERROR_HANDLING(res, "[gym_init] Failed to create Mutex")
+#endif
+}
 
-    res = pthread_cond_init(&no_weights, NULL);
-    FATAL_ERROR_HANDLING(res, "[gym_init] Failed to create condition variable")
+/*
+ * Switches fair mode on or off
+ */
+void gym_set_fairness(int overtakes) {
+    int res = lock_monitor();
+    FATAL_ERROR_HANDLING(res, "[gym_set_fairness] Failed to lock mutex")
+    gym_admission_set_fairness(overtakes);
+    unlock_monitor();
 }
 
 /*
@@ -109,40 +133,101 @@ void gym_init() {
  *
  * This method will check which weights are available and then try to find a
  * combination that sums up to the required total. If it finds one, the weights
- * will be handed out (signaled by a return value of 0). If not, an error code
- * is returned
+ * will be handed out. If not, the caller is queued and sleeps until
+ * gym_return_weights finds that its total has become possible.
  */
 void gym_get_weights(int total, int weight_counts[]) {
-    int res = pthread_mutex_lock(&mtx);
+    long start = STATS_START();
+    int res = lock_monitor();
     FATAL_ERROR_HANDLING(res, "[gym_get_weights] Failed to lock mutex")
-
-    while (!is_combination_possible(total, weight_counts,
-    GYM_WEIGHTS_AVAILIABLE_SIZE - 1)) {
-        res = pthread_cond_wait(&no_weights, &mtx);
-        FATAL_ERROR_HANDLING(res, "[gym_get_weights] Wait on condition variable failed")
+    long locked = STATS_NOW(start);
+    STATS_RECORD_SPAN(STATS_GYM_LOCK, start, locked);
+
+    if (gym_admission_try(total, weight_counts)) {
+        philosophers_weights_changed(weight_counts, gym_admission_availiable());
+        STATS_RECORD(STATS_GYM_HOLD, locked);
+        unlock_monitor();
+        STATS_RECORD(STATS_GYM_WAIT, start);
+        return;
     }
 
-    philosophers_display_status(weights_availiable);
-
-    pthread_mutex_unlock(&mtx);
+    // not possible right now - queue up and wait for gym_return_weights
+    GymWaiter self;
+    FATAL_ERROR_HANDLING(
+            !gym_admission_queue(total, &self.ticket, weight_counts),
+            "[gym_get_weights] Total can never be handed out")
+    tasks_sem_init(&self.wakeup);
+    do {
+        STATS_RECORD(STATS_GYM_HOLD, locked);
+        unlock_monitor();
+        tasks_sem_wait(&self.wakeup);
+        STATS_COUNT(STATS_GYM_WAKEUPS);
+        long woken = STATS_NOW(start);
+        res = lock_monitor();
+        FATAL_ERROR_HANDLING(res, "[gym_get_weights] Failed to lock mutex")
+        locked = STATS_NOW(start);
+        STATS_RECORD_SPAN(STATS_GYM_LOCK, woken, locked);
+
+        if (self.ticket.granted) {
+            // starving - gym_return_weights handed the weights over directly
+            break;
+        }
+        if (gym_admission_try(total, weight_counts)) {
+            philosophers_weights_changed(weight_counts,
+                    gym_admission_availiable());
+            break;
+        }
+        // somebody else was faster - keep our place at the front
+        STATS_COUNT(STATS_GYM_SPURIOUS);
+        gym_admission_requeue(total, &self.ticket);
+    } while (true);
+
+    STATS_RECORD(STATS_GYM_HOLD, locked);
+    unlock_monitor();
+    tasks_sem_destroy(&self.wakeup);
+    STATS_RECORD(STATS_GYM_WAIT, start);
 }
 
 /*
  * [MONITOR METHOD] Returns weights from the caller to the gym.
  */
 void gym_return_weights(int weight_counts[]) {
-    int res = pthread_mutex_lock(&mtx);
+    long start = STATS_START();
+    int res = lock_monitor();
     FATAL_ERROR_HANDLING(res, "[gym_return_weights] Failed to lock mutex")
+    long locked = STATS_NOW(start);
+    STATS_RECORD_SPAN(STATS_GYM_LOCK, start, locked);
 
-    for (int i = 0; i < GYM_WEIGHTS_AVAILIABLE_SIZE; i++) {
-        // "transfer" weights to gym
-        weights_availiable[i] += weight_counts[i];
-        weight_counts[i] = 0;
-    }
+    gym_admission_return(weight_counts);
+    philosophers_weights_changed(weight_counts, gym_admission_availiable());
+    gym_admission_wake(wake_waiter, NULL);
 
-    philosophers_display_status(weights_availiable);
+    STATS_RECORD(STATS_GYM_HOLD, locked);
+    unlock_monitor();
+}
 
-    // notify threads who might be blocking on the condition
-    pthread_cond_broadcast(&no_weights);
-    pthread_mutex_unlock(&mtx);
+/*
+ * Copies the weights in the gym and whatever else the gym changes,
+ * consistently and without entering the monitor
+ */
+bool gym_snapshot(int gym_weights[], GymSnapshotCopy copy, void *context) {
+    for (int attempt = 0; attempt < GYM_SNAPSHOT_ATTEMPTS; attempt++) {
+        if (attempt > 0) {
+            // let the monitor method finish, it may be on this CPU
+            sched_yield();
+        }
+        unsigned sequence = seqlock_read_begin(&snapshot_lock);
+        if (sequence & 1) {
+            continue;
+        }
+        seqlock_copy(gym_weights, gym_admission_availiable(),
+                gym_weight_classes);
+        if (copy != NULL) {
+            copy(context);
+        }
+        if (seqlock_read_valid(&snapshot_lock, sequence)) {
+            return true;
+        }
+    }
+    return false;
 }
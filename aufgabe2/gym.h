@@ -11,28 +11,55 @@
 #ifndef GYM_H_
 #define GYM_H_
 
-#define GYM_WEIGHTS_AVAILIABLE_SIZE 3
+#include <stdbool.h>
+#include "gym_solver.h"
 
 /**
- * @brief Read-Only variable containing the total amounts of weights in the gym
+ * @brief How often gym_snapshot tries to get a consistent copy
  */
-extern const int gym_weights_availiable[];
+#define GYM_SNAPSHOT_ATTEMPTS 64
+
+/**
+ * @brief Copies data that only changes in the gym (the weights held by the
+ *        philosophers), see gym_snapshot
+ *
+ * Must read the data with atomic loads (see seqlock_copy) and must not block.
+ *
+ * @param[in] context what was passed to gym_snapshot
+ */
+typedef void (*GymSnapshotCopy)(void *context);
 
 /**
  * @brief Initializes the Gym
+ *
+ * @param[in] classes   the number of different kinds of weights
+ * @param[in] masses    the mass of every kind of weight
+ * @param[in] inventory how many weights of every kind there are
+ */
+void gym_init(int classes, const int masses[], const int inventory[]);
+
+/**
+ * @brief Switches fair mode on or off
+ *
+ * In fair mode a waiting philosopher is overtaken at most overtakes times
+ * (weights handed out to others while it waits). After that, weights are
+ * only handed out if enough is left for it, and it gets its weights as soon
+ * as they are returned. Can be called at any time after gym_init.
+ *
+ * @param[in] overtakes the bound, 0 to switch fair mode off
  */
-void gym_init();
+void gym_set_fairness(int overtakes);
 
 /**
  * @brief [MONITOR METHOD] Hands out weights to the caller.
  *
  * This method will check which weights are available and then try to find a
  * combination that sums up to the required total. If it finds one, the weights
- * will be handed out (signaled by a return value of 0). If not, an error code
- * is returned
+ * will be handed out. If not, the caller blocks until it is possible.
  *
  * @param[in] total          the desired total weight
- * @param[out] weight_counts will contain the weights if method returned 0
+ * @param[out] weight_counts will contain the weights (gym_weight_classes
+ *                           entries) once the method returns
  */
 void gym_get_weights(int total, int weight_counts[]);
 
@@ -43,4 +70,21 @@ void gym_get_weights(int total, int weight_counts[]);
  */
 void gym_return_weights(int weight_counts[]);
 
+/**
+ * @brief Copies the weights in the gym and whatever else the gym changes,
+ *        consistently and without entering the monitor
+ *
+ * The copy is retried until no gym operation ran while it was made (up to
+ * GYM_SNAPSHOT_ATTEMPTS times), so together with the weights held by the
+ * philosophers the counts always add up to the inventory. Gym operations
+ * never wait for this.
+ *
+ * @param[out] gym_weights the weights in the gym (gym_weight_classes entries)
+ * @param[in]  copy        copies the rest, NULL for nothing
+ * @param[in]  context     passed to copy
+ * @return false if there was no consistent copy (the gym was too busy, or the
+ *         lock-free engine is used, which has no snapshots)
+ */
+bool gym_snapshot(int gym_weights[], GymSnapshotCopy copy, void *context);
+
 #endif /* GYM_H_ */
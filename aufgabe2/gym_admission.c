@@ -0,0 +1,461 @@
+/** ****************************************************************
+ * @file    aufgabe2/gym_admission.c
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    14.12.2016
+ * @brief   Implementation for the Gym admission module
+ ******************************************************************
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gym_admission.h"
+#include "allocator.h"
+#include "stats.h"
+#include "errors.h"
+
+/**
+ * @brief FIFO queue of tickets that all want the same total
+ */
+typedef struct {
+    GymTicket *head; //!< oldest ticket
+    GymTicket *tail; //!< youngest ticket
+} GymWaitQueue;
+
+/**
+ * @brief One wait queue per requestable total, indexed by the total
+ */
+static GymWaitQueue *wait_queues = NULL;
+
+/**
+ * @brief Totals that currently have a non-empty wait queue, heaviest first
+ */
+static int *active_totals = NULL;
+
+/**
+ * @brief Number of entries in active_totals
+ */
+static int active_count = 0;
+
+/**
+ * @brief Weights that were returned together, handed out together again
+ */
+typedef struct GymKit {
+    struct GymKit *next; //!< next kit of the same total, or next unused kit
+    int weight_counts[]; //!< the weights of the kit
+} GymKit;
+
+/**
+ * @brief The weights in the gym
+ */
+static Allocator *weights = NULL;
+
+/**
+ * @brief Stack of kits per total, indexed by the total
+ */
+static GymKit **kits = NULL;
+
+/**
+ * @brief Kits not in use. There can't be more kits than weights, so there
+ *        is one for every weight.
+ */
+static GymKit *unused_kits = NULL;
+
+/**
+ * @brief Weights in the gym that are not part of a kit
+ */
+static int *loose_weights = NULL;
+
+/**
+ * @brief Per total whether the full inventory can make it up, indexed by the
+ *        total
+ */
+static bool *reachable_totals = NULL;
+
+/**
+ * @brief How often a waiter may be overtaken in fair mode, 0 if not fair
+ */
+static int max_overtakes = 0;
+
+/**
+ * @brief Number of times weights were handed out so far
+ */
+static long acquisitions = 0;
+
+/**
+ * @brief Finds the ticket that has been overtaken too often
+ *
+ * Only the oldest ticket is protected at a time.
+ *
+ * @param[out] total will contain the total the ticket wants
+ * @return the ticket or NULL, if nobody is starving (or not in fair mode)
+ */
+static GymTicket* find_starving(int *total) {
+    if (max_overtakes == 0) {
+        return NULL;
+    }
+
+    GymTicket *oldest = NULL;
+    for (int a = 0; a < active_count; a++) {
+        GymTicket *head = wait_queues[active_totals[a]].head;
+        if (oldest == NULL || head->queued_at < oldest->queued_at) {
+            oldest = head;
+            *total = active_totals[a];
+        }
+    }
+    if (oldest == NULL || acquisitions - oldest->queued_at < max_overtakes) {
+        return NULL;
+    }
+    return oldest;
+}
+
+/**
+ * @brief Checks whether weights are contained in others
+ *
+ * @param[in] weight_counts the weights
+ * @param[in] availiable    the weights to take them from
+ * @return true if every kind of weight is availiable often enough
+ */
+static bool fits(const int weight_counts[], const int availiable[]) {
+    for (int i = 0; i < gym_weight_classes; i++) {
+        if (weight_counts[i] > availiable[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Breaks kits apart until the loose weights cover a split
+ *
+ * The split must be available in the gym. Heavy totals are broken first.
+ *
+ * @param[in] weight_counts the split
+ */
+static void break_kits(const int weight_counts[]) {
+    int missing[gym_weight_classes];
+    bool short_of = false;
+    for (int i = 0; i < gym_weight_classes; i++) {
+        missing[i] = weight_counts[i] - loose_weights[i];
+        short_of |= missing[i] > 0;
+    }
+
+    for (int total = gym_solver_max_total(); total > 0 && short_of; total--) {
+        GymKit **link = &kits[total];
+        while (*link != NULL && short_of) {
+            GymKit *kit = *link;
+            bool needed = false;
+            for (int i = 0; i < gym_weight_classes; i++) {
+                needed |= missing[i] > 0 && kit->weight_counts[i] > 0;
+            }
+            if (!needed) {
+                link = &kit->next;
+                continue;
+            }
+
+            *link = kit->next;
+            short_of = false;
+            for (int i = 0; i < gym_weight_classes; i++) {
+                loose_weights[i] += kit->weight_counts[i];
+                missing[i] -= kit->weight_counts[i];
+                short_of |= missing[i] > 0;
+            }
+            kit->next = unused_kits;
+            unused_kits = kit;
+            STATS_COUNT(STATS_GYM_KITS_BROKEN);
+        }
+    }
+}
+
+/**
+ * @brief Takes weights out of the gym, a kit if there is one
+ *
+ * @param[in]  total         the total weight requested
+ * @param[out] weight_counts will contain the weights if true is returned
+ * @return true if the total could be achieved
+ */
+static bool take_weights(int total, int weight_counts[]) {
+    GymKit *kit = total > 0 && total <= gym_solver_max_total() ?
+            kits[total] : NULL;
+    if (kit != NULL) {
+        kits[total] = kit->next;
+        kit->next = unused_kits;
+        unused_kits = kit;
+        allocator_try(weights, kit->weight_counts, weight_counts);
+        STATS_COUNT(STATS_GYM_KIT_HITS);
+        return true;
+    }
+
+    if (!allocator_try_sum(weights, total, weight_counts)) {
+        return false;
+    }
+    STATS_COUNT(STATS_GYM_KIT_MISSES);
+    break_kits(weight_counts);
+    for (int i = 0; i < gym_weight_classes; i++) {
+        loose_weights[i] -= weight_counts[i];
+    }
+    return true;
+}
+
+/**
+ * @brief Puts weights back into the gym as a kit for their total
+ *
+ * @param[in]     total         the total of the weights
+ * @param[in,out] weight_counts the weights, empty afterwards
+ */
+static void put_weights(int total, int weight_counts[]) {
+    GymKit *kit = unused_kits;
+    if (total > 0 && kit != NULL) {
+        unused_kits = kit->next;
+        memcpy(kit->weight_counts, weight_counts,
+                sizeof(int) * gym_weight_classes);
+        kit->next = kits[total];
+        kits[total] = kit;
+    } else {
+        for (int i = 0; i < gym_weight_classes; i++) {
+            loose_weights[i] += weight_counts[i];
+        }
+    }
+    allocator_release(weights, weight_counts);
+}
+
+/**
+ * @brief Adds a ticket to a wait queue
+ *
+ * @param[in] total  the total the ticket wants
+ * @param[in] ticket the ticket to add
+ * @param[in] front  true to add it as the oldest ticket, false to append it
+ */
+static void enqueue_ticket(int total, GymTicket *ticket, bool front) {
+    GymWaitQueue *queue = &wait_queues[total];
+
+    if (queue->head == NULL) {
+        // keep active_totals sorted, heaviest first
+        int pos = active_count++;
+        while (pos > 0 && active_totals[pos - 1] < total) {
+            active_totals[pos] = active_totals[pos - 1];
+            pos--;
+        }
+        active_totals[pos] = total;
+    }
+
+    if (front) {
+        ticket->next = queue->head;
+        queue->head = ticket;
+        if (queue->tail == NULL) {
+            queue->tail = ticket;
+        }
+    } else {
+        ticket->next = NULL;
+        if (queue->tail == NULL) {
+            queue->head = ticket;
+        } else {
+            queue->tail->next = ticket;
+        }
+        queue->tail = ticket;
+    }
+}
+
+/**
+ * @brief Removes the oldest ticket from a wait queue
+ *
+ * queue must not be empty. The caller is responsible for removing the total
+ * from active_totals if the queue becomes empty.
+ *
+ * @param[in] queue the queue to remove the ticket from
+ * @return the removed ticket
+ */
+static GymTicket* dequeue_ticket(GymWaitQueue *queue) {
+    GymTicket *ticket = queue->head;
+    queue->head = ticket->next;
+    if (queue->head == NULL) {
+        queue->tail = NULL;
+    }
+    return ticket;
+}
+
+/**
+ * @brief Splits a total into weights with the solver
+ *
+ * @param[in]  context     unused
+ * @param[in]  availiable  the weights to choose from
+ * @param[in]  total       the total to achieve
+ * @param[out] split       will contain the weights if true is returned
+ * @return true if the total can be achieved
+ */
+static bool split_weights(void *context, const int availiable[], int total,
+        int split[]) {
+    return gym_solver_find(availiable, total, split);
+}
+
+/*
+ * Sets up the weights in the gym and the wait queues
+ */
+void gym_admission_init(int classes, const int masses[], const int inventory[]) {
+    // precompute all combinations once, so admission only does lookups
+    gym_solver_init(classes, masses, inventory);
+
+    weights = allocator_create(classes, gym_weights_availiable, split_weights,
+            NULL);
+
+    // all weights start loose, every one of them may end up in a kit
+    int weight_count = 0;
+    loose_weights = malloc(sizeof(int) * classes);
+    FATAL_ERROR_HANDLING(loose_weights == NULL,
+            "[gym_admission_init] Failed to allocate weights")
+    for (int i = 0; i < classes; i++) {
+        loose_weights[i] = gym_weights_availiable[i];
+        weight_count += gym_weights_availiable[i];
+    }
+    size_t kit_size = sizeof(GymKit) + sizeof(int) * classes;
+    char *kit_pool = malloc(kit_size * weight_count);
+    kits = calloc(gym_solver_max_total() + 1, sizeof(GymKit*));
+    FATAL_ERROR_HANDLING((kit_pool == NULL && weight_count > 0) || kits == NULL,
+            "[gym_admission_init] Failed to allocate kits")
+    for (int k = 0; k < weight_count; k++) {
+        GymKit *kit = (GymKit*) (kit_pool + kit_size * k);
+        kit->next = unused_kits;
+        unused_kits = kit;
+    }
+
+    int queue_count = gym_solver_max_total() + 1;
+    wait_queues = calloc(queue_count, sizeof(GymWaitQueue));
+    active_totals = malloc(sizeof(int) * queue_count);
+    reachable_totals = malloc(sizeof(bool) * queue_count);
+    FATAL_ERROR_HANDLING(
+            wait_queues == NULL || active_totals == NULL
+                    || reachable_totals == NULL,
+            "[gym_admission_init] Failed to allocate wait queues")
+    gym_solver_reachable_totals(classes, masses, inventory, reachable_totals);
+}
+
+/*
+ * Switches fair mode on or off
+ */
+void gym_admission_set_fairness(int overtakes) {
+    max_overtakes = overtakes;
+}
+
+/*
+ * Gets the weights in the gym
+ */
+const int* gym_admission_availiable() {
+    return allocator_available(weights);
+}
+
+/*
+ * Hands out weights if the total can be achieved right now. Runs in
+ * O(gym_weight_classes) if the solver has a table.
+ */
+bool gym_admission_try(int total, int weight_counts[]) {
+    // "transfer" weights from gym to philosopher
+    if (!take_weights(total, weight_counts)) {
+        return false;
+    }
+
+    // ... unless that leaves a starving waiter without its weights
+    int starving_total;
+    int split[gym_weight_classes];
+    if (find_starving(&starving_total) != NULL && !gym_solver_find(
+            allocator_available(weights), starving_total, split)) {
+        put_weights(total, weight_counts);
+        return false;
+    }
+    acquisitions++;
+    return true;
+}
+
+/*
+ * Queues a request behind all others for the same total
+ */
+bool gym_admission_queue(int total, GymTicket *ticket, int weight_counts[]) {
+    ticket->queued_at = acquisitions;
+    ticket->weight_counts = weight_counts;
+    ticket->granted = false;
+
+    // a total the gym can never reach would never be woken up
+    if (total <= 0 || total > gym_solver_max_total()
+            || !reachable_totals[total]) {
+        return false;
+    }
+    enqueue_ticket(total, ticket, false);
+    return true;
+}
+
+/*
+ * Puts a woken ticket back to the front of its queue
+ */
+void gym_admission_requeue(int total, GymTicket *ticket) {
+    enqueue_ticket(total, ticket, true);
+}
+
+/*
+ * Takes weights back into the gym
+ */
+void gym_admission_return(int weight_counts[]) {
+    // "transfer" weights to gym
+    int total = 0;
+    for (int i = 0; i < gym_weight_classes; i++) {
+        total += weight_counts[i] * gym_weight_masses[i];
+    }
+    put_weights(total, weight_counts);
+}
+
+/*
+ * Wakes the waiters that can be served with the weights in the gym
+ */
+void gym_admission_wake(GymWakeFunction wake, void *context) {
+    // in fair mode a starving waiter gets its weights right away, so nobody
+    // can take them between its wakeup and its retry
+    int starving_total;
+    GymTicket *starving = find_starving(&starving_total);
+    if (starving != NULL && take_weights(starving_total,
+            starving->weight_counts)) {
+        acquisitions++;
+        starving->granted = true;
+        dequeue_ticket(&wait_queues[starving_total]);
+        wake(starving, context);
+    }
+
+    // wake only the waiters that can be served with what is in the gym now,
+    // reserving their share so we don't wake more than we can satisfy.
+    // Heavy totals go first, they have the hardest time getting weights.
+    // Kits of the total are reserved before asking the solver.
+    int remaining[gym_weight_classes];
+    int solved[gym_weight_classes];
+    const int *availiable = allocator_available(weights);
+    for (int i = 0; i < gym_weight_classes; i++) {
+        remaining[i] = availiable[i];
+    }
+
+    int still_active = 0;
+    for (int a = 0; a < active_count; a++) {
+        int total = active_totals[a];
+        GymWaitQueue *queue = &wait_queues[total];
+        GymKit *kit = kits[total];
+        while (queue->head != NULL) {
+            // earlier reservations may have used weights of a kit
+            while (kit != NULL && !fits(kit->weight_counts, remaining)) {
+                kit = kit->next;
+            }
+            const int *split = solved;
+            if (kit != NULL) {
+                split = kit->weight_counts;
+                kit = kit->next;
+            } else if (!gym_solver_find(remaining, total, solved)) {
+                break;
+            }
+            for (int i = 0; i < gym_weight_classes; i++) {
+                remaining[i] -= split[i];
+            }
+            wake(dequeue_ticket(queue), context);
+        }
+        if (queue->head != NULL) {
+            active_totals[still_active++] = total;
+        }
+    }
+    active_count = still_active;
+}
@@ -0,0 +1,126 @@
+/** ****************************************************************
+ * @file    aufgabe2/gym_admission.h
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    14.12.2016
+ * @brief   Header for the Gym admission module
+ *
+ * Decides who gets weights: the weights in the gym, the FIFO wait queue per
+ * total, fair mode and which waiters are woken when weights come back. It
+ * does no locking and no waiting itself, so the monitor gym (gym.c) and the
+ * discrete-event simulator (gymsim.c) share the exact same policy. Callers
+ * must serialize all calls.
+ *
+ * Returned weights are kept together as a kit for the total they made up.
+ * Philosophers ask for the same few totals again and again, so a request
+ * usually pops a kit of its total instead of searching for a combination.
+ * Only when there is no kit the solver picks weights from the whole gym and
+ * the kits these weights came from are broken apart.
+ ******************************************************************
+ */
+
+#ifndef GYM_ADMISSION_H_
+#define GYM_ADMISSION_H_
+
+#include <stdbool.h>
+#include "gym_solver.h"
+
+/**
+ * @brief A request in a wait queue
+ *
+ * Owned by the caller, who has to keep it alive while it is queued.
+ */
+typedef struct GymTicket {
+    long queued_at;          //!< value of the acquisition count when queued
+    int *weight_counts;      //!< where weights go if they are handed over
+    bool granted;            //!< true if the weights were handed over
+    struct GymTicket *next;  //!< next ticket in the queue
+} GymTicket;
+
+/**
+ * @brief Called for every ticket that is taken out of its queue by
+ *        gym_admission_wake
+ *
+ * If ticket->granted is set, the weights are already in
+ * ticket->weight_counts, otherwise the owner has to try again.
+ *
+ * @param[in] ticket  the ticket
+ * @param[in] context as passed to gym_admission_wake
+ */
+typedef void (*GymWakeFunction)(GymTicket *ticket, void *context);
+
+/**
+ * @brief Sets up the weights in the gym and the wait queues
+ *
+ * @param[in] classes   the number of different kinds of weights
+ * @param[in] masses    the mass of every kind of weight
+ * @param[in] inventory how many weights of every kind there are
+ */
+void gym_admission_init(int classes, const int masses[], const int inventory[]);
+
+/**
+ * @brief Switches fair mode on or off
+ *
+ * @param[in] overtakes how often a waiter may be overtaken, 0 for no limit
+ */
+void gym_admission_set_fairness(int overtakes);
+
+/**
+ * @brief Gets the weights in the gym
+ *
+ * @return gym_weight_classes counts
+ */
+const int* gym_admission_availiable();
+
+/**
+ * @brief Hands out weights if the total can be achieved right now
+ *
+ * In fair mode the request is refused if it would leave too little for a
+ * starving waiter.
+ *
+ * @param[in]  total         the total weight requested
+ * @param[out] weight_counts will contain the weights if true is returned,
+ *                           must be empty
+ * @return true if the weights were handed out
+ */
+bool gym_admission_try(int total, int weight_counts[]);
+
+/**
+ * @brief Queues a request behind all others for the same total
+ *
+ * @param[in]  total         the total weight requested
+ * @param[out] ticket        the ticket to queue
+ * @param[in]  weight_counts where handed over weights go
+ * @return false if the total can never be achieved (nothing is queued)
+ */
+bool gym_admission_queue(int total, GymTicket *ticket, int weight_counts[]);
+
+/**
+ * @brief Puts a woken ticket back to the front of its queue
+ *
+ * @param[in] total  the total weight requested
+ * @param[in] ticket the ticket
+ */
+void gym_admission_requeue(int total, GymTicket *ticket);
+
+/**
+ * @brief Takes weights back into the gym
+ *
+ * @param[in,out] weight_counts the weights, empty afterwards
+ */
+void gym_admission_return(int weight_counts[]);
+
+/**
+ * @brief Wakes the waiters that can be served with the weights in the gym
+ *
+ * A starving waiter (fair mode) gets its weights handed over, the others are
+ * only woken if their share is availiable (heaviest totals first) and have
+ * to try again.
+ *
+ * @param[in] wake    called for every ticket taken out of its queue
+ * @param[in] context passed to wake
+ */
+void gym_admission_wake(GymWakeFunction wake, void *context);
+
+#endif /* GYM_ADMISSION_H_ */
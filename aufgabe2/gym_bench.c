@@ -0,0 +1,131 @@
+/** ****************************************************************
+ * @file    aufgabe2/gym_bench.c
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    05.12.2016
+ * @brief   Throughput micro benchmark for the gym engines
+ *
+ * Starts a number of threads that get and return weights as fast as they can
+ * (no workout, no rest, no status output) and prints the achieved gym
+ * operations per second and context switches per operation. Link against
+ * gym.o or gym_lockfree.o to compare the engines.
+ *
+ * Usage: gym_bench_<engine> THREADS SECONDS
+ ******************************************************************
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "gym.h"
+#include "errors.h"
+
+/**
+ * @brief The totals requested by the threads (round robin)
+ */
+static const int bench_totals[] = { 6, 8, 12, 12, 14 };
+
+/**
+ * @brief Set to false to stop all threads
+ */
+static atomic_bool running = true;
+
+/**
+ * @brief Barrier, to make sure all threads are created before the first one
+ *        starts.
+ */
+static pthread_barrier_t init_barrier;
+
+/**
+ * @brief Sum of get/return cycles of all threads
+ */
+static atomic_long total_cycles;
+
+/**
+ * @brief Status output is not benchmarked, so it is a no-op here
+ */
+void philosophers_weights_changed(const int weight_counts[],
+        const int gym_weights[]) {
+}
+
+/**
+ * @brief Loop for the benchmark threads
+ *
+ * @param arg the total to request (int, passed by value)
+ */
+static void* bench_loop(void *arg) {
+    int total = (int) (long) arg;
+    int weights[gym_weight_classes];
+    for (int i = 0; i < gym_weight_classes; i++) {
+        weights[i] = 0;
+    }
+    long cycles = 0;
+
+    pthread_barrier_wait(&init_barrier);
+    while (atomic_load_explicit(&running, memory_order_relaxed)) {
+        gym_get_weights(total, weights);
+        gym_return_weights(weights);
+        cycles++;
+    }
+
+    atomic_fetch_add(&total_cycles, cycles);
+    return NULL;
+}
+
+/**
+ * @brief Program entry
+ */
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s THREADS SECONDS\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int thread_count = atoi(argv[1]);
+    int seconds = atoi(argv[2]);
+
+    pthread_t *threads = malloc(sizeof(pthread_t) * thread_count);
+    FATAL_ERROR_HANDLING(threads == NULL, "Failed to allocate threads")
+
+    const int masses[] = { GYM_DEFAULT_WEIGHT_MASSES };
+    const int inventory[] = { GYM_DEFAULT_WEIGHTS_INVENTORY };
+    gym_init(GYM_DEFAULT_WEIGHT_CLASSES, masses, inventory);
+    int res = pthread_barrier_init(&init_barrier, NULL, thread_count + 1);
+    FATAL_ERROR_HANDLING(res, "Failed to create init_barrier")
+
+    for (int i = 0; i < thread_count; i++) {
+        long total = bench_totals[i % (sizeof(bench_totals) / sizeof(int))];
+        res = pthread_create(&threads[i], NULL, bench_loop, (void*) total);
+        FATAL_ERROR_HANDLING(res, "Failed to create thread")
+    }
+
+    struct timespec start, end;
+    pthread_barrier_wait(&init_barrier);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sleep(seconds);
+    atomic_store(&running, false);
+
+    // waiting threads are served by the others, who return before stopping
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    double elapsed = (end.tv_sec - start.tv_sec)
+            + (end.tv_nsec - start.tv_nsec) / 1e9;
+    long cycles = atomic_load(&total_cycles);
+    printf("%s,%d,%.0f,%.4f\n", argv[0], thread_count, cycles / elapsed,
+            (double) (usage.ru_nvcsw + usage.ru_nivcsw) / cycles);
+
+    pthread_barrier_destroy(&init_barrier);
+    free(threads);
+    return 0;
+}
@@ -0,0 +1,318 @@
+/** ****************************************************************
+ * @file    aufgabe2/gym_lockfree.c
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    05.12.2016
+ * @brief   Lock-free implementation for the Gym module
+ *
+ * Drop-in replacement for gym.c (select with "make GYM_ENGINE=lockfree").
+ * The weights in the gym are packed into one atomic word (the mixed-radix key
+ * of the availability vector), so getting and returning weights is a single
+ * compare-and-swap / fetch-and-add. Threads only sleep on a futex when no
+ * combination for their total is availiable, on the futex bit of their total.
+ * A return only wakes the bits of totals that became possible, so waiters
+ * for other totals keep sleeping. There is no consistent snapshot
+ * of the gym while weights move, so the status display does not check for
+ * synchronization errors with this engine. There is no monitor either, so
+ * GYM_STATS records the wait time, wakeups and failed compare-and-swaps.
+ * Tasks (see tasks.h) must not block their worker on the futex, they wait on
+ * a semaphore in a list per futex bit instead, which returns post together
+ * with the bit.
+ ******************************************************************
+ */
+
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "gym.h"
+#include "philosophers.h"
+#include "stats.h"
+#include "tasks.h"
+#include "errors.h"
+
+/**
+ * @brief Number of futex bits, a thread sleeps on the bit of its total modulo
+ *        this
+ */
+#define GYM_WAKE_BUCKETS 32
+
+/**
+ * @brief A task waiting for weights
+ */
+typedef struct GymTaskWaiter {
+    TaskSem wakeup;              //!< posted when the bucket is woken
+    struct GymTaskWaiter *next;  //!< next waiter in the same bucket
+} GymTaskWaiter;
+
+/**
+ * @brief Packed weights currently availiable in the gym
+ */
+static _Atomic long availiable_key;
+
+/**
+ * @brief Futex word, incremented every time weights are returned to waiters
+ */
+static atomic_uint generation;
+
+/**
+ * @brief Number of threads currently sleeping (or about to) on generation
+ */
+static atomic_int waiters;
+
+/**
+ * @brief Number of waiters for every total
+ */
+static atomic_int *total_waiters;
+
+/**
+ * @brief Number of waiters for the totals of every futex bit
+ */
+static atomic_int bucket_waiters[GYM_WAKE_BUCKETS];
+
+/**
+ * @brief Tasks waiting for the totals of every futex bit
+ *
+ * Waiters are only ever pushed one by one and taken out all at once, so the
+ * lists need no lock.
+ */
+static GymTaskWaiter *_Atomic task_waiters[GYM_WAKE_BUCKETS];
+
+/**
+ * @brief Sleeps on the bit of a total as long as the futex still contains
+ *        expected
+ *
+ * @param[in] expected the generation that was observed before sleeping
+ * @param[in] total    the total the caller waits for
+ */
+static void futex_wait(unsigned int expected, int total) {
+    syscall(SYS_futex, &generation, FUTEX_WAIT_BITSET_PRIVATE, expected, NULL,
+            NULL, 1u << (total % GYM_WAKE_BUCKETS));
+}
+
+/**
+ * @brief Wakes all threads sleeping on one of the given bits
+ *
+ * @param[in] mask the bits to wake
+ */
+static void futex_wake(unsigned int mask) {
+    syscall(SYS_futex, &generation, FUTEX_WAKE_BITSET_PRIVATE, INT_MAX, NULL,
+            NULL, mask);
+}
+
+/**
+ * @brief Wakes all tasks waiting for the totals of a futex bit
+ *
+ * @param[in] bucket the bit
+ */
+static void wake_tasks(int bucket) {
+    GymTaskWaiter *waiter = atomic_exchange(&task_waiters[bucket], NULL);
+    while (waiter != NULL) {
+        // the waiter may be gone as soon as it is posted
+        GymTaskWaiter *next = waiter->next;
+        tasks_sem_post(&waiter->wakeup);
+        waiter = next;
+    }
+}
+
+/**
+ * @brief Parks the calling task until its bucket is woken
+ *
+ * The caller must be registered with count_waiter already.
+ *
+ * @param[in] total the total the task waits for
+ * @param[in] key   the packed weights the total was not possible with
+ */
+static void task_wait(int total, long key) {
+    int bucket = total % GYM_WAKE_BUCKETS;
+    GymTaskWaiter self;
+    tasks_sem_init(&self.wakeup);
+    self.next = atomic_load(&task_waiters[bucket]);
+    while (!atomic_compare_exchange_weak(&task_waiters[bucket], &self.next,
+            &self)) {
+        // self.next was reloaded by the failed CAS
+    }
+
+    // a return before the push did not see us - wake the bucket ourselves
+    if (atomic_load(&availiable_key) != key) {
+        wake_tasks(bucket);
+    }
+    tasks_sem_wait(&self.wakeup);
+    tasks_sem_destroy(&self.wakeup);
+}
+
+/**
+ * @brief Registers or unregisters a waiter
+ *
+ * @param[in] total the total the waiter waits for
+ * @param[in] delta 1 to register, -1 to unregister
+ */
+static void count_waiter(int total, int delta) {
+    atomic_fetch_add(&total_waiters[total], delta);
+    atomic_fetch_add(&bucket_waiters[total % GYM_WAKE_BUCKETS], delta);
+    atomic_fetch_add(&waiters, delta);
+}
+
+/**
+ * @brief Finds the futex bits of all waited for totals that can be handed out
+ *
+ * @param[in] key the packed weights in the gym
+ * @return the bits to wake
+ */
+static unsigned int possible_buckets(long key) {
+    // heavier totals than what is in the gym are not worth a lookup
+    int availiable[gym_weight_classes];
+    gym_solver_decode(key, availiable);
+    int mass = 0;
+    for (int i = 0; i < gym_weight_classes; i++) {
+        mass += availiable[i] * gym_weight_masses[i];
+    }
+
+    unsigned int mask = 0;
+    for (int bucket = 0; bucket < GYM_WAKE_BUCKETS; bucket++) {
+        if (atomic_load(&bucket_waiters[bucket]) == 0) {
+            continue;
+        }
+        for (int total = bucket; total <= mass; total += GYM_WAKE_BUCKETS) {
+            if (atomic_load(&total_waiters[total]) > 0
+                    && gym_solver_lookup(key, total) != GYM_NO_COMBINATION) {
+                mask |= 1u << bucket;
+                break;
+            }
+        }
+    }
+    return mask;
+}
+
+/*
+ * Initializes the Gym
+ */
+void gym_init(int classes, const int masses[], const int inventory[]) {
+    // precompute all combinations once, so get only does lookups
+    gym_solver_init(classes, masses, inventory);
+    if (!gym_solver_has_keys()) {
+        fprintf(stderr, "Inventory too big for the lock-free gym, "
+                "the weights do not fit into one 64 bit word\n");
+        exit(EXIT_FAILURE);
+    }
+    atomic_init(&availiable_key, gym_solver_encode(gym_weights_availiable));
+    atomic_init(&generation, 0);
+    atomic_init(&waiters, 0);
+    total_waiters = calloc(gym_solver_max_total() + 1, sizeof(atomic_int));
+    FATAL_ERROR_HANDLING(total_waiters == NULL,
+            "[gym_init] Failed to allocate waiter counts")
+    for (int i = 0; i < GYM_WAKE_BUCKETS; i++) {
+        atomic_init(&bucket_waiters[i], 0);
+        atomic_init(&task_waiters[i], NULL);
+    }
+}
+
+/*
+ * Switches fair mode on or off
+ */
+void gym_set_fairness(int overtakes) {
+    if (overtakes > 0) {
+        fprintf(stderr, "[gym_set_fairness] Fair mode needs the monitor "
+                "engine (make GYM_ENGINE=monitor)\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * [MONITOR METHOD] Hands out weights to the caller.
+ *
+ * Lock-free: the split is looked up for the availability word that was read
+ * and then committed with a compare-and-swap. If the word changed in between,
+ * the lookup is simply repeated.
+ */
+void gym_get_weights(int total, int weight_counts[]) {
+    long start = STATS_START();
+    FATAL_ERROR_HANDLING(total <= 0 || total > gym_solver_max_total(),
+            "[gym_get_weights] Total can never be handed out")
+    long key = atomic_load(&availiable_key);
+
+    while (true) {
+        long split = gym_solver_lookup(key, total);
+        if (split != GYM_NO_COMBINATION) {
+            // no carries possible, split is a subset of key
+            if (atomic_compare_exchange_weak(&availiable_key, &key,
+                    key - split)) {
+                gym_solver_decode(split, weight_counts);
+                philosophers_weights_changed(weight_counts, NULL);
+                STATS_RECORD(STATS_GYM_WAIT, start);
+                return;
+            }
+            // key was reloaded by the failed CAS
+            STATS_COUNT(STATS_GYM_CAS_FAILURES);
+            continue;
+        }
+
+        // nothing feasible - register as waiter, then check again before
+        // sleeping, so a concurrent return can not be missed
+        count_waiter(total, 1);
+        unsigned int gen = atomic_load(&generation);
+        long current = atomic_load(&availiable_key);
+        if (current == key) {
+            if (tasks_current() != NULL) {
+                // a task must not sleep on the futex, that would block its
+                // worker
+                task_wait(total, key);
+            } else {
+                futex_wait(gen, total);
+            }
+            STATS_COUNT(STATS_GYM_WAKEUPS);
+            current = atomic_load(&availiable_key);
+#ifdef GYM_STATS
+            if (gym_solver_lookup(current, total) == GYM_NO_COMBINATION) {
+                STATS_COUNT(STATS_GYM_SPURIOUS);
+            }
+#endif
+        }
+        count_waiter(total, -1);
+        key = current;
+    }
+}
+
+/*
+ * [MONITOR METHOD] Returns weights from the caller to the gym.
+ */
+void gym_return_weights(int weight_counts[]) {
+    // "transfer" weights to gym
+    long returned = gym_solver_encode(weight_counts);
+    long key = atomic_fetch_add(&availiable_key, returned) + returned;
+    for (int i = 0; i < gym_weight_classes; i++) {
+        weight_counts[i] = 0;
+    }
+    philosophers_weights_changed(weight_counts, NULL);
+
+    // only pay for the lookups and the syscall if somebody is actually
+    // sleeping, and only wake those that can get their total now
+    if (atomic_load(&waiters) > 0) {
+        unsigned int mask = possible_buckets(key);
+        if (mask != 0) {
+            atomic_fetch_add(&generation, 1);
+            futex_wake(mask);
+            for (int bucket = 0; bucket < GYM_WAKE_BUCKETS; bucket++) {
+                if (mask & (1u << bucket)) {
+                    wake_tasks(bucket);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Copies the weights in the gym and whatever else the gym changes,
+ * consistently and without entering the monitor
+ */
+bool gym_snapshot(int gym_weights[], GymSnapshotCopy copy, void *context) {
+    // weights move with one CAS in the gym and a separate update of the
+    // philosopher, there is no point in time where both match
+    return false;
+}
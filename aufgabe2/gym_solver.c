@@ -0,0 +1,348 @@
+/** ****************************************************************
+ * @file    aufgabe2/gym_solver.c
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 2.0
+ * @date    09.12.2016
+ * @brief   Implementation of the weight combination solver
+ ******************************************************************
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gym_solver.h"
+#include "errors.h"
+
+/*
+ * Number of different kinds of weights
+ */
+int gym_weight_classes;
+
+/*
+ * Array used to store how many of the different kinds of weights are
+ *        available
+ */
+const int *gym_weights_availiable = NULL;
+
+/*
+ * The mass of the different kinds of weights
+ */
+const int *gym_weight_masses = NULL;
+
+/**
+ * @brief The heaviest total that can ever be requested successfully
+ */
+static int max_total;
+
+/**
+ * @brief Number of distinct availability vectors (product of all counts + 1)
+ *
+ * -1 if that does not fit into a long.
+ */
+static long state_count;
+
+/**
+ * @brief Mixed-radix place values used to encode an availability vector
+ *
+ * Class 0 is the least significant digit, so the numeric order of the keys is
+ * the lexicographic order on (count[n-1], ..., count[0]).
+ */
+static long *place_values = NULL;
+
+/**
+ * @brief Precomputed solutions, indexed by [availability key][total]
+ *
+ * Every entry contains the encoded weight split to hand out, or
+ * GYM_NO_COMBINATION if the total cannot be reached with that availability.
+ * NULL if the inventory is too big for a table.
+ */
+static long *solution_table = NULL;
+
+/**
+ * @brief Scratch memory for the knapsack, per thread so it needs no lock
+ */
+static __thread bool *knapsack_reachable = NULL;
+
+/**
+ * @brief Size of knapsack_reachable in elements
+ */
+static __thread size_t knapsack_size = 0;
+
+/**
+ * @brief Holds knapsack_reachable of every thread as well, so it is freed
+ *        when the thread exits
+ */
+static pthread_key_t knapsack_key;
+
+/**
+ * @brief Solves a request with a bounded knapsack
+ *
+ * reachable[c][t] tells whether t can be built from the classes below c. The
+ * split is then reconstructed from the heaviest class down, always taking as
+ * many weights as possible.
+ * Runs in O(classes * total * count) without the solution table.
+ *
+ * @param[in]  availiable the weights currently in the gym
+ * @param[in]  total      the total weight requested
+ * @param[out] split      will contain the split if true is returned
+ * @return true if total can be achieved
+ */
+static bool solve_knapsack(const int availiable[], int total, int split[]) {
+    int width = total + 1;
+    size_t needed = (size_t) (gym_weight_classes + 1) * width;
+    if (needed > knapsack_size) {
+        free(knapsack_reachable);
+        knapsack_reachable = malloc(needed * sizeof(bool));
+        FATAL_ERROR_HANDLING(knapsack_reachable == NULL,
+                "[gym_solver] Failed to allocate knapsack")
+        knapsack_size = needed;
+        int res = pthread_setspecific(knapsack_key, knapsack_reachable);
+        FATAL_ERROR_HANDLING(res, "[gym_solver] Failed to register knapsack")
+    }
+
+    bool *reachable = knapsack_reachable;
+    memset(reachable, 0, width * sizeof(bool));
+    reachable[0] = true;
+    for (int c = 0; c < gym_weight_classes; c++) {
+        const bool *below = &reachable[c * width];
+        bool *current = &reachable[(c + 1) * width];
+        int mass = gym_weight_masses[c];
+        for (int t = 0; t < width; t++) {
+            current[t] = false;
+            for (int k = 0; k <= availiable[c] && k * mass <= t; k++) {
+                if (below[t - k * mass]) {
+                    current[t] = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (!reachable[gym_weight_classes * width + total]) {
+        return false;
+    }
+
+    for (int c = gym_weight_classes - 1; c >= 0; c--) {
+        int mass = gym_weight_masses[c];
+        int k = availiable[c] < total / mass ? availiable[c] : total / mass;
+        while (!reachable[c * width + total - k * mass]) {
+            k--;
+        }
+        split[c] = k;
+        total -= k * mass;
+    }
+    return true;
+}
+
+/**
+ * @brief Builds the solution table
+ *
+ * For every availability vector the lexicographically greatest split (heaviest
+ * weights first) is stored for every reachable total, the same split
+ * solve_knapsack would find.
+ */
+static void build_solution_table() {
+    solution_table = malloc(sizeof(long) * state_count * (max_total + 1));
+    FATAL_ERROR_HANDLING(solution_table == NULL,
+            "[gym_solver_init] Failed to allocate solution table")
+
+    for (long i = 0; i < state_count * (max_total + 1); i++) {
+        solution_table[i] = GYM_NO_COMBINATION;
+    }
+
+    int availiable[gym_weight_classes];
+    int split[gym_weight_classes];
+    for (long a = 0; a < state_count; a++) {
+        gym_solver_decode(a, availiable);
+
+        // descending keys == heaviest weights first, first hit wins
+        for (long s = a; s >= 0; s--) {
+            gym_solver_decode(s, split);
+
+            int total = 0;
+            bool fits = true;
+            for (int i = 0; i < gym_weight_classes && fits; i++) {
+                fits = split[i] <= availiable[i];
+                total += split[i] * gym_weight_masses[i];
+            }
+
+            long *entry = &solution_table[a * (max_total + 1) + total];
+            if (fits && *entry == GYM_NO_COMBINATION) {
+                *entry = s;
+            }
+        }
+    }
+}
+
+/*
+ * Computes the total mass of an inventory
+ */
+long gym_solver_total_mass(int classes, const int masses[],
+        const int inventory[]) {
+    long total = 0;
+    for (int i = 0; i < classes; i++) {
+        // stays far below LONG_MAX, as the total is checked after every class
+        total += (long) inventory[i] * masses[i];
+        if (total > GYM_SOLVER_MAX_TOTAL) {
+            return -1;
+        }
+    }
+    return total;
+}
+
+/*
+ * Finds every total an inventory can make up
+ */
+void gym_solver_reachable_totals(int classes, const int masses[],
+        const int inventory[], bool reachable[]) {
+    long mass = gym_solver_total_mass(classes, masses, inventory);
+    FATAL_ERROR_HANDLING(mass == -1,
+            "[gym_solver] Total mass of the inventory is too big")
+
+    // used[t]: fewest weights of the current kind that reach t
+    int *used = malloc(sizeof(int) * (mass + 1));
+    FATAL_ERROR_HANDLING(used == NULL,
+            "[gym_solver] Failed to allocate reachable totals")
+    reachable[0] = true;
+    for (long t = 1; t <= mass; t++) {
+        reachable[t] = false;
+    }
+    for (int c = 0; c < classes; c++) {
+        for (long t = 0; t <= mass; t++) {
+            used[t] = 0;
+        }
+        for (long t = masses[c]; t <= mass; t++) {
+            if (!reachable[t] && reachable[t - masses[c]]
+                    && used[t - masses[c]] < inventory[c]) {
+                reachable[t] = true;
+                used[t] = used[t - masses[c]] + 1;
+            }
+        }
+    }
+    free(used);
+}
+
+/*
+ * Sets up the solver for the gym inventory
+ */
+void gym_solver_init(int classes, const int masses[], const int inventory[]) {
+    int *masses_copy = malloc(sizeof(int) * classes);
+    int *inventory_copy = malloc(sizeof(int) * classes);
+    place_values = malloc(sizeof(long) * classes);
+    FATAL_ERROR_HANDLING(
+            masses_copy == NULL || inventory_copy == NULL
+                    || place_values == NULL,
+            "[gym_solver_init] Failed to allocate inventory")
+
+    int res = pthread_key_create(&knapsack_key, free);
+    FATAL_ERROR_HANDLING(res, "[gym_solver_init] Failed to create knapsack key")
+
+    memcpy(masses_copy, masses, sizeof(int) * classes);
+    memcpy(inventory_copy, inventory, sizeof(int) * classes);
+    gym_weight_classes = classes;
+    gym_weight_masses = masses_copy;
+    gym_weights_availiable = inventory_copy;
+
+    // compute place values and table dimensions
+    long total = gym_solver_total_mass(classes, masses, inventory);
+    FATAL_ERROR_HANDLING(total == -1,
+            "[gym_solver_init] Total mass of the inventory is too big")
+    max_total = (int) total;
+    state_count = 1;
+    for (int i = 0; i < classes; i++) {
+        if (state_count == -1) {
+            continue;
+        }
+        place_values[i] = state_count;
+        if (state_count > LONG_MAX / (inventory[i] + 1)) {
+            state_count = -1;
+        } else {
+            state_count *= inventory[i] + 1;
+        }
+    }
+
+    // only worth it (and affordable) for small inventories
+    if (state_count != -1 && state_count <= GYM_SOLVER_TABLE_MAX_STATES
+            && state_count * (max_total + 1) <= GYM_SOLVER_TABLE_MAX_ENTRIES) {
+        build_solution_table();
+    }
+}
+
+/*
+ * Gets the heaviest total the gym can ever hand out
+ */
+int gym_solver_max_total() {
+    return max_total;
+}
+
+/*
+ * Checks whether every availability vector fits into a key
+ */
+bool gym_solver_has_keys() {
+    return state_count != -1;
+}
+
+/*
+ * Encodes a weight vector into its mixed-radix key
+ */
+long gym_solver_encode(const int weight_counts[]) {
+    long key = 0;
+    for (int i = 0; i < gym_weight_classes; i++) {
+        key += weight_counts[i] * place_values[i];
+    }
+    return key;
+}
+
+/*
+ * Decodes a mixed-radix key back into a weight vector
+ */
+void gym_solver_decode(long key, int weight_counts[]) {
+    for (int i = 0; i < gym_weight_classes; i++) {
+        weight_counts[i] = (key / place_values[i])
+                % (gym_weights_availiable[i] + 1);
+    }
+}
+
+/*
+ * Looks up the split to hand out for a request
+ */
+long gym_solver_lookup(long availiable_key, int total) {
+    if (total < 0 || total > max_total) {
+        return GYM_NO_COMBINATION;
+    }
+    if (solution_table != NULL) {
+        return solution_table[availiable_key * (max_total + 1) + total];
+    }
+
+    int availiable[gym_weight_classes];
+    int split[gym_weight_classes];
+    gym_solver_decode(availiable_key, availiable);
+    if (!solve_knapsack(availiable, total, split)) {
+        return GYM_NO_COMBINATION;
+    }
+    return gym_solver_encode(split);
+}
+
+/*
+ * Finds the split to hand out for a request
+ */
+bool gym_solver_find(const int availiable[], int total, int split[]) {
+    if (total < 0 || total > max_total) {
+        return false;
+    }
+    if (solution_table == NULL) {
+        return solve_knapsack(availiable, total, split);
+    }
+
+    long key = solution_table[gym_solver_encode(availiable) * (max_total + 1)
+            + total];
+    if (key == GYM_NO_COMBINATION) {
+        return false;
+    }
+    gym_solver_decode(key, split);
+    return true;
+}
@@ -0,0 +1,171 @@
+/** ****************************************************************
+ * @file    aufgabe2/gym_solver.h
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 2.0
+ * @date    09.12.2016
+ * @brief   Header for the weight combination solver shared by all gym engines
+ ******************************************************************
+ */
+
+#ifndef GYM_SOLVER_H_
+#define GYM_SOLVER_H_
+
+#include <stdbool.h>
+
+/**
+ * @brief Number of different kinds of weights if nothing else is configured
+ */
+#define GYM_DEFAULT_WEIGHT_CLASSES 3
+
+/**
+ * @brief The mass of the different kinds of weights if nothing else is
+ *        configured
+ */
+#define GYM_DEFAULT_WEIGHT_MASSES 2, 3, 5
+
+/**
+ * @brief How many of the different kinds of weights there are if nothing else
+ *        is configured
+ */
+#define GYM_DEFAULT_WEIGHTS_INVENTORY 4, 4, 5
+
+/**
+ * @brief Marker for requests that have no solution
+ */
+#define GYM_NO_COMBINATION -1
+
+/**
+ * @brief Upper limit for the number of entries in the solution table
+ *
+ * If the inventory would need a bigger table, every request is solved with a
+ * bounded knapsack instead.
+ */
+#define GYM_SOLVER_TABLE_MAX_ENTRIES (1 << 20)
+
+/**
+ * @brief Upper limit for the number of availability vectors in the solution
+ *        table (building the table is quadratic in this)
+ */
+#define GYM_SOLVER_TABLE_MAX_STATES 2048
+
+/**
+ * @brief Upper limit for the total mass of the inventory
+ *
+ * The gym keeps tables with an entry for every possible total, so bigger
+ * inventories are rejected.
+ */
+#define GYM_SOLVER_MAX_TOTAL (1 << 20)
+
+/**
+ * @brief Read-Only variable containing the number of different kinds of
+ *        weights
+ */
+extern int gym_weight_classes;
+
+/**
+ * @brief Read-Only variable containing the total amounts of weights in the gym
+ */
+extern const int *gym_weights_availiable;
+
+/**
+ * @brief Read-Only variable containing the mass of the different weights
+ */
+extern const int *gym_weight_masses;
+
+/**
+ * @brief Computes the total mass of an inventory
+ *
+ * @param[in] classes   the number of different kinds of weights
+ * @param[in] masses    the mass of every kind of weight
+ * @param[in] inventory how many weights of every kind there are
+ * @return the total mass, -1 if it exceeds GYM_SOLVER_MAX_TOTAL
+ */
+long gym_solver_total_mass(int classes, const int masses[],
+        const int inventory[]);
+
+/**
+ * @brief Finds every total an inventory can make up
+ *
+ * Works without gym_solver_init, so a configuration can be checked first.
+ *
+ * @param[in]  classes   the number of different kinds of weights
+ * @param[in]  masses    the mass of every kind of weight
+ * @param[in]  inventory how many weights of every kind there are
+ * @param[out] reachable one flag per total from 0 to the total mass (see
+ *                       gym_solver_total_mass), true if some combination of
+ *                       the inventory adds up to it
+ */
+void gym_solver_reachable_totals(int classes, const int masses[],
+        const int inventory[], bool reachable[]);
+
+/**
+ * @brief Sets up the solver for the gym inventory
+ *
+ * Builds the solution table if the inventory is small enough. Must be called
+ * once before any of the other solver functions. The total mass of the
+ * inventory must not exceed GYM_SOLVER_MAX_TOTAL.
+ *
+ * @param[in] classes   the number of different kinds of weights
+ * @param[in] masses    the mass of every kind of weight
+ * @param[in] inventory how many weights of every kind there are
+ */
+void gym_solver_init(int classes, const int masses[], const int inventory[]);
+
+/**
+ * @brief Gets the heaviest total the gym can ever hand out
+ *
+ * @return the sum of all weights in the gym
+ */
+int gym_solver_max_total();
+
+/**
+ * @brief Checks whether every availability vector fits into a key
+ *
+ * @return true if the encode / decode / lookup functions can be used
+ */
+bool gym_solver_has_keys();
+
+/**
+ * @brief Encodes a weight vector into its mixed-radix key
+ *
+ * Keys of vectors that are componentwise subsets of each other can be
+ * subtracted (and added) without any carries, so a key can be used as a packed
+ * representation of the vector.
+ *
+ * @param[in] weight_counts the vector to encode
+ * @return the key
+ */
+long gym_solver_encode(const int weight_counts[]);
+
+/**
+ * @brief Decodes a mixed-radix key back into a weight vector
+ *
+ * @param[in]  key           the key to decode
+ * @param[out] weight_counts will contain the decoded vector
+ */
+void gym_solver_decode(long key, int weight_counts[]);
+
+/**
+ * @brief Looks up the split to hand out for a request
+ *
+ * @param[in] availiable_key the encoded weights currently in the gym
+ * @param[in] total          the total weight requested
+ * @return the encoded split or GYM_NO_COMBINATION
+ */
+long gym_solver_lookup(long availiable_key, int total);
+
+/**
+ * @brief Finds the split to hand out for a request
+ *
+ * Prefers heavy weights: the split with the most weights of the heaviest
+ * class (then the next class and so on) is chosen.
+ *
+ * @param[in]  availiable the weights currently in the gym
+ * @param[in]  total      the total weight requested
+ * @param[out] split      will contain the split if true is returned
+ * @return true if total can be achieved
+ */
+bool gym_solver_find(const int availiable[], int total, int split[]);
+
+#endif /* GYM_SOLVER_H_ */
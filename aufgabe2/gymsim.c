@@ -0,0 +1,464 @@
+/** ****************************************************************
+ * @file    aufgabe2/gymsim.c
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    14.12.2016
+ * @brief   Discrete-event simulation of the philosophers and the gym
+ *
+ * Runs the philosophers in virtual time on a single thread: every workout
+ * and every rest is an event in a priority queue and time jumps from one
+ * event to the next. Weights are handed out by the same admission module
+ * (queues, fair mode, wakeups) as the monitor gym, so policy changes can be
+ * evaluated for hours of gym time in seconds. The same seed always gives the
+ * same result.
+ *
+ * Workout and rest durations are drawn from a distribution with the
+ * configured duration as mean:
+ *   fixed    always the mean
+ *   uniform  uniform between 0 and twice the mean
+ *   exp      exponential
+ *
+ * Prints the simulation speed, the time-weighted utilisation of every kind
+ * of weight, the wait percentiles, the hit rate of the kit cache and per
+ * training weight the acquisitions,
+ * waits and starving philosophers (never served or still waiting at the
+ * end).
+ *
+ * Usage: gymsim SECONDS SEED fixed|uniform|exp [philosophen_training options]
+ ******************************************************************
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "gym_admission.h"
+#include "stats.h"
+#include "errors.h"
+
+/**
+ * @brief Nanoseconds per millisecond
+ */
+#define NS_PER_MS 1000000L
+
+/**
+ * @brief Nanoseconds per second
+ */
+#define NS_PER_S 1000000000L
+
+/**
+ * @brief Distribution of workout and rest durations
+ */
+typedef enum {
+    DIST_FIXED,   //!< always the mean
+    DIST_UNIFORM, //!< uniform between 0 and twice the mean
+    DIST_EXP      //!< exponential
+} SimDist;
+
+/**
+ * @brief A simulated philosopher
+ */
+typedef struct {
+    GymTicket ticket;   //!< place in the wait queue
+    int *weights;       //!< weights the philosopher holds
+    int total;          //!< training weight
+    bool working_out;   //!< true between getting and returning weights
+    bool waiting;       //!< true while queued for weights
+    long wait_start;    //!< virtual time the current wait began
+    long acquisitions;  //!< number of workouts started
+    long wait_sum;      //!< sum of all waits in ns
+    long wait_max;      //!< longest wait in ns
+} SimPhilo;
+
+/**
+ * @brief An event: the workout or rest of a philosopher ends
+ */
+typedef struct {
+    long time; //!< virtual time in ns
+    long seq;  //!< order of scheduling, breaks ties between equal times
+    int philo; //!< the philosopher
+} SimEvent;
+
+/**
+ * @brief The philosophers
+ */
+static SimPhilo *philos = NULL;
+
+/**
+ * @brief Pending events as binary min-heap, at most one per philosopher
+ */
+static SimEvent *events = NULL;
+
+/**
+ * @brief Number of pending events
+ */
+static int event_count = 0;
+
+/**
+ * @brief Number of events scheduled so far
+ */
+static long event_seq = 0;
+
+/**
+ * @brief Current virtual time in ns
+ */
+static long now = 0;
+
+/**
+ * @brief State of the random number generator
+ */
+static unsigned long random_state;
+
+/**
+ * @brief Distribution of the durations
+ */
+static SimDist dist;
+
+/**
+ * @brief Tickets woken by gym_admission_wake, in the order they were woken
+ */
+static GymTicket **woken = NULL;
+
+/**
+ * @brief Number of entries in woken
+ */
+static int woken_count = 0;
+
+/**
+ * @brief Gets the next random number (splitmix64)
+ *
+ * @return 64 random bits
+ */
+static unsigned long next_random() {
+    unsigned long z = (random_state += 0x9E3779B97F4A7C15UL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9UL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBUL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Draws a duration from the configured distribution
+ *
+ * @param[in] mean_ns the mean in ns
+ * @return the duration in ns
+ */
+static long draw_duration(long mean_ns) {
+    // uniform in (0, 1]
+    double u = ((next_random() >> 11) + 1) * (1.0 / 9007199254740992.0);
+
+    switch (dist) {
+        case DIST_UNIFORM:
+            return (long) (u * 2 * mean_ns);
+        case DIST_EXP:
+            return (long) (-log(u) * mean_ns);
+        default:
+            return mean_ns;
+    }
+}
+
+/**
+ * @brief Checks whether event a is due before event b
+ */
+static bool event_before(const SimEvent *a, const SimEvent *b) {
+    return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+/**
+ * @brief Schedules the end of the current phase of a philosopher
+ *
+ * @param[in] philo the philosopher
+ * @param[in] delay time until the phase ends in ns
+ */
+static void schedule(int philo, long delay) {
+    SimEvent event = { now + delay, event_seq++, philo };
+
+    int pos = event_count++;
+    while (pos > 0 && event_before(&event, &events[(pos - 1) / 2])) {
+        events[pos] = events[(pos - 1) / 2];
+        pos = (pos - 1) / 2;
+    }
+    events[pos] = event;
+}
+
+/**
+ * @brief Removes the next event from the queue
+ *
+ * The queue must not be empty.
+ *
+ * @return the event
+ */
+static SimEvent pop_event() {
+    SimEvent first = events[0];
+    SimEvent last = events[--event_count];
+
+    int pos = 0;
+    while (true) {
+        int child = 2 * pos + 1;
+        if (child >= event_count) {
+            break;
+        }
+        if (child + 1 < event_count
+                && event_before(&events[child + 1], &events[child])) {
+            child++;
+        }
+        if (!event_before(&events[child], &last)) {
+            break;
+        }
+        events[pos] = events[child];
+        pos = child;
+    }
+    events[pos] = last;
+    return first;
+}
+
+/**
+ * @brief Collects the tickets woken by gym_admission_wake
+ *
+ * @param[in] ticket  the woken ticket
+ * @param[in] context unused
+ */
+static void collect_woken(GymTicket *ticket, void *context) {
+    woken[woken_count++] = ticket;
+}
+
+/**
+ * @brief A philosopher got its weights, records its wait and starts the
+ *        workout
+ *
+ * @param[in] id         the philosopher
+ * @param[in] workout_ns mean workout duration in ns
+ */
+static void start_workout(int id, long workout_ns) {
+    SimPhilo *philo = &philos[id];
+    long wait = now - philo->wait_start;
+
+    stats_record(STATS_GYM_WAIT, wait);
+    philo->acquisitions++;
+    philo->wait_sum += wait;
+    if (wait > philo->wait_max) {
+        philo->wait_max = wait;
+    }
+    philo->waiting = false;
+    philo->working_out = true;
+    schedule(id, draw_duration(workout_ns));
+}
+
+/**
+ * @brief Runs the simulation
+ *
+ * @param[in] config     the configuration
+ * @param[in] end        virtual time to stop at in ns
+ * @param[out] busy      will contain per kind of weight the integral of the
+ *                       weights in use over time (weight ns)
+ * @return number of completed get/return cycles
+ */
+static long simulate(const Config *config, long end, double busy[]) {
+    const int *availiable = gym_admission_availiable();
+    long workout_ns = config->workout_ms * NS_PER_MS;
+    long rest_ns = config->rest_ms * NS_PER_MS;
+    long cycles = 0;
+
+    // like the threads, everybody heads for the gym right away
+    for (int id = 0; id < config->philo_count; id++) {
+        schedule(id, 0);
+    }
+
+    while (event_count > 0 && events[0].time <= end) {
+        SimEvent event = pop_event();
+        for (int i = 0; i < config->weight_classes; i++) {
+            busy[i] += (double) (config->weights_inventory[i] - availiable[i])
+                    * (event.time - now);
+        }
+        now = event.time;
+
+        SimPhilo *philo = &philos[event.philo];
+        if (!philo->working_out) {
+            // rest is over
+            philo->wait_start = now;
+            if (gym_admission_try(philo->total, philo->weights)) {
+                start_workout(event.philo, workout_ns);
+            } else {
+                // an unreachable total is not queued - the philosopher drops
+                // out and counts as never served
+                philo->waiting = gym_admission_queue(philo->total,
+                        &philo->ticket, philo->weights);
+            }
+            continue;
+        }
+
+        // workout is over
+        philo->working_out = false;
+        gym_admission_return(philo->weights);
+        schedule(event.philo, draw_duration(rest_ns));
+        cycles++;
+
+        // the woken retry right away, in the order they were woken
+        woken_count = 0;
+        gym_admission_wake(collect_woken, NULL);
+        for (int w = 0; w < woken_count; w++) {
+            SimPhilo *waiter = (SimPhilo*) woken[w];
+            int id = waiter - philos;
+            if (waiter->ticket.granted
+                    || gym_admission_try(waiter->total, waiter->weights)) {
+                start_workout(id, workout_ns);
+            } else {
+                gym_admission_requeue(waiter->total, &waiter->ticket);
+            }
+        }
+    }
+
+    for (int i = 0; i < config->weight_classes; i++) {
+        busy[i] += (double) (config->weights_inventory[i] - availiable[i])
+                * (end - now);
+    }
+    now = end;
+    return cycles;
+}
+
+/**
+ * @brief Prints acquisitions, waits and starvation per training weight
+ *
+ * @param[in] config the configuration
+ */
+static void print_training_weights(const Config *config) {
+    printf("weight philosophers acquisitions wait_mean_ms wait_max_ms "
+            "never_served waiting_longest_ms\n");
+
+    for (int id = 0; id < config->philo_count; id++) {
+        int total = philos[id].total;
+        bool first = true;
+        for (int other = 0; other < id; other++) {
+            first = first && philos[other].total != total;
+        }
+        if (!first) {
+            continue;
+        }
+
+        int count = 0;
+        int never_served = 0;
+        long acquisitions = 0;
+        long wait_sum = 0;
+        long wait_max = 0;
+        long waiting = 0;
+        for (int other = id; other < config->philo_count; other++) {
+            SimPhilo *philo = &philos[other];
+            if (philo->total != total) {
+                continue;
+            }
+            count++;
+            never_served += philo->acquisitions == 0;
+            acquisitions += philo->acquisitions;
+            wait_sum += philo->wait_sum;
+            if (philo->wait_max > wait_max) {
+                wait_max = philo->wait_max;
+            }
+            if (philo->waiting && now - philo->wait_start > waiting) {
+                waiting = now - philo->wait_start;
+            }
+        }
+        printf("%6d %12d %12ld %12.3f %11.3f %12d %18.3f\n", total, count,
+                acquisitions,
+                acquisitions > 0 ? (double) wait_sum / acquisitions / NS_PER_MS
+                        : 0.0,
+                (double) wait_max / NS_PER_MS, never_served,
+                (double) waiting / NS_PER_MS);
+    }
+}
+
+/**
+ * @brief Program entry
+ */
+int main(int argc, char **argv) {
+    if (argc < 4 || atoi(argv[1]) <= 0) {
+        fprintf(stderr, "Usage: %s SECONDS SEED fixed|uniform|exp [options]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    long seconds = atol(argv[1]);
+    random_state = strtoul(argv[2], NULL, 0);
+    if (strcmp(argv[3], "fixed") == 0) {
+        dist = DIST_FIXED;
+    } else if (strcmp(argv[3], "uniform") == 0) {
+        dist = DIST_UNIFORM;
+    } else if (strcmp(argv[3], "exp") == 0) {
+        dist = DIST_EXP;
+    } else {
+        fprintf(stderr, "Unknown distribution: %s\n", argv[3]);
+        return EXIT_FAILURE;
+    }
+
+    // the remaining arguments are the same as for philosophen_training
+    argv[3] = argv[0];
+    Config config;
+    config_load(&config, argc - 3, argv + 3);
+
+    gym_admission_init(config.weight_classes, config.weight_masses,
+            config.weights_inventory);
+    gym_admission_set_fairness(config.fairness);
+
+    philos = calloc(config.philo_count, sizeof(SimPhilo));
+    events = malloc(sizeof(SimEvent) * config.philo_count);
+    woken = malloc(sizeof(GymTicket*) * config.philo_count);
+    int *weights = calloc(config.philo_count * config.weight_classes,
+            sizeof(int));
+    double *busy = calloc(config.weight_classes, sizeof(double));
+    FATAL_ERROR_HANDLING(philos == NULL || events == NULL || woken == NULL
+            || weights == NULL || busy == NULL,
+            "Failed to allocate simulation")
+    for (int id = 0; id < config.philo_count; id++) {
+        philos[id].weights = &weights[id * config.weight_classes];
+        philos[id].total = config.training_weights[id];
+    }
+
+    long start = stats_now();
+    long cycles = simulate(&config, seconds * NS_PER_S, busy);
+    double elapsed = (double) (stats_now() - start) / NS_PER_S;
+
+    printf("simulated %ld s, %ld cycles in %.3f s (%.0f cycles/s)\n",
+            seconds, cycles, elapsed, elapsed > 0 ? cycles / elapsed : 0.0);
+
+    double busy_sum = 0;
+    int inventory_sum = 0;
+    for (int i = 0; i < config.weight_classes; i++) {
+        busy_sum += busy[i] * config.weight_masses[i];
+        inventory_sum += config.weights_inventory[i] * config.weight_masses[i];
+    }
+    printf("utilisation %.1f%% of the mass", inventory_sum > 0 ?
+            busy_sum / inventory_sum / (seconds * NS_PER_S) * 100.0 : 0.0);
+    for (int i = 0; i < config.weight_classes; i++) {
+        printf(", %dkg %.1f%%", config.weight_masses[i],
+                config.weights_inventory[i] > 0 ? busy[i]
+                        / config.weights_inventory[i]
+                        / (seconds * NS_PER_S) * 100.0 : 0.0);
+    }
+    printf("\n");
+
+    StatsSnapshot *snapshot = malloc(sizeof(StatsSnapshot));
+    FATAL_ERROR_HANDLING(snapshot == NULL, "Failed to allocate snapshot")
+    stats_snapshot(snapshot, STATS_ALL_LABELS);
+    printf("wait p50 %.3f ms, p99 %.3f ms, p999 %.3f ms, max %.3f ms\n",
+            (double) stats_percentile(snapshot, STATS_GYM_WAIT, 50) / NS_PER_MS,
+            (double) stats_percentile(snapshot, STATS_GYM_WAIT, 99) / NS_PER_MS,
+            (double) stats_percentile(snapshot, STATS_GYM_WAIT, 99.9)
+                    / NS_PER_MS,
+            (double) stats_percentile(snapshot, STATS_GYM_WAIT, 100)
+                    / NS_PER_MS);
+    long kit_hits = snapshot->counters[STATS_GYM_KIT_HITS];
+    long kit_lookups = kit_hits + snapshot->counters[STATS_GYM_KIT_MISSES];
+    printf("kit cache %.1f%% hits, %ld kits broken\n", kit_lookups > 0 ?
+            100.0 * kit_hits / kit_lookups : 0.0,
+            snapshot->counters[STATS_GYM_KITS_BROKEN]);
+    print_training_weights(&config);
+
+    free(snapshot);
+    free(busy);
+    free(weights);
+    free(woken);
+    free(events);
+    free(philos);
+    config_free(&config);
+    return 0;
+}
@@ -7,49 +7,86 @@
  * @brief   Implementation of the Philosophers Module
  ******************************************************************
  */
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
 #include <pthread.h>
-#include <semaphore.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
 #include "philosophers.h"
 #include "errors.h"
 #include "gym.h"
+#include "seqlock.h"
+#include "status.h"
+#include "stats.h"
+#include "tasks.h"
+#include "trace.h"
 
 /* ****************************************************************************
  * constants
  *************************************************************************** */
 
 /**
- * @brief Threshold for the arg_barrier
+ * @brief Least number of philosopher threads a starter thread creates
+ *
+ * Below that, creating the starter costs more than it saves.
  */
-#define ARG_BARRIER_THRESHOLD 2
+#define PHILO_STARTER_MIN 256
 
 /**
- * @brief Threshold for the init_barrier
+ * @brief Stack size of the philosopher threads
+ *
+ * Philosophers only need a few frames, the default of several MB per thread
+ * would limit how many of them can be started.
  */
-#define INIT_BARRIER_THRESHOLD (PHILOSOPHERS_COUNT + 1)
+#define PHILO_STACK_SIZE (64 * 1024)
 
 /**
- * @brief the semapore is not shared between processes
+ * @brief Size of a cache line
+ *
+ * Every philosopher and every weights array gets lines of its own, so
+ * neighbouring philosophers do not invalidate each other's caches.
  */
-#define SEM_NOT_SHARED 0
+#define PHILO_CACHE_LINE 64
 
+#ifdef PHILO_NO_PADDING
 /**
- * @brief The initila value for the semaphore
+ * @brief Aligns the start of a philosopher (nothing: philosophers share lines,
+ *        see PHILO_PAD in the makefile)
  */
-#define SEM_INITIAL_VALUE 0
+#define PHILO_LINE_ALIGNED
+/**
+ * @brief The weights array of a philosopher is padded to a multiple of this
+ */
+#define PHILO_WEIGHTS_PADDING 1
+#else
+#define PHILO_LINE_ALIGNED _Alignas(PHILO_CACHE_LINE)
+#define PHILO_WEIGHTS_PADDING (PHILO_CACHE_LINE / (int) sizeof(int))
+#endif
 
 /**
- * @brief Counter for the Rest Loop
+ * @brief Milliseconds per second
  */
-#define REST_LOOP 1000000000
+#define MS_PER_SECOND 1000
 
 /**
- * @brief Counter for Workout Loop
+ * @brief Nanoseconds per millisecond
  */
-#define WORKOUT_LOOP 500000000
+#define NS_PER_MS 1000000L
+
+/**
+ * @brief Nanoseconds per second
+ */
+#define NS_PER_SECOND 1000000000L
 
 /* ****************************************************************************
  * static type definitions
@@ -80,50 +117,164 @@ static const char philo_command_names[] = { 'n', 'b', 'p', 'q' };
 
 /**
  * @brief Structure to represent and manage a Philosopher
+ *
+ * command is the mailbox of the philosopher: written with release by the
+ * main thread (and by the philosopher itself when it consumes PROCEED), read
+ * with acquire by the philosopher. It doubles as the futex word the
+ * philosopher sleeps on, so a new command wakes it up right away. Philosophers
+ * that run as tasks park instead and are unparked on a new command.
+ *
+ * Aligned to a cache line, so the hot fields never share a line with another
+ * philosopher (unless built with PHILO_PAD=0).
  */
 typedef struct {
-    PhiloCommand command;
-    PhiloState state;
-    pthread_t id;
-    sem_t block_semaphore;
-    int weights[GYM_WEIGHTS_AVAILIABLE_SIZE];
+    PHILO_LINE_ALIGNED
+    atomic_uint command;  //!< the current PhiloCommand
+    atomic_int state;     //!< the current PhiloState (only written by itself)
+    pthread_t id;         //!< the thread, if it runs as a thread
+    Task *task;           //!< the task, if it runs as a task
+    int *weights;
 } Philosopher;
 
+/**
+ * @brief Philosopher threads one starter thread creates
+ */
+typedef struct {
+    int first; //!< id of the first philosopher
+    int end;   //!< id after the last philosopher
+} PhiloRange;
+
 /* ****************************************************************************
  * static function definitions
  *************************************************************************** */
 /**
  * @brief Loop for the philosopher threads
  *
- * @param arg the id of the philosopher (int)
+ * @param arg the Philosopher of the thread
  */
 static void* philo_loop(void *arg);
 
 /**
- * @brief Creates a new philosopher thread and initializes it
+ * @brief Entry of the philosopher tasks
+ *
+ * @param arg the id of the philosopher (int, passed by value)
+ */
+static void philo_task(void *arg);
+
+/**
+ * @brief What a philosopher does until it gets the QUIT command
+ *
+ * @param id the id of the philosopher
+ */
+static void philo_run(int id);
+
+/**
+ * @brief Creates a new philosopher thread
+ *
+ * The philosopher must already be initialized.
  *
  * @param philo_id  the id of the philosopher
  */
 static void create_philothread(int philo_id);
 
+/**
+ * @brief Creates the philosopher threads of a range
+ *
+ * @param arg the PhiloRange
+ * @return NULL
+ */
+static void* start_philothreads(void *arg);
+
+/**
+ * @brief Creates a new philosopher task and initializes it
+ *
+ * @param philo_id  the id of the philosopher
+ */
+static void create_philotask(int philo_id);
+
+/**
+ * @brief Initializes the shared part of a philosopher
+ *
+ * @param philo_id  the id of the philosopher
+ */
+static void init_philosopher(int philo_id);
+
+/**
+ * @brief Wakes up a philosopher that waits for a command
+ *
+ * @param id the thread id
+ */
+static void wake_philosopher(int id);
+
 /**
  * @brief Checks if this thread should block
  *
- * If yes, then it blocks on the associated semaphore
+ * If yes, then it sleeps on its mailbox until it is unblocked
  *
  * @param id the thread id
  */
 static void check_block(int id);
 
 /**
- * @brief Busy witing loop
+ * @brief Changes the state of a philosopher and reports it to the display
  *
- * Executes a loop time times, checking command flag on every iteration.
+ * @param id    the thread id
+ * @param state the new state
+ */
+static void set_state(int id, PhiloState state);
+
+/**
+ * @brief Changes the command of a philosopher and reports it to the display
  *
- * @param time the amount of iterations
- * @param id   the thread id (for flag checking)
+ * @param id      the thread id
+ * @param command the new command
  */
-static void idle_loop(int time, int id);
+static void set_command(int id, PhiloCommand command);
+
+/**
+ * @brief Changes the command of a philosopher if it still has the expected
+ *        one and reports it to the display
+ *
+ * @param id       the thread id
+ * @param expected the command the philosopher must have
+ * @param command  the new command
+ * @return true if the command was changed
+ */
+static bool replace_command(int id, PhiloCommand expected,
+        PhiloCommand command);
+
+/**
+ * @brief Sleeps until the command of a philosopher changes
+ *
+ * May return early (spurious wakeup), so the caller has to check again.
+ *
+ * @param id       the thread id
+ * @param expected the command the philosopher has now
+ * @param deadline absolute CLOCK_MONOTONIC time to stop sleeping at, NULL to
+ *                 sleep without a time limit
+ * @return false if the deadline has passed
+ */
+static bool wait_command(int id, PhiloCommand expected,
+        const struct timespec *deadline);
+
+/**
+ * @brief Gets the current command of a philosopher
+ *
+ * @param id the thread id
+ * @return the command
+ */
+static PhiloCommand get_command(int id);
+
+/**
+ * @brief Idle waiting
+ *
+ * Sleeps for the given time, but wakes up immediately if a command arrives.
+ * Returns early on QUIT and PROCEED, the time spent blocked does not count.
+ *
+ * @param duration_ms how long to wait in milliseconds
+ * @param id          the thread id (for command checking)
+ */
+static void idle_wait(int duration_ms, int id);
 
 /**
  * @brief Workout phase
@@ -139,6 +290,13 @@ static void workout(int id);
  */
 static void rest(int id);
 
+/**
+ * @brief Copies the weights held by all philosophers, called by gym_snapshot
+ *
+ * @param[out] context gym_weight_classes ints per philosopher
+ */
+static void copy_weights(void *context);
+
 /**
  * @brief Getting weights from gym phase
  *
@@ -157,94 +315,204 @@ static void put_weights(int id);
  * global variables
  *************************************************************************** */
 
-/**
- * @brief Barrier, to make sure threads get their arguments properly
- */
-static pthread_barrier_t arg_barrier;
-
 /**
  * @brief Barrier, to make sure all threads get initialized before the first
  *        one starts.
  */
 static pthread_barrier_t init_barrier;
 
+/**
+ * @brief Number of philosophers
+ */
+static int philos_count = 0;
+
 /**
  * @brief Array to manage all threads
  */
-static Philosopher philos[PHILOSOPHERS_COUNT];
+static Philosopher *philos = NULL;
+
+/**
+ * @brief Weights held by the philosophers, weights_stride per philosopher
+ */
+static int *philos_weights = NULL;
+
+/**
+ * @brief Distance between the weights of two philosophers in philos_weights
+ *
+ * gym_weight_classes rounded up to whole cache lines.
+ */
+static int weights_stride = 0;
+
+/**
+ * @brief Number of CPUs the philosophers are pinned to, 0 for no pinning
+ */
+static int cpu_count = 0;
+
+/**
+ * @brief The CPUs the philosophers are pinned to, round robin
+ */
+static int *cpus = NULL;
+
+/**
+ * @brief Number of worker threads running the philosophers as tasks, 0 to
+ *        run every philosopher in a thread of its own
+ */
+static int worker_count = 0;
 
 /**
  * @brief Array that contains the training weights for each philosopher
  */
-static const int training_weights[PHILOSOPHERS_COUNT] = { PHILOSOPHERS_WEIGHTS };
+static int *training_weights = NULL;
+
+/**
+ * @brief Duration of the workout phase in milliseconds
+ */
+static atomic_int workout_ms = PHILOSOPHERS_WORKOUT_MS;
+
+/**
+ * @brief Duration of the rest phase in milliseconds
+ */
+static atomic_int rest_ms = PHILOSOPHERS_REST_MS;
 
 /* ****************************************************************************
  * function declarations
  *************************************************************************** */
 
 /*
- * Displays the current status on the screen
- *
- * Will print state and held weights information for all philosophers and the
- * gym.
+ * Reports a change of the weights held by a philosopher to the status display
  */
-void philosophers_display_status(const int gym_weights[]) {
-    // initialize accumulator for weights
-    int weight_acum[GYM_WEIGHTS_AVAILIABLE_SIZE] = { 0 };
+void philosophers_weights_changed(const int weight_counts[],
+        const int gym_weights[]) {
+    // the gym only knows the weights array - find the philosopher owning it
+    int id = (weight_counts - philos_weights) / weights_stride;
+    status_push_weights(id, weight_counts, gym_weights);
+}
 
-    // print information for each philosopher
-    for (int i = 0; i < PHILOSOPHERS_COUNT; i++) {
-        printf("%d(%d)%c:%c:[%d, %d, %d] ", i, training_weights[i],
-                philo_command_names[philos[i].command],
-                philo_state_names[philos[i].state], philos[i].weights[0],
-                philos[i].weights[1], philos[i].weights[2]);
+/*
+ * Gets the number of philosophers
+ */
+int philosophers_get_count() {
+    return philos_count;
+}
 
-        // accumulate
-        weight_acum[0] += philos[i].weights[0];
-        weight_acum[1] += philos[i].weights[1];
-        weight_acum[2] += philos[i].weights[2];
+/*
+ * Sets the duration of the workout and rest phases
+ */
+void philosophers_set_durations(int workout, int rest) {
+    atomic_store(&workout_ms, workout);
+    atomic_store(&rest_ms, rest);
+}
 
-    }
+/*
+ * Gets the duration of the workout and rest phases
+ */
+void philosophers_get_durations(int *workout, int *rest) {
+    *workout = atomic_load(&workout_ms);
+    *rest = atomic_load(&rest_ms);
+}
 
-    // print information about gym
-    printf("Gym: [%d, %d, %d]\n", gym_weights[0], gym_weights[1],
-            gym_weights[2]);
-    // accumulate
-    weight_acum[0] += gym_weights[0];
-    weight_acum[1] += gym_weights[1];
-    weight_acum[2] += gym_weights[2];
+/*
+ * Pins the philosophers to CPUs
+ */
+void philosophers_set_affinity(int count, const int cpu_list[]) {
+    free(cpus);
+    cpus = NULL;
+    cpu_count = count;
+    if (count > 0) {
+        cpus = malloc(sizeof(int) * count);
+        FATAL_ERROR_HANDLING(cpus == NULL,
+                "[philosophers_set_affinity] Failed to allocate CPUs")
+        memcpy(cpus, cpu_list, sizeof(int) * count);
+    }
+}
 
-    // check validity
-    bool invalid = weight_acum[0] != gym_weights_availiable[0]
-            || weight_acum[1] != gym_weights_availiable[1]
-            || weight_acum[2] != gym_weights_availiable[2];
-    FATAL_ERROR_HANDLING(invalid, "Synchronization error!")
+/*
+ * Runs the philosophers as tasks on a pool of worker threads
+ */
+void philosophers_set_workers(int workers) {
+    worker_count = workers;
 }
 
 /*
  * Initializes the philosophers
  */
-void philosophers_init() {
-    // Initialize arg_barrier
-    int res = pthread_barrier_init(&arg_barrier, NULL, ARG_BARRIER_THRESHOLD);
-    FATAL_ERROR_HANDLING(res,
-            "[philosophers_init] Failed to create arg_barrier")
+void philosophers_init(int count, const int weights[]) {
+    // Allocate storage, every philosopher on cache lines of its own
+    weights_stride = (gym_weight_classes + PHILO_WEIGHTS_PADDING - 1)
+            / PHILO_WEIGHTS_PADDING * PHILO_WEIGHTS_PADDING;
+    size_t weights_size = sizeof(int) * count * weights_stride;
+    // aligned_alloc wants whole lines, only matters without padding
+    size_t weights_lines = (weights_size + PHILO_CACHE_LINE - 1)
+            / PHILO_CACHE_LINE * PHILO_CACHE_LINE;
+    size_t philos_lines = (sizeof(Philosopher) * count + PHILO_CACHE_LINE - 1)
+            / PHILO_CACHE_LINE * PHILO_CACHE_LINE;
+
+    philos_count = count;
+    philos = aligned_alloc(PHILO_CACHE_LINE, philos_lines);
+    philos_weights = aligned_alloc(PHILO_CACHE_LINE, weights_lines);
+    training_weights = malloc(sizeof(int) * count);
+    FATAL_ERROR_HANDLING(
+            philos == NULL || philos_weights == NULL
+                    || training_weights == NULL,
+            "[philosophers_init] Failed to allocate philosophers")
+    memset(philos, 0, sizeof(Philosopher) * count);
+    memset(philos_weights, 0, weights_size);
+    memcpy(training_weights, weights, sizeof(int) * count);
+
+    if (worker_count > 0) {
+        // tasks only start running with tasks_start, no barriers needed
+        status_init(philos_count, training_weights);
+        tasks_init(worker_count);
+        for (int i = 0; i < philos_count; i++) {
+            create_philotask(i);
+        }
+        tasks_start();
+        return;
+    }
 
     // Initialize init_barrier
-    res = pthread_barrier_init(&init_barrier, NULL, INIT_BARRIER_THRESHOLD);
+    int res = pthread_barrier_init(&init_barrier, NULL, philos_count + 1);
     FATAL_ERROR_HANDLING(res,
             "[philosophers_init] Failed to create init_barrier")
 
-    // Initialize all Philosophers
-    for (int i = 0; i < PHILOSOPHERS_COUNT; i++) {
-        create_philothread(i);
+    // Start status display before anybody can change anything
+    status_init(philos_count, training_weights);
+
+    // Initialize all Philosophers, so the threads find everything they need
+    // in their own Philosopher and nobody has to wait for them to start
+    for (int i = 0; i < philos_count; i++) {
+        init_philosopher(i);
+    }
+
+    // Create the threads from one starter thread per CPU
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    int starter_count = philos_count / PHILO_STARTER_MIN;
+    if (starter_count > online) {
+        starter_count = online;
+    }
+    if (starter_count <= 1) {
+        PhiloRange all = { 0, philos_count };
+        start_philothreads(&all);
+    } else {
+        pthread_t starters[starter_count];
+        PhiloRange ranges[starter_count];
+        for (int s = 0; s < starter_count; s++) {
+            ranges[s].first = (long) philos_count * s / starter_count;
+            ranges[s].end = (long) philos_count * (s + 1) / starter_count;
+            res = pthread_create(&starters[s], NULL, start_philothreads,
+                    &ranges[s]);
+            FATAL_ERROR_HANDLING(res,
+                    "[philosophers_init] Failed to create starter thread")
+        }
+        for (int s = 0; s < starter_count; s++) {
+            pthread_join(starters[s], NULL);
+        }
     }
 
     // Wait for initialization of all threads
     pthread_barrier_wait(&init_barrier);
 
     // Cleanup barriers
-    pthread_barrier_destroy(&arg_barrier);
     pthread_barrier_destroy(&init_barrier);
 }
 
@@ -252,37 +520,42 @@ void philosophers_init() {
  * Stops all the philosopher threads
  */
 void philosophers_quit() {
-    // Send quit command to all Philosophers
-    for (int i = 0; i < PHILOSOPHERS_COUNT; i++) {
-        philos[i].command = QUIT;
-    }
-
-    // Wakeup all philosophers
-    for (int i = 0; i < PHILOSOPHERS_COUNT; i++) {
-        sem_post(&(philos[i].block_semaphore));
+    // Send quit command to all Philosophers (also wakes them up)
+    for (int i = 0; i < philos_count; i++) {
+        set_command(i, QUIT);
     }
 
     // Wait for all philosophers to quit
-    for (int i = 0; i < PHILOSOPHERS_COUNT; i++) {
-        pthread_join(philos[i].id, NULL);
+    if (worker_count > 0) {
+        tasks_wait();
+    } else {
+        for (int i = 0; i < philos_count; i++) {
+            pthread_join(philos[i].id, NULL);
+        }
     }
 
     // Cleanup
-    for (int i = 0; i < PHILOSOPHERS_COUNT; i++) {
-        sem_destroy(&(philos[i].block_semaphore));
-    }
+    status_quit();
+
+    free(philos);
+    free(philos_weights);
+    free(training_weights);
+    philos = NULL;
+    philos_weights = NULL;
+    training_weights = NULL;
+    philos_count = 0;
 }
 
 /*
  * Blocks the specified philosopher
  */
 int philosophers_block(int philo_id) {
-    if (philo_id < 0 || philo_id >= PHILOSOPHERS_COUNT) {
+    if (philo_id < 0 || philo_id >= philos_count) {
         return E_NO_SUCH_PHILOSOPHER;
     }
 
     // send block command
-    philos[philo_id].command = BLOCK;
+    set_command(philo_id, BLOCK);
 
     return 0;
 }
@@ -291,17 +564,12 @@ int philosophers_block(int philo_id) {
  * Unblocks the specified philosopher
  */
 int philosophers_unblock(int philo_id) {
-    if (philo_id < 0 || philo_id >= PHILOSOPHERS_COUNT) {
+    if (philo_id < 0 || philo_id >= philos_count) {
         return E_NO_SUCH_PHILOSOPHER;
     }
 
-    // clear  block command
-    if (philos[philo_id].command == BLOCK) {
-        philos[philo_id].command = NORMAL_EXECUTION;
-    }
-
-    // wakeup thread
-    sem_post(&(philos[philo_id].block_semaphore));
+    // clear block command (wakes up the thread)
+    replace_command(philo_id, BLOCK, NORMAL_EXECUTION);
     return 0;
 }
 
@@ -309,40 +577,96 @@ int philosophers_unblock(int philo_id) {
  * Proceeds the specified philosopher behind the current loop
  */
 int philosophers_proceed(int philo_id) {
-    if (philo_id < 0 || philo_id >= PHILOSOPHERS_COUNT) {
+    if (philo_id < 0 || philo_id >= philos_count) {
         return E_NO_SUCH_PHILOSOPHER;
     }
 
     // send proceed command
-    philos[philo_id].command = PROCEED;
+    set_command(philo_id, PROCEED);
 
     return 0;
 }
 
 /*
- * Creates a new philosopher thread and initializes it
+ * Gets what the specified philosopher is doing right now
  */
-static void create_philothread(int philo_id) {
-    // initialize
-    philos[philo_id].command = NORMAL_EXECUTION;
-    philos[philo_id].state = UNDEFINED;
+int philosophers_get_status(int philo_id, char *state, char *command,
+        int *training_weight) {
+    if (philo_id < 0 || philo_id >= philos_count) {
+        return E_NO_SUCH_PHILOSOPHER;
+    }
+
+    *state = philo_state_names[atomic_load_explicit(&(philos[philo_id].state),
+            memory_order_relaxed)];
+    *command = philo_command_names[get_command(philo_id)];
+    *training_weight = training_weights[philo_id];
+    return 0;
+}
+
+/*
+ * Gets the weights held by all philosophers and the weights in the gym at one
+ * point in time
+ */
+bool philosophers_snapshot(int gym_weights[], int weight_counts[]) {
+    return gym_snapshot(gym_weights, copy_weights, weight_counts);
+}
+
+/*
+ * Initializes the shared part of a philosopher
+ */
+static void init_philosopher(int philo_id) {
+    // nobody can wait on the mailbox yet, so there is nobody to wake
+    atomic_store_explicit(&(philos[philo_id].command), NORMAL_EXECUTION,
+            memory_order_relaxed);
+    status_push_command(philo_id, philo_command_names[NORMAL_EXECUTION]);
+    TRACE(philo_id, TRACE_PHILOSOPHER, training_weights[philo_id]);
+    set_state(philo_id, UNDEFINED);
 
-    for (int i = 0; i < GYM_WEIGHTS_AVAILIABLE_SIZE; i++) {
-        philos[philo_id].weights[i] = 0;
+    philos[philo_id].weights = philos_weights + philo_id * weights_stride;
+}
+
+/*
+ * Creates a new philosopher task and initializes it
+ */
+static void create_philotask(int philo_id) {
+    init_philosopher(philo_id);
+    philos[philo_id].task = tasks_spawn(philo_task, (void*) (long) philo_id);
+}
+
+/*
+ * Creates the philosopher threads of a range
+ */
+static void* start_philothreads(void *arg) {
+    const PhiloRange *range = arg;
+    for (int i = range->first; i < range->end; i++) {
+        create_philothread(i);
     }
+    return NULL;
+}
 
-    // initialize condition variable
-    int res = sem_init(&(philos[philo_id].block_semaphore), SEM_NOT_SHARED,
-    SEM_INITIAL_VALUE);
-    FATAL_ERROR_HANDLING(res,
-            "[create_philothread] Failed to initialize semaphore")
+/*
+ * Creates a new philosopher thread
+ */
+static void create_philothread(int philo_id) {
+    // create thread with a small stack
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    int res = pthread_attr_setstacksize(&attr, PHILO_STACK_SIZE);
+    FATAL_ERROR_HANDLING(res, "[create_philothread] Failed to set stack size")
+
+    if (cpu_count > 0) {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(cpus[philo_id % cpu_count], &cpu_set);
+        res = pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpu_set);
+        FATAL_ERROR_HANDLING(res, "[create_philothread] Failed to set affinity")
+    }
 
-    // create thread
-    res = pthread_create(&(philos[philo_id].id), NULL, philo_loop, &philo_id);
+    // the thread gets its own Philosopher, nothing on our stack
+    res = pthread_create(&(philos[philo_id].id), &attr, philo_loop,
+            &philos[philo_id]);
     FATAL_ERROR_HANDLING(res, "[create_philothread] Failed to create thread")
-
-    // Wait until thread has initialized itself
-    pthread_barrier_wait(&arg_barrier);
+    pthread_attr_destroy(&attr);
 }
 
 /*
@@ -350,72 +674,211 @@ static void create_philothread(int philo_id) {
  * Loop for the philosopher threads
  */
 static void* philo_loop(void *arg) {
-    // get id and store it in local variables
-    int id = *((int*) arg);
-
-    // tell create_philothread that we finished initialization
-    pthread_barrier_wait(&arg_barrier);
+    int id = (Philosopher*) arg - philos;
+    STATS_LABEL(id);
 
     // Wait for initialization of all threads
     pthread_barrier_wait(&init_barrier);
 
-    // philoloop "main" code
-    while (philos[id].command != QUIT) {
+    philo_run(id);
+    return NULL;
+}
+
+/*
+ * Entry of the philosopher tasks
+ */
+static void philo_task(void *arg) {
+    philo_run((int) (long) arg);
+}
+
+/*
+ * philoloop "main" code
+ */
+static void philo_run(int id) {
+    while (get_command(id) != QUIT) {
         get_weights(id);
         workout(id);
         put_weights(id);
         rest(id);
     }
+}
 
-    return NULL;
+/*
+ * change state and report it
+ */
+static void set_state(int id, PhiloState state) {
+    atomic_store_explicit(&(philos[id].state), state, memory_order_relaxed);
+    status_push_state(id, philo_state_names[state]);
+    TRACE(id, TRACE_STATE, philo_state_names[state]);
+}
+
+/*
+ * change command, report it and wake up the philosopher
+ */
+static void set_command(int id, PhiloCommand command) {
+    atomic_store_explicit(&(philos[id].command), command,
+            memory_order_release);
+    status_push_command(id, philo_command_names[command]);
+    TRACE(id, TRACE_COMMAND, philo_command_names[command]);
+    wake_philosopher(id);
+}
+
+/*
+ * change command if it is still the expected one
+ */
+static bool replace_command(int id, PhiloCommand expected,
+        PhiloCommand command) {
+    unsigned int current = expected;
+    if (!atomic_compare_exchange_strong_explicit(&(philos[id].command),
+            &current, command, memory_order_acq_rel, memory_order_acquire)) {
+        return false;
+    }
+    status_push_command(id, philo_command_names[command]);
+    TRACE(id, TRACE_COMMAND, philo_command_names[command]);
+    wake_philosopher(id);
+    return true;
+}
+
+/*
+ * wake up a philosopher waiting for a command
+ */
+static void wake_philosopher(int id) {
+    if (philos[id].task != NULL) {
+        tasks_unpark(philos[id].task);
+    } else {
+        syscall(SYS_futex, &(philos[id].command), FUTEX_WAKE_PRIVATE, INT_MAX,
+                NULL, NULL, 0);
+    }
+}
+
+/*
+ * sleep until the command changes
+ */
+static bool wait_command(int id, PhiloCommand expected,
+        const struct timespec *deadline) {
+    if (philos[id].task != NULL) {
+        // park instead of blocking the worker, set_command unparks
+        if (get_command(id) != expected) {
+            return true;
+        }
+        if (deadline == NULL) {
+            tasks_park();
+            return true;
+        }
+        tasks_park_until(deadline);
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec < deadline->tv_sec
+                || (now.tv_sec == deadline->tv_sec
+                        && now.tv_nsec < deadline->tv_nsec);
+    }
+
+    // FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC deadline
+    long res = syscall(SYS_futex, &(philos[id].command),
+            FUTEX_WAIT_BITSET_PRIVATE, expected, deadline, NULL,
+            FUTEX_BITSET_MATCH_ANY);
+    return res == 0 || errno != ETIMEDOUT;
+}
+
+/*
+ * get current command
+ */
+static PhiloCommand get_command(int id) {
+    return atomic_load_explicit(&(philos[id].command), memory_order_acquire);
 }
 
 /*
  * check if thread should block
  */
 static void check_block(int id) {
-    if (philos[id].command == BLOCK) {
-        sem_wait(&(philos[id].block_semaphore));
+    while (get_command(id) == BLOCK) {
+        wait_command(id, BLOCK, NULL);
     }
 }
 
 /*
- * busy waiting loop
- */
-static void idle_loop(int time, int id) {
-    // busy waiting loop that checks command flags
-    for (int i = 0; i < time; i++) {
-        if (philos[id].command == QUIT) {
-            break;
-        } else if (philos[id].command == PROCEED) {
-            philos[id].command = NORMAL_EXECUTION;
-            break;
-        } else {
-            check_block(id);
+ * idle waiting, interrupted by commands
+ */
+static void idle_wait(int duration_ms, int id) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += duration_ms / MS_PER_SECOND;
+    deadline.tv_nsec += (duration_ms % MS_PER_SECOND) * NS_PER_MS;
+    if (deadline.tv_nsec >= NS_PER_SECOND) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= NS_PER_SECOND;
+    }
+
+    bool done = false;
+    while (!done) {
+        PhiloCommand command = get_command(id);
+        switch (command) {
+            case QUIT:
+                done = true;
+                break;
+            case PROCEED:
+                // only consume it if main did not send something else since
+                done = replace_command(id, PROCEED, NORMAL_EXECUTION);
+                break;
+            case BLOCK: {
+                // blocked time does not count - move the deadline by it
+                struct timespec now;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                long remaining = (deadline.tv_sec - now.tv_sec) * NS_PER_SECOND
+                        + deadline.tv_nsec - now.tv_nsec;
+                wait_command(id, BLOCK, NULL);
+
+                clock_gettime(CLOCK_MONOTONIC, &deadline);
+                if (remaining > 0) {
+                    deadline.tv_sec += remaining / NS_PER_SECOND;
+                    deadline.tv_nsec += remaining % NS_PER_SECOND;
+                    if (deadline.tv_nsec >= NS_PER_SECOND) {
+                        deadline.tv_sec++;
+                        deadline.tv_nsec -= NS_PER_SECOND;
+                    }
+                }
+                break;
+            }
+            case NORMAL_EXECUTION:
+                done = !wait_command(id, NORMAL_EXECUTION, &deadline);
+                break;
         }
     }
 }
+
 /*
  * workout phase
  */
 static void workout(int id) {
-    philos[id].state = WORKOUT;
-    idle_loop(WORKOUT_LOOP, id);
+    set_state(id, WORKOUT);
+    idle_wait(atomic_load(&workout_ms), id);
 }
 
 /*
  * resting phase
  */
 static void rest(int id) {
-    philos[id].state = REST;
-    idle_loop(REST_LOOP, id);
+    set_state(id, REST);
+    idle_wait(atomic_load(&rest_ms), id);
+}
+
+/*
+ * Copies the weights held by all philosophers, called by gym_snapshot
+ */
+static void copy_weights(void *context) {
+    int *weight_counts = context;
+    for (int id = 0; id < philos_count; id++) {
+        seqlock_copy(weight_counts + id * gym_weight_classes,
+                philos_weights + id * weights_stride, gym_weight_classes);
+    }
 }
 
 /*
  * getting weights from the gym phase
  */
 static void get_weights(int id) {
-    philos[id].state = GET_WEIGHTS;
+    set_state(id, GET_WEIGHTS);
     check_block(id);
     gym_get_weights(training_weights[id], philos[id].weights);
 }
@@ -424,7 +887,7 @@ static void get_weights(int id) {
  * returning weights to the gym phase
  */
 static void put_weights(int id) {
-    philos[id].state = RETURN_WEIGHTS;
+    set_state(id, RETURN_WEIGHTS);
     check_block(id);
     gym_return_weights(philos[id].weights);
 }
@@ -11,37 +11,99 @@
 #ifndef PHILOSOPHERS_H_
 #define PHILOSOPHERS_H_
 
+#include <stdbool.h>
+
 /**
- * @brief How many Philosophers will be created
+ * @brief The training weights for the Philosophers if nothing else is
+ *        configured
  *
- * If this is changed, PHILOSOPHERS_WEIGHTS must also be changed to match
+ * One Philosopher is created for every weight.
  */
-#define PHILOSOPHERS_COUNT 5
+#define PHILOSOPHERS_WEIGHTS 6, 8, 12, 12, 14
 
 /**
- * @brief The weights for the Philosophers
- *
- * If the number of weights is changed, PHILOSOPHERS_COUNT must also be changed
- * to match.
- * This does not apply for changes in amount.
+ * @brief Duration of the workout phase in milliseconds if nothing else is
+ *        configured
  */
-#define PHILOSOPHERS_WEIGHTS 6, 8, 12, 12, 14
+#define PHILOSOPHERS_WORKOUT_MS 500
 
 /**
- * @brief Displays the current status on the screen
+ * @brief Duration of the rest phase in milliseconds if nothing else is
+ *        configured
+ */
+#define PHILOSOPHERS_REST_MS 1000
+
+/**
+ * @brief Reports a change of the weights held by a philosopher to the status
+ *        display
  *
- * Will print state and held weights information for all philosophers and the
- * gym.
+ * Called by the gym whenever it handed out or took back weights.
  *
- * @param gym_weights the weights currently present in the gym.
- *                    used for displaying and sync error checking
+ * @param weight_counts the weights array of the philosopher (as passed to the
+ *                      gym) after the change
+ * @param gym_weights   the weights currently present in the gym, used for
+ *                      sync error checking. NULL if the gym can not provide a
+ *                      snapshot that is consistent with the change.
  */
-void philosophers_display_status(const int gym_weights[]);
+void philosophers_weights_changed(const int weight_counts[],
+        const int gym_weights[]);
 
 /**
  * @brief Initializes the philosophers
+ *
+ * Requires the gym to be initialized.
+ *
+ * @param count   how many philosophers to create
+ * @param weights the training weight of every philosopher (count entries)
+ */
+void philosophers_init(int count, const int weights[]);
+
+/**
+ * @brief Gets the number of philosophers
+ *
+ * @return the number of philosophers created by philosophers_init
+ */
+int philosophers_get_count();
+
+/**
+ * @brief Sets the duration of the workout and rest phases
+ *
+ * Can be called at any time, takes effect with the next phase.
+ *
+ * @param workout duration of the workout phase in milliseconds
+ * @param rest    duration of the rest phase in milliseconds
+ */
+void philosophers_set_durations(int workout, int rest);
+
+/**
+ * @brief Gets the duration of the workout and rest phases
+ *
+ * @param[out] workout duration of the workout phase in milliseconds
+ * @param[out] rest    duration of the rest phase in milliseconds
  */
-void philosophers_init();
+void philosophers_get_durations(int *workout, int *rest);
+
+/**
+ * @brief Pins the philosopher threads to CPUs
+ *
+ * Philosopher i runs on cpus[i % count]. Must be called before
+ * philosophers_init.
+ *
+ * @param count number of CPUs, 0 to not pin the philosophers
+ * @param cpus  the CPUs (count entries)
+ */
+void philosophers_set_affinity(int count, const int cpus[]);
+
+/**
+ * @brief Runs the philosophers as tasks on a pool of worker threads
+ *
+ * Makes huge numbers of philosophers possible, see tasks.h. The CPU affinity
+ * is not used then. Must be called before philosophers_init.
+ *
+ * @param workers number of worker threads, 0 to run every philosopher in a
+ *                thread of its own
+ */
+void philosophers_set_workers(int workers);
 
 /**
  * @brief Stops all the philosopher threads
@@ -78,4 +140,33 @@ int philosophers_unblock(int philo_id);
  */
 int philosophers_proceed(int philo_id);
 
+/**
+ * @brief Gets what the specified philosopher is doing right now
+ *
+ * @param[in]  philo_id        the ID of the philosopher
+ * @param[out] state           display character of the state (G W P R U)
+ * @param[out] command         display character of the command (n b p q)
+ * @param[out] training_weight the training weight of the philosopher
+ * @return error code
+ * @retval 0                     no error
+ * @retval E_NO_SUCH_PHILOSOPHER the given ID does not exist
+ */
+int philosophers_get_status(int philo_id, char *state, char *command,
+        int *training_weight);
+
+/**
+ * @brief Gets the weights held by all philosophers and the weights in the gym
+ *        at one point in time
+ *
+ * Does not enter the gym monitor (see gym_snapshot), so it can be called as
+ * often as needed without slowing the philosophers down.
+ *
+ * @param[out] gym_weights   the weights in the gym (gym_weight_classes
+ *                           entries)
+ * @param[out] weight_counts the weights held, gym_weight_classes entries per
+ *                           philosopher
+ * @return false if there was no consistent snapshot
+ */
+bool philosophers_snapshot(int gym_weights[], int weight_counts[]);
+
 #endif /* PHILOSOPHERS_H_ */
@@ -0,0 +1,106 @@
+/** ****************************************************************
+ * @file    aufgabe2/seqlock.h
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    16.12.2016
+ * @brief   Sequence lock for readers that must not block the writer
+ *
+ * The writer makes the sequence odd before it changes the data and even
+ * again afterwards. A reader remembers the sequence, copies the data and
+ * checks that the sequence is still the same even number - otherwise the
+ * copy may be torn and it has to try again. Readers never write shared
+ * memory, so they neither delay the writer nor each other.
+ *
+ * There must only be one writer at a time (the caller has to serialize them,
+ * e.g. with the lock that guards the data anyway).
+ ******************************************************************
+ */
+
+#ifndef SEQLOCK_H_
+#define SEQLOCK_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+/**
+ * @brief A sequence lock
+ */
+typedef struct {
+    atomic_uint sequence; //!< odd while the data is being changed
+} SeqLock;
+
+/**
+ * @brief Initializes a sequence lock
+ *
+ * @param[out] lock the lock
+ */
+static inline void seqlock_init(SeqLock *lock) {
+    atomic_init(&lock->sequence, 0);
+}
+
+/**
+ * @brief Starts changing the data
+ *
+ * @param[in] lock the lock
+ */
+static inline void seqlock_write_begin(SeqLock *lock) {
+    unsigned sequence = atomic_load_explicit(&lock->sequence,
+            memory_order_relaxed);
+    atomic_store_explicit(&lock->sequence, sequence + 1, memory_order_relaxed);
+    // the odd sequence must be visible before any of the changes
+    atomic_thread_fence(memory_order_release);
+}
+
+/**
+ * @brief Finishes changing the data
+ *
+ * @param[in] lock the lock
+ */
+static inline void seqlock_write_end(SeqLock *lock) {
+    unsigned sequence = atomic_load_explicit(&lock->sequence,
+            memory_order_relaxed);
+    atomic_store_explicit(&lock->sequence, sequence + 1, memory_order_release);
+}
+
+/**
+ * @brief Starts reading the data
+ *
+ * @param[in] lock the lock
+ * @return the sequence to pass to seqlock_read_valid
+ */
+static inline unsigned seqlock_read_begin(SeqLock *lock) {
+    return atomic_load_explicit(&lock->sequence, memory_order_acquire);
+}
+
+/**
+ * @brief Checks whether the data read since seqlock_read_begin is consistent
+ *
+ * @param[in] lock     the lock
+ * @param[in] sequence what seqlock_read_begin returned
+ * @return true if no writer was active while reading
+ */
+static inline bool seqlock_read_valid(SeqLock *lock, unsigned sequence) {
+    // the copies must be done before the sequence is checked again
+    atomic_thread_fence(memory_order_acquire);
+    return (sequence & 1) == 0 && atomic_load_explicit(&lock->sequence,
+            memory_order_relaxed) == sequence;
+}
+
+/**
+ * @brief Copies data guarded by a sequence lock
+ *
+ * The writer may change the data concurrently, so every int is read with an
+ * atomic load (the result is only used if seqlock_read_valid succeeds).
+ *
+ * @param[out] to    where to copy to
+ * @param[in]  from  where to copy from
+ * @param[in]  count number of ints
+ */
+static inline void seqlock_copy(int to[], const int from[], int count) {
+    for (int i = 0; i < count; i++) {
+        to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+    }
+}
+
+#endif /* SEQLOCK_H_ */
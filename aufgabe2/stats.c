@@ -0,0 +1,293 @@
+/** ****************************************************************
+ * @file    aufgabe2/stats.c
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    09.12.2016
+ * @brief   Implementation for the Statistics module
+ ******************************************************************
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "stats.h"
+#include "errors.h"
+
+/**
+ * @brief Histograms of one thread
+ *
+ * Only written by the owning thread, so relaxed loads and stores are enough.
+ * Kept after the thread exits, so its durations still show up in snapshots.
+ */
+typedef struct StatsThread {
+    atomic_long buckets[STATS_KINDS][STATS_BUCKETS]; //!< counts per bucket
+    atomic_long sum[STATS_KINDS];                    //!< sum of all durations
+    atomic_long counters[STATS_COUNTERS];            //!< event counters
+    int label;                                       //!< see stats_set_label
+    struct StatsThread *next;                        //!< next thread
+} StatsThread;
+
+/**
+ * @brief Mutex guarding the list of threads
+ */
+static pthread_mutex_t threads_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief All threads that ever recorded something
+ */
+static StatsThread *threads = NULL;
+
+/**
+ * @brief The histograms of the calling thread, NULL until its first record
+ */
+static __thread StatsThread *local = NULL;
+
+/*
+ * Operations of the calling thread until the next one is timed
+ */
+__thread int stats_sample_countdown = 0;
+
+/**
+ * @brief State of the random number generator for the sample intervals of
+ *        the calling thread, 0 until its first use
+ */
+static __thread unsigned int sample_state = 0;
+
+/**
+ * @brief Gets the histograms of the calling thread, creates them on first use
+ *
+ * @return the histograms of the calling thread
+ */
+static StatsThread* local_histograms() {
+    if (local == NULL) {
+        local = calloc(1, sizeof(StatsThread));
+        FATAL_ERROR_HANDLING(local == NULL,
+                "[stats] Failed to allocate histogram")
+        local->label = STATS_ALL_LABELS;
+        pthread_mutex_lock(&threads_mtx);
+        local->next = threads;
+        threads = local;
+        pthread_mutex_unlock(&threads_mtx);
+    }
+    return local;
+}
+
+/**
+ * @brief Gets the bucket of a duration
+ *
+ * @param[in] duration the duration in nanoseconds
+ * @return the bucket index
+ */
+static int bucket_of(long duration) {
+    if (duration < (1 << STATS_SUB_BITS)) {
+        return duration < 0 ? 0 : (int) duration;
+    }
+    int exponent = 63 - __builtin_clzl(duration);
+    int sub = (duration >> (exponent - STATS_SUB_BITS))
+            & ((1 << STATS_SUB_BITS) - 1);
+    return ((exponent - STATS_SUB_BITS + 1) << STATS_SUB_BITS) + sub;
+}
+
+/**
+ * @brief Gets the duration a bucket stands for (the middle of its range)
+ *
+ * @param[in] bucket the bucket index
+ * @return the duration in nanoseconds
+ */
+static long value_of(int bucket) {
+    if (bucket < (1 << STATS_SUB_BITS)) {
+        return bucket;
+    }
+    int exponent = (bucket >> STATS_SUB_BITS) + STATS_SUB_BITS - 1;
+    long sub = bucket & ((1 << STATS_SUB_BITS) - 1);
+    int shift = exponent - STATS_SUB_BITS;
+    long lower = ((1L << STATS_SUB_BITS) + sub) << shift;
+    return lower + ((1L << shift) >> 1);
+}
+
+/*
+ * Gets the current time
+ */
+long stats_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/*
+ * Draws the number of operations until the next sample
+ */
+int stats_sample_interval(int rate) {
+    // xorshift32, seeded from the address of the thread local state
+    unsigned int x = sample_state;
+    if (x == 0) {
+        x = (unsigned int) (unsigned long) &sample_state | 1;
+    }
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sample_state = x;
+    return 1 + x % (2 * rate - 1);
+}
+
+/*
+ * Records a duration in the histogram of the calling thread
+ */
+void stats_record(StatsKind kind, long duration) {
+    stats_record_sampled(kind, duration, 1);
+}
+
+/*
+ * Records a sampled duration in the histogram of the calling thread
+ */
+void stats_record_sampled(StatsKind kind, long duration, int weight) {
+    StatsThread *histograms = local_histograms();
+
+    atomic_long *bucket = &histograms->buckets[kind][bucket_of(duration)];
+    atomic_store_explicit(bucket,
+            atomic_load_explicit(bucket, memory_order_relaxed) + weight,
+            memory_order_relaxed);
+    atomic_store_explicit(&histograms->sum[kind],
+            atomic_load_explicit(&histograms->sum[kind], memory_order_relaxed)
+                    + duration * weight, memory_order_relaxed);
+}
+
+/*
+ * Counts an event for the calling thread
+ */
+void stats_count_event(StatsCounter counter) {
+    atomic_long *count = &local_histograms()->counters[counter];
+    atomic_store_explicit(count,
+            atomic_load_explicit(count, memory_order_relaxed) + 1,
+            memory_order_relaxed);
+}
+
+/*
+ * Labels the histograms of the calling thread
+ */
+void stats_set_label(int label) {
+    StatsThread *histograms = local_histograms();
+
+    pthread_mutex_lock(&threads_mtx);
+    histograms->label = label;
+    pthread_mutex_unlock(&threads_mtx);
+}
+
+/*
+ * Sums up the histograms of all threads with a label
+ */
+void stats_snapshot(StatsSnapshot *snapshot, int label) {
+    memset(snapshot, 0, sizeof(StatsSnapshot));
+
+    pthread_mutex_lock(&threads_mtx);
+    for (StatsThread *t = threads; t != NULL; t = t->next) {
+        if (label != STATS_ALL_LABELS && t->label != label) {
+            continue;
+        }
+        for (int k = 0; k < STATS_KINDS; k++) {
+            for (int b = 0; b < STATS_BUCKETS; b++) {
+                snapshot->buckets[k][b] += atomic_load_explicit(
+                        &t->buckets[k][b], memory_order_relaxed);
+            }
+            snapshot->sum[k] += atomic_load_explicit(&t->sum[k],
+                    memory_order_relaxed);
+        }
+        for (int c = 0; c < STATS_COUNTERS; c++) {
+            snapshot->counters[c] += atomic_load_explicit(&t->counters[c],
+                    memory_order_relaxed);
+        }
+    }
+    pthread_mutex_unlock(&threads_mtx);
+}
+
+/*
+ * Subtracts an earlier snapshot, leaving what was recorded in between
+ */
+void stats_subtract(StatsSnapshot *snapshot, const StatsSnapshot *earlier) {
+    for (int k = 0; k < STATS_KINDS; k++) {
+        for (int b = 0; b < STATS_BUCKETS; b++) {
+            snapshot->buckets[k][b] -= earlier->buckets[k][b];
+        }
+        snapshot->sum[k] -= earlier->sum[k];
+    }
+    for (int c = 0; c < STATS_COUNTERS; c++) {
+        snapshot->counters[c] -= earlier->counters[c];
+    }
+}
+
+/*
+ * Gets the number of recorded durations
+ */
+long stats_count(const StatsSnapshot *snapshot, StatsKind kind) {
+    long count = 0;
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+        count += snapshot->buckets[kind][b];
+    }
+    return count;
+}
+
+/*
+ * Gets a percentile of the recorded durations
+ */
+long stats_percentile(const StatsSnapshot *snapshot, StatsKind kind,
+        double percentile) {
+    long count = stats_count(snapshot, kind);
+    if (count == 0) {
+        return 0;
+    }
+
+    // rank of the requested duration, 1 based
+    long rank = (long) (count * percentile / 100.0 + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    long seen = 0;
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+        seen += snapshot->buckets[kind][b];
+        if (seen >= rank) {
+            return value_of(b);
+        }
+    }
+    return value_of(STATS_BUCKETS - 1);
+}
+
+/*
+ * Prints a report of the gym monitor
+ */
+void stats_print(FILE *file, const StatsSnapshot *snapshot) {
+    static const char *names[STATS_KINDS] = { "in gym_get_weights",
+            "holding monitor", "waiting for monitor" };
+    long acquisitions = stats_count(snapshot, STATS_GYM_WAIT);
+
+    fprintf(file, "acquisitions: %ld\n", acquisitions);
+    for (int k = 0; k < STATS_KINDS; k++) {
+        long count = stats_count(snapshot, k);
+        fprintf(file, "%-20s n=%ld mean=%.2fus p50=%.2fus p99=%.2fus "
+                "max=%.2fus\n", names[k], count,
+                count > 0 ? snapshot->sum[k] / 1000.0 / count : 0.0,
+                stats_percentile(snapshot, k, 50) / 1000.0,
+                stats_percentile(snapshot, k, 99) / 1000.0,
+                stats_percentile(snapshot, k, 100) / 1000.0);
+    }
+    double per = acquisitions > 0 ? 1.0 / acquisitions : 0.0;
+    fprintf(file, "wakeups: %ld (%.3f per acquisition), spurious: %ld "
+            "(%.3f per acquisition), failed CAS: %ld (%.3f per "
+            "acquisition)\n", snapshot->counters[STATS_GYM_WAKEUPS],
+            snapshot->counters[STATS_GYM_WAKEUPS] * per,
+            snapshot->counters[STATS_GYM_SPURIOUS],
+            snapshot->counters[STATS_GYM_SPURIOUS] * per,
+            snapshot->counters[STATS_GYM_CAS_FAILURES],
+            snapshot->counters[STATS_GYM_CAS_FAILURES] * per);
+
+    long hits = snapshot->counters[STATS_GYM_KIT_HITS];
+    long lookups = hits + snapshot->counters[STATS_GYM_KIT_MISSES];
+    if (lookups > 0) {
+        fprintf(file, "kit cache: %ld hits (%.1f%%), %ld misses, %ld kits "
+                "broken\n", hits, 100.0 * hits / lookups, lookups - hits,
+                snapshot->counters[STATS_GYM_KITS_BROKEN]);
+    }
+}
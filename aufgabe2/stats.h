@@ -0,0 +1,255 @@
+/** ****************************************************************
+ * @file    aufgabe2/stats.h
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    09.12.2016
+ * @brief   Header for the Statistics module
+ *
+ * Collects latency histograms for the gym. Every thread records into its own
+ * histogram, so recording never contends; stats_snapshot sums them up, either
+ * for all threads or for the threads with a given label (the philosopher id).
+ * Buckets are log-linear (16 per power of two), so percentiles are accurate
+ * to about 6%.
+ *
+ * Besides durations, every thread counts events (wakeups of waiters and
+ * what they were good for). Counters are kept the same way, no shared atomics
+ * on the hot path.
+ *
+ * The gym engines only record if they are compiled with -DGYM_STATS, the
+ * normal build does not pay for it (see "make GYM_STATS=1").
+ ******************************************************************
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdio.h>
+
+/**
+ * @brief Number of linear sub-buckets per power of two (must be 2^STATS_SUB_BITS)
+ */
+#define STATS_SUB_BITS 4
+
+/**
+ * @brief Number of buckets of a histogram
+ */
+#define STATS_BUCKETS (64 << STATS_SUB_BITS)
+
+/**
+ * @brief Label that selects all threads in stats_snapshot
+ */
+#define STATS_ALL_LABELS -1
+
+/**
+ * @brief What a recorded duration measures
+ */
+typedef enum {
+    STATS_GYM_WAIT, //!< time spent in gym_get_weights
+    STATS_GYM_HOLD, //!< time the gym monitor was held
+    STATS_GYM_LOCK, //!< time spent waiting for the gym monitor
+    STATS_KINDS     //!< number of kinds
+} StatsKind;
+
+/**
+ * @brief What a counter counts
+ */
+typedef enum {
+    STATS_GYM_WAKEUPS,      //!< waiters woken up
+    STATS_GYM_SPURIOUS,     //!< wakeups after which the total was not possible
+    STATS_GYM_CAS_FAILURES, //!< failed compare-and-swaps (lock-free gym)
+    STATS_GYM_KIT_HITS,     //!< requests served with a cached kit
+    STATS_GYM_KIT_MISSES,   //!< requests served by the solver
+    STATS_GYM_KITS_BROKEN,  //!< kits broken up to serve another total
+    STATS_COUNTERS          //!< number of counters
+} StatsCounter;
+
+/**
+ * @brief Sum of the histograms of all threads at one point in time
+ */
+typedef struct {
+    long buckets[STATS_KINDS][STATS_BUCKETS]; //!< counts per bucket
+    long sum[STATS_KINDS];                    //!< sum of all durations in ns
+    long counters[STATS_COUNTERS];            //!< sum of all counters
+} StatsSnapshot;
+
+/**
+ * @brief Only one in STATS_SAMPLE operations of a thread is timed (picked at
+ *        random)
+ *
+ * Reading the clock costs about as much as a whole uncontended gym
+ * operation, so timing every operation can more than halve the throughput.
+ * Sampled durations are recorded STATS_SAMPLE times, so counts and sums
+ * stay estimates of the totals. Counters are always exact.
+ */
+#ifndef STATS_SAMPLE
+#define STATS_SAMPLE 1
+#endif
+
+#ifdef GYM_STATS
+/**
+ * @brief Gets the start time of an operation, 0 if the operation is not
+ *        sampled (always 0 without GYM_STATS)
+ */
+#define STATS_START() stats_start()
+
+/**
+ * @brief Gets the current time, if the operation that started at start is
+ *        sampled (0 otherwise and without GYM_STATS)
+ */
+#define STATS_NOW(start) ((start) != 0 ? stats_now() : 0)
+
+/**
+ * @brief Records the time between start and end, if the operation is
+ *        sampled (nothing without GYM_STATS)
+ */
+#define STATS_RECORD_SPAN(kind, start, end) do { \
+        if ((start) != 0) { \
+            stats_record_sampled((kind), (end) - (start), STATS_SAMPLE); \
+        } \
+    } while (0)
+
+/**
+ * @brief Records the time elapsed since start, if the operation is sampled
+ *        (nothing without GYM_STATS)
+ */
+#define STATS_RECORD(kind, start) \
+    STATS_RECORD_SPAN((kind), (start), STATS_NOW(start))
+
+/**
+ * @brief Counts an event (nothing without GYM_STATS)
+ */
+#define STATS_COUNT(counter) stats_count_event(counter)
+
+/**
+ * @brief Labels the histograms of the calling thread (nothing without
+ *        GYM_STATS)
+ */
+#define STATS_LABEL(label) stats_set_label(label)
+#else
+#define STATS_START() 0
+#define STATS_NOW(start) ((void) (start), 0)
+#define STATS_RECORD_SPAN(kind, start, end) ((void) (start), (void) (end))
+#define STATS_RECORD(kind, start) ((void) (start))
+#define STATS_COUNT(counter) ((void) 0)
+#define STATS_LABEL(label) ((void) (label))
+#endif
+
+/**
+ * @brief Gets the current time
+ *
+ * @return the CLOCK_MONOTONIC time in nanoseconds
+ */
+long stats_now();
+
+/**
+ * @brief Operations of the calling thread until the next one is timed
+ */
+extern __thread int stats_sample_countdown;
+
+/**
+ * @brief Draws the number of operations until the next sample
+ *
+ * @param[in] rate the mean number of operations between samples
+ * @return a random number between 1 and 2 * rate - 1
+ */
+int stats_sample_interval(int rate);
+
+/**
+ * @brief Gets the start time of an operation, if it is sampled
+ *
+ * Operations that are not sampled only decrement a counter. The distance
+ * between samples is random instead of always STATS_SAMPLE, so a thread that
+ * alternates between getting and returning weights gets both sampled.
+ *
+ * @return the CLOCK_MONOTONIC time in nanoseconds, 0 if not sampled
+ */
+static inline long stats_start() {
+    if (STATS_SAMPLE > 1) {
+        if (--stats_sample_countdown > 0) {
+            return 0;
+        }
+        stats_sample_countdown = stats_sample_interval(STATS_SAMPLE);
+    }
+    return stats_now();
+}
+
+/**
+ * @brief Records a duration in the histogram of the calling thread
+ *
+ * @param[in] kind     what the duration measures
+ * @param[in] duration the duration in nanoseconds
+ */
+void stats_record(StatsKind kind, long duration);
+
+/**
+ * @brief Records a sampled duration in the histogram of the calling thread
+ *
+ * @param[in] kind     what the duration measures
+ * @param[in] duration the duration in nanoseconds
+ * @param[in] weight   how many durations the sample stands for
+ */
+void stats_record_sampled(StatsKind kind, long duration, int weight);
+
+/**
+ * @brief Counts an event for the calling thread
+ *
+ * @param[in] counter what happened
+ */
+void stats_count_event(StatsCounter counter);
+
+/**
+ * @brief Labels the histograms of the calling thread
+ *
+ * @param[in] label the label, e.g. the philosopher id (>= 0)
+ */
+void stats_set_label(int label);
+
+/**
+ * @brief Sums up the histograms of all threads with a label
+ *
+ * Can be called while other threads are recording.
+ *
+ * @param[out] snapshot will contain the sums
+ * @param[in]  label    the label of the threads, STATS_ALL_LABELS for all
+ */
+void stats_snapshot(StatsSnapshot *snapshot, int label);
+
+/**
+ * @brief Subtracts an earlier snapshot, leaving what was recorded in between
+ *
+ * @param[in,out] snapshot the later snapshot, will contain the difference
+ * @param[in]     earlier  the earlier snapshot
+ */
+void stats_subtract(StatsSnapshot *snapshot, const StatsSnapshot *earlier);
+
+/**
+ * @brief Gets the number of recorded durations
+ *
+ * @param[in] snapshot the snapshot to evaluate
+ * @param[in] kind     which durations to count
+ * @return the number of durations
+ */
+long stats_count(const StatsSnapshot *snapshot, StatsKind kind);
+
+/**
+ * @brief Gets a percentile of the recorded durations
+ *
+ * @param[in] snapshot   the snapshot to evaluate
+ * @param[in] kind       which durations to evaluate
+ * @param[in] percentile the percentile (0 - 100)
+ * @return the duration in nanoseconds, 0 if nothing was recorded
+ */
+long stats_percentile(const StatsSnapshot *snapshot, StatsKind kind,
+        double percentile);
+
+/**
+ * @brief Prints a report of the gym monitor: acquisitions, time waiting for
+ *        and holding the monitor and wakeups per acquisition
+ *
+ * @param[in] file     where to print
+ * @param[in] snapshot the snapshot to evaluate
+ */
+void stats_print(FILE *file, const StatsSnapshot *snapshot);
+
+#endif /* STATS_H_ */
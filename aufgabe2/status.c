@@ -0,0 +1,391 @@
+/** ****************************************************************
+ * @file    aufgabe2/status.c
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    07.12.2016
+ * @brief   Implementation of the Status display module
+ ******************************************************************
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "status.h"
+#include "errors.h"
+#include "gym.h"
+#include "seqlock.h"
+
+/* ****************************************************************************
+ * static type definitions
+ *************************************************************************** */
+
+/**
+ * @brief The latest values pushed for a philosopher
+ *
+ * Every push overwrites the previous value, so producers never wait for the
+ * renderer. Weights of one philosopher are only changed by one thread at a
+ * time (its own thread or the one holding the gym monitor).
+ */
+typedef struct {
+    atomic_char command; //!< display character of the command
+    atomic_char state;   //!< display character of the state
+    SeqLock lock;        //!< guards weights
+    int *weights;        //!< the weights held by the philosopher
+} StatusPhilo;
+
+/**
+ * @brief What the renderer knows about a philosopher
+ */
+typedef struct {
+    char command;
+    char state;
+    int *weights;
+} PhiloModel;
+
+/* ****************************************************************************
+ * global variables
+ *************************************************************************** */
+
+/**
+ * @brief The latest values of all philosophers
+ */
+static StatusPhilo *published_philos;
+
+/**
+ * @brief The gym weights of the latest push that had them
+ */
+static int *published_gym;
+
+/**
+ * @brief Guards published_gym together with all published weights
+ *
+ * Pushes with gym weights come from the gym monitor, so they are serialized
+ * and the weights of all philosophers add up with the gym weights whenever
+ * the sequence is even.
+ */
+static SeqLock published_lock;
+
+/**
+ * @brief Set once a push had gym weights
+ */
+static atomic_bool published_gym_valid;
+
+/**
+ * @brief The renderer thread
+ */
+static pthread_t renderer;
+
+/**
+ * @brief Set to false to stop the renderer
+ */
+static atomic_bool running;
+
+/**
+ * @brief Number of philosophers
+ */
+static int model_count;
+
+/**
+ * @brief Training weight of every philosopher
+ */
+static const int *model_training_weights;
+
+/**
+ * @brief Renderer model of all philosophers
+ */
+static PhiloModel *model_philos;
+
+/**
+ * @brief Renderer model of the gym
+ */
+static int *model_gym;
+
+/**
+ * @brief What the renderer printed last, to detect changes
+ */
+static PhiloModel *shown_philos;
+
+/**
+ * @brief Gym weights the renderer printed last
+ */
+static int *shown_gym;
+
+/* ****************************************************************************
+ * static functions
+ *************************************************************************** */
+
+/**
+ * @brief Copies the weights of a philosopher into the model (renderer only)
+ *
+ * The only writer of the philosopher is never blocked, so this does not have
+ * to give up.
+ *
+ * @param[in] philo_id the ID of the philosopher
+ */
+static void copy_philo(int philo_id) {
+    StatusPhilo *philo = &published_philos[philo_id];
+    PhiloModel *model = &model_philos[philo_id];
+
+    model->command = atomic_load_explicit(&philo->command,
+            memory_order_relaxed);
+    model->state = atomic_load_explicit(&philo->state, memory_order_relaxed);
+    unsigned sequence;
+    do {
+        sequence = seqlock_read_begin(&philo->lock);
+        seqlock_copy(model->weights, philo->weights, gym_weight_classes);
+    } while (!seqlock_read_valid(&philo->lock, sequence));
+}
+
+/**
+ * @brief Copies the latest values into the model (renderer only)
+ *
+ * @return true if the weights of all philosophers and the gym weights are
+ *         from the same point in time
+ */
+static bool take_snapshot() {
+    for (int attempt = 0; attempt < GYM_SNAPSHOT_ATTEMPTS; attempt++) {
+        if (attempt > 0) {
+            // let the gym monitor finish, it may be on this CPU
+            sched_yield();
+        }
+        unsigned sequence = seqlock_read_begin(&published_lock);
+        for (int i = 0; i < model_count; i++) {
+            copy_philo(i);
+        }
+        seqlock_copy(model_gym, published_gym, gym_weight_classes);
+        if (seqlock_read_valid(&published_lock, sequence)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Completes the gym model and checks it for sync errors
+ *
+ * @param[in] consistent whether the snapshot is from one point in time
+ */
+static void check_snapshot(bool consistent) {
+    bool gym_valid = atomic_load(&published_gym_valid);
+
+    for (int w = 0; w < gym_weight_classes; w++) {
+        int held = 0;
+        for (int i = 0; i < model_count; i++) {
+            held += model_philos[i].weights[w];
+        }
+
+        if (!gym_valid) {
+            // gym only knows its own part - derive it from what is held
+            model_gym[w] = gym_weights_availiable[w] - held;
+        } else if (consistent) {
+            // check validity - the snapshot is one state of the monitor
+            FATAL_ERROR_HANDLING(
+                    held + model_gym[w] != gym_weights_availiable[w],
+                    "Synchronization error!")
+        }
+    }
+}
+
+/**
+ * @brief Checks whether the model differs from what was printed last, and
+ *        remembers it as printed
+ *
+ * @return true if something changed
+ */
+static bool model_changed() {
+    bool changed = memcmp(shown_gym, model_gym,
+            sizeof(int) * gym_weight_classes) != 0;
+    memcpy(shown_gym, model_gym, sizeof(int) * gym_weight_classes);
+
+    for (int i = 0; i < model_count; i++) {
+        PhiloModel *model = &model_philos[i];
+        PhiloModel *shown = &shown_philos[i];
+        changed |= shown->command != model->command
+                || shown->state != model->state
+                || memcmp(shown->weights, model->weights,
+                        sizeof(int) * gym_weight_classes) != 0;
+        shown->command = model->command;
+        shown->state = model->state;
+        memcpy(shown->weights, model->weights,
+                sizeof(int) * gym_weight_classes);
+    }
+    return changed;
+}
+
+/**
+ * @brief Prints the model on the screen
+ */
+static void render() {
+    for (int i = 0; i < model_count; i++) {
+        printf("%d(%d)%c:%c:[", i, model_training_weights[i],
+                model_philos[i].command, model_philos[i].state);
+        for (int w = 0; w < gym_weight_classes; w++) {
+            printf(w == 0 ? "%d" : ", %d", model_philos[i].weights[w]);
+        }
+        printf("] ");
+    }
+
+    printf("Gym: [");
+    for (int w = 0; w < gym_weight_classes; w++) {
+        printf(w == 0 ? "%d" : ", %d", model_gym[w]);
+    }
+    printf("]\n");
+    fflush(stdout);
+}
+
+/**
+ * @brief Loop for the renderer thread
+ *
+ * @param arg unused
+ */
+static void* render_loop(void *arg) {
+    const struct timespec interval = { STATUS_INTERVAL_MS / 1000,
+            (STATUS_INTERVAL_MS % 1000) * 1000000L };
+    bool stop = false;
+
+    while (!stop) {
+        // read the flag first, so the last round sees every pushed value
+        stop = !atomic_load(&running);
+
+        check_snapshot(take_snapshot());
+        if (model_changed()) {
+            render();
+        }
+        if (!stop) {
+            nanosleep(&interval, NULL);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Allocates a model of all philosophers with their weights
+ *
+ * @return the model, NULL if out of memory
+ */
+static PhiloModel* alloc_model() {
+    PhiloModel *model = calloc(model_count, sizeof(PhiloModel));
+    int *weights = calloc((size_t) model_count * gym_weight_classes,
+            sizeof(int));
+    if (model == NULL || weights == NULL) {
+        free(model);
+        free(weights);
+        return NULL;
+    }
+
+    for (int i = 0; i < model_count; i++) {
+        model[i].command = '?';
+        model[i].state = '?';
+        model[i].weights = weights + i * gym_weight_classes;
+    }
+    return model;
+}
+
+/* ****************************************************************************
+ * function declarations
+ *************************************************************************** */
+
+/*
+ * Starts the renderer thread
+ */
+void status_init(int philo_count, const int training_weights[]) {
+    model_count = philo_count;
+    model_training_weights = training_weights;
+    model_philos = alloc_model();
+    shown_philos = alloc_model();
+    model_gym = malloc(sizeof(int) * gym_weight_classes);
+    shown_gym = malloc(sizeof(int) * gym_weight_classes);
+    published_philos = calloc(philo_count, sizeof(StatusPhilo));
+    int *published_weights = calloc((size_t) philo_count * gym_weight_classes,
+            sizeof(int));
+    published_gym = malloc(sizeof(int) * gym_weight_classes);
+    FATAL_ERROR_HANDLING(
+            model_philos == NULL || shown_philos == NULL || model_gym == NULL
+                    || shown_gym == NULL || published_philos == NULL
+                    || published_weights == NULL || published_gym == NULL,
+            "[status_init] Failed to allocate model")
+
+    for (int i = 0; i < philo_count; i++) {
+        atomic_init(&published_philos[i].command, '?');
+        atomic_init(&published_philos[i].state, '?');
+        seqlock_init(&published_philos[i].lock);
+        published_philos[i].weights = published_weights
+                + i * gym_weight_classes;
+    }
+    for (int i = 0; i < gym_weight_classes; i++) {
+        published_gym[i] = gym_weights_availiable[i];
+        shown_gym[i] = gym_weights_availiable[i];
+    }
+    seqlock_init(&published_lock);
+    atomic_init(&published_gym_valid, false);
+
+    atomic_init(&running, true);
+    int res = pthread_create(&renderer, NULL, render_loop, NULL);
+    FATAL_ERROR_HANDLING(res, "[status_init] Failed to create renderer thread")
+}
+
+/*
+ * Stops the renderer thread after it displayed the latest values
+ */
+void status_quit() {
+    atomic_store(&running, false);
+    pthread_join(renderer, NULL);
+    free(model_philos[0].weights);
+    free(model_philos);
+    free(shown_philos[0].weights);
+    free(shown_philos);
+    free(model_gym);
+    free(shown_gym);
+    free(published_philos[0].weights);
+    free(published_philos);
+    free(published_gym);
+    model_philos = NULL;
+}
+
+/*
+ * Reports a new state of a philosopher
+ */
+void status_push_state(int philo_id, char state) {
+    atomic_store_explicit(&published_philos[philo_id].state, state,
+            memory_order_relaxed);
+}
+
+/*
+ * Reports a new command for a philosopher
+ */
+void status_push_command(int philo_id, char command) {
+    atomic_store_explicit(&published_philos[philo_id].command, command,
+            memory_order_relaxed);
+}
+
+/*
+ * Reports a change of the weights held by a philosopher
+ */
+void status_push_weights(int philo_id, const int weights[],
+        const int gym_weights[]) {
+    StatusPhilo *philo = &published_philos[philo_id];
+
+    if (gym_weights != NULL) {
+        seqlock_write_begin(&published_lock);
+    }
+    seqlock_write_begin(&philo->lock);
+    for (int i = 0; i < gym_weight_classes; i++) {
+        __atomic_store_n(&philo->weights[i], weights[i], __ATOMIC_RELAXED);
+    }
+    seqlock_write_end(&philo->lock);
+    if (gym_weights != NULL) {
+        for (int i = 0; i < gym_weight_classes; i++) {
+            __atomic_store_n(&published_gym[i], gym_weights[i],
+                    __ATOMIC_RELAXED);
+        }
+        atomic_store_explicit(&published_gym_valid, true, memory_order_relaxed);
+        seqlock_write_end(&published_lock);
+    }
+}
@@ -0,0 +1,67 @@
+/** ****************************************************************
+ * @file    aufgabe2/status.h
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    07.12.2016
+ * @brief   Header for the Status display module
+ *
+ * Every push overwrites the latest value of a philosopher, so pushing never
+ * waits (it is done while holding the gym monitor). A renderer thread copies
+ * the latest values at a fixed rate, checks them for synchronization errors
+ * and prints them if something changed. Nothing is printed on the hot path.
+ ******************************************************************
+ */
+
+#ifndef STATUS_H_
+#define STATUS_H_
+
+#include <stdbool.h>
+
+/**
+ * @brief Time between two status outputs in milliseconds
+ */
+#define STATUS_INTERVAL_MS 100
+
+/**
+ * @brief Starts the renderer thread
+ *
+ * @param[in] philo_count      how many philosophers there are
+ * @param[in] training_weights the training weight of every philosopher
+ */
+void status_init(int philo_count, const int training_weights[]);
+
+/**
+ * @brief Stops the renderer thread after it displayed the latest values
+ */
+void status_quit();
+
+/**
+ * @brief Reports a new state of a philosopher
+ *
+ * @param[in] philo_id the ID of the philosopher
+ * @param[in] state    display character for the new state
+ */
+void status_push_state(int philo_id, char state);
+
+/**
+ * @brief Reports a new command for a philosopher
+ *
+ * @param[in] philo_id the ID of the philosopher
+ * @param[in] command  display character for the new command
+ */
+void status_push_command(int philo_id, char command);
+
+/**
+ * @brief Reports a change of the weights held by a philosopher
+ *
+ * @param[in] philo_id    the ID of the philosopher
+ * @param[in] weights     the weights the philosopher holds now
+ * @param[in] gym_weights the weights in the gym after the change or NULL if
+ *                        the caller can not provide a consistent snapshot
+ *                        (disables the synchronization check)
+ */
+void status_push_weights(int philo_id, const int weights[],
+        const int gym_weights[]);
+
+#endif /* STATUS_H_ */
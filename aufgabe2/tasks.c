@@ -0,0 +1,734 @@
+/** ****************************************************************
+ * @file    aufgabe2/tasks.c
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    12.12.2016
+ * @brief   Implementation for the Tasks module
+ ******************************************************************
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "tasks.h"
+#include "errors.h"
+
+/**
+ * @brief Size of a cache line, workers get lines of their own
+ */
+#define TASKS_CACHE_LINE 64
+
+/**
+ * @brief Lifecycle of a task
+ *
+ * Parking is done in two steps: the task marks itself PARKING and switches to
+ * its worker, which marks it PARKED once its context is saved. An unpark that
+ * comes in between turns it into NOTIFIED instead, and the worker requeues it.
+ */
+typedef enum {
+    TASK_RUNNING,  //!< runnable or running
+    TASK_NOTIFIED, //!< runnable or running, next park returns right away
+    TASK_PARKING,  //!< about to switch to its worker to park
+    TASK_PARKED,   //!< parked, needs tasks_unpark
+    TASK_DONE      //!< function returned
+} TaskState;
+
+/**
+ * @brief A user level task
+ */
+struct Task {
+    ucontext_t context;       //!< saved registers and stack while not running
+    void (*function)(void*);  //!< what the task runs
+    void *arg;                //!< argument for function
+    atomic_int state;         //!< the TaskState
+    struct Task *next;        //!< next task in a run queue
+    struct Task *all_next;    //!< next task in the list of all tasks
+};
+
+/**
+ * @brief A worker thread with its run queue
+ */
+typedef struct {
+    _Alignas(TASKS_CACHE_LINE)
+    pthread_mutex_t mtx;      //!< guards the run queue
+    Task *head;               //!< next task to run
+    Task *tail;               //!< last task to run
+    Task *current;            //!< the task running right now, NULL if none
+    ucontext_t context;       //!< context of the scheduling loop
+    pthread_t id;             //!< the thread
+} Worker;
+
+/**
+ * @brief A task parked with a deadline
+ */
+typedef struct {
+    struct timespec deadline; //!< when to unpark the task
+    Task *task;               //!< the task
+} TaskTimer;
+
+/**
+ * @brief The workers
+ */
+static Worker *workers = NULL;
+
+/**
+ * @brief Number of workers
+ */
+static int worker_count = 0;
+
+/**
+ * @brief The worker the calling thread is, NULL if it is none
+ *
+ * Only accessed through this_worker().
+ */
+static __thread Worker *self = NULL;
+
+/**
+ * @brief All tasks, freed by tasks_wait
+ */
+static Task *all_tasks = NULL;
+
+/**
+ * @brief Mutex guarding all_tasks and the stack chunks
+ */
+static pthread_mutex_t all_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Chunks of task stacks
+ */
+static char **chunks = NULL;
+
+/**
+ * @brief Number of chunks
+ */
+static int chunk_count = 0;
+
+/**
+ * @brief Number of stacks handed out from the last chunk
+ */
+static int chunk_used = TASKS_STACKS_PER_CHUNK;
+
+/**
+ * @brief Round robin counter to distribute tasks from outside the pool
+ */
+static atomic_uint next_worker;
+
+/**
+ * @brief Number of tasks in all run queues
+ */
+static atomic_int runnable;
+
+/**
+ * @brief Number of tasks that have not ended yet
+ */
+static atomic_int live;
+
+/**
+ * @brief Futex word idle workers sleep on, changed whenever work is queued
+ */
+static atomic_uint work_seq;
+
+/**
+ * @brief Number of workers sleeping on work_seq
+ */
+static atomic_int sleepers;
+
+/**
+ * @brief Set by tasks_wait to stop the workers and the timer thread
+ */
+static atomic_bool stopping;
+
+/**
+ * @brief Mutex for live reaching 0
+ */
+static pthread_mutex_t done_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Signaled when live reaches 0
+ */
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * @brief Min heap of timers, earliest deadline first
+ */
+static TaskTimer *timers = NULL;
+
+/**
+ * @brief Number of timers in the heap
+ */
+static int timer_count = 0;
+
+/**
+ * @brief Capacity of the heap
+ */
+static int timer_capacity = 0;
+
+/**
+ * @brief Mutex guarding the timers
+ */
+static pthread_mutex_t timer_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Signaled when there is a new earliest timer or the pool stops
+ */
+static pthread_cond_t timer_cond;
+
+/**
+ * @brief The timer thread
+ */
+static pthread_t timer_thread;
+
+/**
+ * @brief Gets the worker the calling thread is
+ *
+ * Not inlined: a task may continue on another thread after a park, so the
+ * address of the thread local variable must not be cached by the compiler.
+ *
+ * @return the worker, NULL if the caller is no worker thread
+ */
+static __attribute__((noinline)) Worker* this_worker() {
+    return self;
+}
+
+/**
+ * @brief Compares two CLOCK_MONOTONIC times
+ *
+ * @return true if a is before b
+ */
+static bool before(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec
+            || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/**
+ * @brief Allocates a task stack
+ *
+ * @return the lowest address of the stack
+ */
+static char* allocate_stack() {
+    pthread_mutex_lock(&all_mtx);
+    if (chunk_used == TASKS_STACKS_PER_CHUNK) {
+        chunks = realloc(chunks, sizeof(char*) * (chunk_count + 1));
+        FATAL_ERROR_HANDLING(chunks == NULL,
+                "[tasks_spawn] Failed to allocate chunks")
+        char *chunk = mmap(NULL,
+                (size_t) TASKS_STACK_SIZE * TASKS_STACKS_PER_CHUNK,
+                PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        FATAL_ERROR_HANDLING(chunk == MAP_FAILED,
+                "[tasks_spawn] Failed to allocate stacks")
+        chunks[chunk_count++] = chunk;
+        chunk_used = 0;
+    }
+    char *stack = chunks[chunk_count - 1]
+            + (size_t) TASKS_STACK_SIZE * chunk_used++;
+    pthread_mutex_unlock(&all_mtx);
+    return stack;
+}
+
+/**
+ * @brief Wakes up one idle worker, if there is one
+ */
+static void notify_work() {
+    atomic_fetch_add(&work_seq, 1);
+    if (atomic_load(&sleepers) > 0) {
+        syscall(SYS_futex, &work_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+/**
+ * @brief Appends a task to the run queue of a worker
+ *
+ * @param[in] worker the worker
+ * @param[in] task   the runnable task
+ */
+static void push_task(Worker *worker, Task *task) {
+    task->next = NULL;
+    pthread_mutex_lock(&worker->mtx);
+    if (worker->tail == NULL) {
+        worker->head = task;
+    } else {
+        worker->tail->next = task;
+    }
+    worker->tail = task;
+    pthread_mutex_unlock(&worker->mtx);
+
+    atomic_fetch_add(&runnable, 1);
+    notify_work();
+}
+
+/**
+ * @brief Makes a task runnable on the calling worker, or on any worker if
+ *        the caller is no worker
+ *
+ * @param[in] task the task
+ */
+static void schedule(Task *task) {
+    Worker *worker = this_worker();
+    if (worker == NULL) {
+        worker = &workers[atomic_fetch_add(&next_worker, 1) % worker_count];
+    }
+    push_task(worker, task);
+}
+
+/**
+ * @brief Takes the first task from the run queue of a worker
+ *
+ * @param[in] worker the worker
+ * @return the task, NULL if the queue is empty
+ */
+static Task* pop_task(Worker *worker) {
+    pthread_mutex_lock(&worker->mtx);
+    Task *task = worker->head;
+    if (task != NULL) {
+        worker->head = task->next;
+        if (worker->head == NULL) {
+            worker->tail = NULL;
+        }
+    }
+    pthread_mutex_unlock(&worker->mtx);
+
+    if (task != NULL) {
+        atomic_fetch_sub(&runnable, 1);
+    }
+    return task;
+}
+
+/**
+ * @brief Takes a task from the own run queue, or steals one from another
+ *        worker
+ *
+ * @param[in] worker the calling worker
+ * @return the task, NULL if all queues are empty
+ */
+static Task* find_task(Worker *worker) {
+    Task *task = pop_task(worker);
+    int index = worker - workers;
+    for (int i = 1; task == NULL && i < worker_count; i++) {
+        if (atomic_load(&runnable) == 0) {
+            break;
+        }
+        task = pop_task(&workers[(index + i) % worker_count]);
+    }
+    return task;
+}
+
+/**
+ * @brief Entry point of every task
+ */
+static void task_entry() {
+    Task *task = tasks_current();
+    task->function(task->arg);
+
+    // never resumed, the worker notices DONE
+    atomic_store(&task->state, TASK_DONE);
+    swapcontext(&task->context, &this_worker()->context);
+}
+
+/**
+ * @brief Handles a task that switched back to its worker
+ *
+ * @param[in] worker the worker
+ * @param[in] task   the task
+ */
+static void task_switched_out(Worker *worker, Task *task) {
+    int state = atomic_load(&task->state);
+    switch (state) {
+        case TASK_DONE:
+            if (atomic_fetch_sub(&live, 1) == 1) {
+                pthread_mutex_lock(&done_mtx);
+                pthread_cond_broadcast(&done_cond);
+                pthread_mutex_unlock(&done_mtx);
+            }
+            break;
+        case TASK_PARKING:
+            // its context is saved now, so it may be unparked
+            if (atomic_compare_exchange_strong(&task->state, &state,
+                    TASK_PARKED)) {
+                break;
+            }
+            // unparked while parking (state is NOTIFIED now)
+            atomic_store(&task->state, TASK_RUNNING);
+            push_task(worker, task);
+            break;
+        default:
+            // yielded
+            push_task(worker, task);
+            break;
+    }
+}
+
+/**
+ * @brief Sleeps until work is queued
+ *
+ * @param[in] seq value of work_seq before looking for work
+ */
+static void wait_for_work(unsigned int seq) {
+    atomic_fetch_add(&sleepers, 1);
+    if (atomic_load(&runnable) == 0 && !atomic_load(&stopping)) {
+        syscall(SYS_futex, &work_seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+    }
+    atomic_fetch_sub(&sleepers, 1);
+}
+
+/**
+ * @brief Scheduling loop of the worker threads
+ *
+ * @param arg the worker
+ */
+static void* worker_loop(void *arg) {
+    Worker *worker = arg;
+    self = worker;
+
+    while (true) {
+        unsigned int seq = atomic_load(&work_seq);
+        Task *task = find_task(worker);
+        if (task == NULL) {
+            if (atomic_load(&stopping)) {
+                break;
+            }
+            wait_for_work(seq);
+            continue;
+        }
+
+        worker->current = task;
+        swapcontext(&worker->context, &task->context);
+        worker->current = NULL;
+        task_switched_out(worker, task);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Adds a timer to the heap, timer_mtx must be held
+ *
+ * @param[in] timer the timer
+ * @return true if it is the earliest timer now
+ */
+static bool push_timer(TaskTimer timer) {
+    if (timer_count == timer_capacity) {
+        timer_capacity = timer_capacity == 0 ? 64 : timer_capacity * 2;
+        timers = realloc(timers, sizeof(TaskTimer) * timer_capacity);
+        FATAL_ERROR_HANDLING(timers == NULL,
+                "[tasks_park_until] Failed to allocate timers")
+    }
+
+    int pos = timer_count++;
+    while (pos > 0 && before(&timer.deadline,
+            &timers[(pos - 1) / 2].deadline)) {
+        timers[pos] = timers[(pos - 1) / 2];
+        pos = (pos - 1) / 2;
+    }
+    timers[pos] = timer;
+    return pos == 0;
+}
+
+/**
+ * @brief Removes the earliest timer from the heap, timer_mtx must be held
+ *
+ * @return the timer
+ */
+static TaskTimer pop_timer() {
+    TaskTimer first = timers[0];
+    TaskTimer last = timers[--timer_count];
+
+    int pos = 0;
+    while (true) {
+        int child = 2 * pos + 1;
+        if (child >= timer_count) {
+            break;
+        }
+        if (child + 1 < timer_count
+                && before(&timers[child + 1].deadline,
+                        &timers[child].deadline)) {
+            child++;
+        }
+        if (!before(&timers[child].deadline, &last.deadline)) {
+            break;
+        }
+        timers[pos] = timers[child];
+        pos = child;
+    }
+    timers[pos] = last;
+    return first;
+}
+
+/**
+ * @brief Loop of the timer thread, unparks tasks whose deadline has passed
+ *
+ * Timers are not removed when their task is unparked early, the late unpark
+ * is just a spurious wakeup.
+ */
+static void* timer_loop(void *arg) {
+    pthread_mutex_lock(&timer_mtx);
+    while (!atomic_load(&stopping)) {
+        if (timer_count == 0) {
+            pthread_cond_wait(&timer_cond, &timer_mtx);
+            continue;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (before(&now, &timers[0].deadline)) {
+            // copy it, the heap may be reallocated while we wait
+            struct timespec deadline = timers[0].deadline;
+            pthread_cond_timedwait(&timer_cond, &timer_mtx, &deadline);
+            continue;
+        }
+        tasks_unpark(pop_timer().task);
+    }
+    pthread_mutex_unlock(&timer_mtx);
+    return NULL;
+}
+
+/*
+ * Prepares the worker pool
+ */
+void tasks_init(int count) {
+    worker_count = count;
+    workers = aligned_alloc(TASKS_CACHE_LINE, sizeof(Worker) * count);
+    FATAL_ERROR_HANDLING(workers == NULL,
+            "[tasks_init] Failed to allocate workers")
+    memset(workers, 0, sizeof(Worker) * count);
+    for (int i = 0; i < count; i++) {
+        int res = pthread_mutex_init(&workers[i].mtx, NULL);
+        FATAL_ERROR_HANDLING(res, "[tasks_init] Failed to create mutex")
+    }
+
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    int res = pthread_cond_init(&timer_cond, &cond_attr);
+    FATAL_ERROR_HANDLING(res,
+            "[tasks_init] Failed to create condition variable")
+    pthread_condattr_destroy(&cond_attr);
+
+    atomic_store(&stopping, false);
+}
+
+/*
+ * Creates a task
+ */
+Task* tasks_spawn(void (*function)(void*), void *arg) {
+    Task *task = calloc(1, sizeof(Task));
+    FATAL_ERROR_HANDLING(task == NULL, "[tasks_spawn] Failed to allocate task")
+    task->function = function;
+    task->arg = arg;
+    atomic_store(&task->state, TASK_RUNNING);
+
+    getcontext(&task->context);
+    task->context.uc_stack.ss_sp = allocate_stack();
+    task->context.uc_stack.ss_size = TASKS_STACK_SIZE;
+    task->context.uc_link = NULL;
+    makecontext(&task->context, task_entry, 0);
+
+    pthread_mutex_lock(&all_mtx);
+    task->all_next = all_tasks;
+    all_tasks = task;
+    pthread_mutex_unlock(&all_mtx);
+
+    atomic_fetch_add(&live, 1);
+    schedule(task);
+    return task;
+}
+
+/*
+ * Starts the worker threads
+ */
+void tasks_start() {
+    for (int i = 0; i < worker_count; i++) {
+        int res = pthread_create(&workers[i].id, NULL, worker_loop,
+                &workers[i]);
+        FATAL_ERROR_HANDLING(res, "[tasks_start] Failed to create worker")
+    }
+    int res = pthread_create(&timer_thread, NULL, timer_loop, NULL);
+    FATAL_ERROR_HANDLING(res, "[tasks_start] Failed to create timer thread")
+}
+
+/*
+ * Waits until all tasks have ended, then stops the worker pool
+ */
+void tasks_wait() {
+    pthread_mutex_lock(&done_mtx);
+    while (atomic_load(&live) > 0) {
+        pthread_cond_wait(&done_cond, &done_mtx);
+    }
+    pthread_mutex_unlock(&done_mtx);
+
+    // stop workers and timer thread
+    atomic_store(&stopping, true);
+    atomic_fetch_add(&work_seq, 1);
+    syscall(SYS_futex, &work_seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    pthread_mutex_lock(&timer_mtx);
+    pthread_cond_signal(&timer_cond);
+    pthread_mutex_unlock(&timer_mtx);
+
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i].id, NULL);
+        pthread_mutex_destroy(&workers[i].mtx);
+    }
+    pthread_join(timer_thread, NULL);
+    pthread_cond_destroy(&timer_cond);
+
+    // cleanup
+    while (all_tasks != NULL) {
+        Task *task = all_tasks;
+        all_tasks = task->all_next;
+        free(task);
+    }
+    for (int i = 0; i < chunk_count; i++) {
+        munmap(chunks[i], (size_t) TASKS_STACK_SIZE * TASKS_STACKS_PER_CHUNK);
+    }
+    free(chunks);
+    free(timers);
+    free(workers);
+    chunks = NULL;
+    chunk_count = 0;
+    chunk_used = TASKS_STACKS_PER_CHUNK;
+    timers = NULL;
+    timer_count = 0;
+    timer_capacity = 0;
+    workers = NULL;
+    worker_count = 0;
+}
+
+/*
+ * Gets the task that is running on the calling thread
+ */
+Task* tasks_current() {
+    Worker *worker = this_worker();
+    return worker == NULL ? NULL : worker->current;
+}
+
+/*
+ * Parks the calling task until somebody unparks it
+ */
+void tasks_park() {
+    Task *task = tasks_current();
+    int state = TASK_RUNNING;
+    if (!atomic_compare_exchange_strong(&task->state, &state,
+            TASK_PARKING)) {
+        // NOTIFIED - consume it
+        atomic_store(&task->state, TASK_RUNNING);
+        return;
+    }
+    swapcontext(&task->context, &this_worker()->context);
+}
+
+/*
+ * Parks the calling task until somebody unparks it or the deadline has passed
+ */
+void tasks_park_until(const struct timespec *deadline) {
+    TaskTimer timer = { *deadline, tasks_current() };
+    pthread_mutex_lock(&timer_mtx);
+    if (push_timer(timer)) {
+        pthread_cond_signal(&timer_cond);
+    }
+    pthread_mutex_unlock(&timer_mtx);
+
+    tasks_park();
+}
+
+/*
+ * Makes a parked task runnable again
+ */
+void tasks_unpark(Task *task) {
+    int state = atomic_load(&task->state);
+    while (true) {
+        switch (state) {
+            case TASK_RUNNING:
+            case TASK_PARKING:
+                if (atomic_compare_exchange_weak(&task->state, &state,
+                        TASK_NOTIFIED)) {
+                    return;
+                }
+                break;
+            case TASK_PARKED:
+                if (atomic_compare_exchange_weak(&task->state, &state,
+                        TASK_RUNNING)) {
+                    schedule(task);
+                    return;
+                }
+                break;
+            default:
+                // already notified or done
+                return;
+        }
+    }
+}
+
+/*
+ * Lets the other runnable tasks of the worker run first
+ */
+void tasks_yield() {
+    Task *task = tasks_current();
+    swapcontext(&task->context, &this_worker()->context);
+}
+
+/*
+ * Initializes a semaphore for the calling thread or task
+ */
+void tasks_sem_init(TaskSem *sem) {
+    sem->task = tasks_current();
+    atomic_store(&sem->count, 0);
+    if (sem->task == NULL) {
+        int res = sem_init(&sem->sem, 0, 0);
+        FATAL_ERROR_HANDLING(res, "[tasks_sem_init] Failed to create semaphore")
+    }
+}
+
+/*
+ * Waits until the semaphore is greater than 0, then decrements it
+ */
+void tasks_sem_wait(TaskSem *sem) {
+    if (sem->task == NULL) {
+        while (sem_wait(&sem->sem) != 0) {
+            // interrupted by a signal, keep waiting
+        }
+        return;
+    }
+
+    int count = atomic_load(&sem->count);
+    while (true) {
+        if (count == 0) {
+            tasks_park();
+            count = atomic_load(&sem->count);
+        } else if (atomic_compare_exchange_weak(&sem->count, &count,
+                count - 1)) {
+            return;
+        }
+    }
+}
+
+/*
+ * Increments the semaphore and wakes up its waiter
+ */
+void tasks_sem_post(TaskSem *sem) {
+    Task *task = sem->task;
+    if (task == NULL) {
+        sem_post(&sem->sem);
+        return;
+    }
+    // the waiter may return and drop sem right after the increment, but the
+    // task itself stays valid until tasks_wait
+    atomic_fetch_add(&sem->count, 1);
+    tasks_unpark(task);
+}
+
+/*
+ * Destroys a semaphore
+ */
+void tasks_sem_destroy(TaskSem *sem) {
+    if (sem->task == NULL) {
+        sem_destroy(&sem->sem);
+    }
+}
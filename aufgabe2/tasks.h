@@ -0,0 +1,156 @@
+/** ****************************************************************
+ * @file    aufgabe2/tasks.h
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    12.12.2016
+ * @brief   Header for the Tasks module
+ *
+ * M:N scheduler: user level tasks (ucontext coroutines with small stacks)
+ * run on a pool of worker threads. Every worker has its own run queue and
+ * steals from the others when it runs dry. A task that has to wait parks
+ * itself, which frees its worker for other tasks, and is made runnable again
+ * by tasks_unpark. Idle workers sleep on a futex, a timer thread wakes tasks
+ * parked with a deadline.
+ *
+ * Code that runs in a task must not block its worker for long (no
+ * sem_wait, no condition variables, no sleeping) and must not keep the
+ * address of thread local variables across a park, because the task may
+ * continue on another worker.
+ ******************************************************************
+ */
+
+#ifndef TASKS_H_
+#define TASKS_H_
+
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <time.h>
+
+/**
+ * @brief Stack size of a task
+ */
+#define TASKS_STACK_SIZE (32 * 1024)
+
+/**
+ * @brief Number of task stacks that are allocated at once
+ *
+ * Stacks come from few big mappings instead of one per task, so 100k tasks
+ * stay far below the mapping limit of the kernel.
+ */
+#define TASKS_STACKS_PER_CHUNK 256
+
+/**
+ * @brief A user level task
+ */
+typedef struct Task Task;
+
+/**
+ * @brief Counting semaphore that works for threads and tasks
+ *
+ * Only the thread or task that initialized it may wait on it, anybody may
+ * post it. A task waiting on it parks instead of blocking its worker.
+ */
+typedef struct {
+    Task *task;       //!< the waiting task, NULL if a thread waits
+    sem_t sem;        //!< used if a thread waits
+    atomic_int count; //!< used if a task waits
+} TaskSem;
+
+/**
+ * @brief Prepares the worker pool
+ *
+ * @param[in] workers number of worker threads
+ */
+void tasks_init(int workers);
+
+/**
+ * @brief Creates a task
+ *
+ * Tasks created before tasks_start all start together.
+ *
+ * @param[in] function what the task runs, the task ends when it returns
+ * @param[in] arg      argument for function
+ * @return the task, valid until tasks_wait returns
+ */
+Task* tasks_spawn(void (*function)(void*), void *arg);
+
+/**
+ * @brief Starts the worker threads
+ */
+void tasks_start();
+
+/**
+ * @brief Waits until all tasks have ended, then stops the worker pool
+ */
+void tasks_wait();
+
+/**
+ * @brief Gets the task that is running on the calling thread
+ *
+ * @return the task, NULL if the caller does not run in a task
+ */
+Task* tasks_current();
+
+/**
+ * @brief Parks the calling task until somebody unparks it
+ *
+ * If it was unparked since it last parked, it returns right away. It may also
+ * return without a reason, so the caller must check its condition again.
+ */
+void tasks_park();
+
+/**
+ * @brief Parks the calling task until somebody unparks it or the deadline
+ *        has passed
+ *
+ * Like tasks_park, the caller must check its condition and the time again.
+ *
+ * @param[in] deadline absolute CLOCK_MONOTONIC time
+ */
+void tasks_park_until(const struct timespec *deadline);
+
+/**
+ * @brief Makes a parked task runnable again
+ *
+ * If the task is not parked, its next tasks_park returns right away.
+ *
+ * @param[in] task the task to unpark
+ */
+void tasks_unpark(Task *task);
+
+/**
+ * @brief Lets the other runnable tasks of the worker run first
+ */
+void tasks_yield();
+
+/**
+ * @brief Initializes a semaphore with the value 0 for the calling thread or
+ *        task
+ *
+ * @param[out] sem the semaphore
+ */
+void tasks_sem_init(TaskSem *sem);
+
+/**
+ * @brief Waits until the semaphore is greater than 0, then decrements it
+ *
+ * @param[in] sem the semaphore
+ */
+void tasks_sem_wait(TaskSem *sem);
+
+/**
+ * @brief Increments the semaphore and wakes up its waiter
+ *
+ * @param[in] sem the semaphore
+ */
+void tasks_sem_post(TaskSem *sem);
+
+/**
+ * @brief Destroys a semaphore
+ *
+ * @param[in] sem the semaphore
+ */
+void tasks_sem_destroy(TaskSem *sem);
+
+#endif /* TASKS_H_ */
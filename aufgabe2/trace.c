@@ -0,0 +1,193 @@
+/** ****************************************************************
+ * @file    aufgabe2/trace.c
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    15.12.2016
+ * @brief   Implementation for the Trace module
+ ******************************************************************
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "trace.h"
+#include "errors.h"
+
+/**
+ * @brief Ring of one thread
+ *
+ * Only written by the owning thread and only read by trace_dump after all
+ * philosophers have stopped. Kept after the thread exits.
+ */
+typedef struct TraceRing {
+    uint64_t recorded;       //!< events recorded in total
+    struct TraceRing *next;  //!< next ring
+    TraceEvent events[];     //!< the last ring_events events
+} TraceRing;
+
+/*
+ * True while tracing is on
+ */
+bool trace_enabled = false;
+
+/**
+ * @brief Where trace_dump writes the trace
+ */
+static char *trace_path = NULL;
+
+/**
+ * @brief Number of events a ring keeps (a power of 2)
+ */
+static uint32_t ring_events = TRACE_MIN_RING_EVENTS;
+
+/**
+ * @brief Mutex guarding the list of rings
+ */
+static pthread_mutex_t rings_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief All rings
+ */
+static TraceRing *rings = NULL;
+
+/**
+ * @brief Number of rings
+ */
+static uint32_t ring_count = 0;
+
+/**
+ * @brief The ring of the calling thread, NULL until its first event
+ */
+static __thread TraceRing *local = NULL;
+
+/**
+ * @brief Ticks and time at trace_init
+ */
+static uint64_t start_ticks, start_ns;
+
+/**
+ * @brief Gets the CLOCK_MONOTONIC time
+ *
+ * @return the time in nanoseconds
+ */
+static uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+/**
+ * @brief Gets the timestamp of an event
+ *
+ * The TSC is an order of magnitude cheaper to read than the clock.
+ *
+ * @return ticks
+ */
+static uint64_t now_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return now_ns();
+#endif
+}
+
+/**
+ * @brief Gets the ring of the calling thread, creates it on first use
+ *
+ * @return the ring of the calling thread
+ */
+static TraceRing* local_ring() {
+    if (local == NULL) {
+        local = malloc(sizeof(TraceRing) + sizeof(TraceEvent) * ring_events);
+        FATAL_ERROR_HANDLING(local == NULL, "[trace] Failed to allocate ring")
+        local->recorded = 0;
+        pthread_mutex_lock(&rings_mtx);
+        local->next = rings;
+        rings = local;
+        ring_count++;
+        pthread_mutex_unlock(&rings_mtx);
+    }
+    return local;
+}
+
+/*
+ * Switches tracing on
+ */
+void trace_init(const char *path, int threads) {
+    trace_path = strdup(path);
+    FATAL_ERROR_HANDLING(trace_path == NULL, "[trace] Failed to copy path")
+
+    // share the budget, the main thread records commands too
+    long share = TRACE_BUDGET_EVENTS / (threads + 1);
+    while (ring_events * 2L <= share) {
+        ring_events *= 2;
+    }
+    start_ns = now_ns();
+    start_ticks = now_ticks();
+    trace_enabled = true;
+}
+
+/*
+ * Records an event in the ring of the calling thread
+ */
+void trace_record(int philo, TraceType type, int value) {
+    TraceRing *ring = local_ring();
+    TraceEvent *event =
+            &ring->events[ring->recorded++ & (ring_events - 1)];
+    event->ticks = now_ticks();
+    event->philo = philo;
+    event->type = type;
+    event->value = value;
+}
+
+/*
+ * Writes all rings to the file given to trace_init
+ */
+void trace_dump() {
+    if (!trace_enabled) {
+        return;
+    }
+    trace_enabled = false;
+
+    TraceFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.threads = ring_count;
+    header.start_ticks = start_ticks;
+    header.start_ns = start_ns;
+    header.end_ticks = now_ticks();
+    header.end_ns = now_ns();
+
+    FILE *file = fopen(trace_path, "wb");
+    FATAL_ERROR_HANDLING(file == NULL, "[trace] Failed to open trace file")
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    for (TraceRing *ring = rings; ring != NULL && written; ring = ring->next) {
+        TraceThreadHeader thread;
+        memset(&thread, 0, sizeof(thread));
+        thread.recorded = ring->recorded;
+        thread.events = ring->recorded < ring_events ?
+                ring->recorded : ring_events;
+        written = fwrite(&thread, sizeof(thread), 1, file) == 1;
+
+        // oldest first: the part after the write position, then the rest
+        uint32_t first = (ring->recorded - thread.events) & (ring_events - 1);
+        uint32_t tail = ring_events - first;
+        if (tail > thread.events) {
+            tail = thread.events;
+        }
+        written = written
+                && fwrite(&ring->events[first], sizeof(TraceEvent), tail, file)
+                        == tail
+                && fwrite(ring->events, sizeof(TraceEvent),
+                        thread.events - tail, file) == thread.events - tail;
+    }
+    FATAL_ERROR_HANDLING(fclose(file) != 0 || !written,
+            "[trace] Failed to write trace file")
+}
@@ -0,0 +1,134 @@
+/** ****************************************************************
+ * @file    aufgabe2/trace.h
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    15.12.2016
+ * @brief   Header for the Trace module
+ *
+ * Records every state change and every command of the philosophers with a
+ * timestamp (TSC ticks on x86) into a ring buffer per thread, so recording
+ * costs a few nanoseconds and never contends. trace_dump writes all rings
+ * into a binary file, trace2json turns it into a Chrome/Perfetto trace
+ * (chrome://tracing, ui.perfetto.dev) with one timeline per philosopher.
+ *
+ * The rings share a budget of TRACE_BUDGET_EVENTS events: every ring keeps
+ * the last budget / threads events of its thread (at least
+ * TRACE_MIN_RING_EVENTS), older events are overwritten. So a few worker
+ * threads running many philosopher tasks get big rings, thousands of
+ * philosopher threads small ones. Tracing is off unless trace_init was
+ * called (-T).
+ *
+ * File format (native byte order): a TraceFileHeader, then per thread a
+ * TraceThreadHeader followed by its events, oldest first.
+ ******************************************************************
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Number of events all rings together keep (64 MB)
+ */
+#define TRACE_BUDGET_EVENTS (1 << 22)
+
+/**
+ * @brief Number of events a ring keeps at least
+ */
+#define TRACE_MIN_RING_EVENTS 1024
+
+/**
+ * @brief First bytes of a trace file
+ */
+#define TRACE_MAGIC "PHTRACE1"
+
+/**
+ * @brief Records an event if tracing is on
+ */
+#define TRACE(philo, type, value) do { \
+        if (trace_enabled) { \
+            trace_record((philo), (type), (value)); \
+        } \
+    } while (0)
+
+/**
+ * @brief What an event records
+ */
+typedef enum {
+    TRACE_PHILOSOPHER = 1, //!< philosopher created, value: training weight
+    TRACE_STATE,           //!< state change, value: state letter (G W P R U)
+    TRACE_COMMAND          //!< command, value: command letter (n b p q)
+} TraceType;
+
+/**
+ * @brief One event
+ */
+typedef struct {
+    uint64_t ticks; //!< timestamp, see TraceFileHeader
+    uint32_t philo; //!< the philosopher
+    uint16_t type;  //!< TraceType
+    uint16_t value; //!< depends on type
+} TraceEvent;
+
+/**
+ * @brief Start of a trace file
+ *
+ * Ticks are converted to nanoseconds linearly between the two points of
+ * time.
+ */
+typedef struct {
+    char magic[8];         //!< TRACE_MAGIC
+    uint32_t threads;      //!< number of thread rings that follow
+    uint32_t reserved;     //!< 0
+    uint64_t start_ticks;  //!< ticks at trace_init
+    uint64_t start_ns;     //!< CLOCK_MONOTONIC time at trace_init
+    uint64_t end_ticks;    //!< ticks at trace_dump
+    uint64_t end_ns;       //!< CLOCK_MONOTONIC time at trace_dump
+} TraceFileHeader;
+
+/**
+ * @brief Start of the events of one thread
+ */
+typedef struct {
+    uint64_t recorded; //!< events recorded in total, including overwritten
+    uint32_t events;   //!< number of events that follow
+    uint32_t reserved; //!< 0
+} TraceThreadHeader;
+
+/**
+ * @brief True while tracing is on
+ */
+extern bool trace_enabled;
+
+/**
+ * @brief Switches tracing on
+ *
+ * Must be called before the philosophers start.
+ *
+ * @param[in] path    where trace_dump writes the trace
+ * @param[in] threads number of threads that will record events, to size
+ *                    the rings
+ */
+void trace_init(const char *path, int threads);
+
+/**
+ * @brief Records an event in the ring of the calling thread
+ *
+ * @param[in] philo the philosopher
+ * @param[in] type  what happened
+ * @param[in] value depends on type
+ */
+void trace_record(int philo, TraceType type, int value);
+
+/**
+ * @brief Writes all rings to the file given to trace_init
+ *
+ * Must be called after the philosophers have stopped. Does nothing if
+ * tracing is off.
+ */
+void trace_dump();
+
+#endif /* TRACE_H_ */
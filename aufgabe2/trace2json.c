@@ -0,0 +1,200 @@
+/** ****************************************************************
+ * @file    aufgabe2/trace2json.c
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    15.12.2016
+ * @brief   Converts a trace (see trace.h) to Chrome trace JSON
+ *
+ * Every philosopher becomes a thread of the timeline: its states are
+ * slices, its commands are instant events. The result can be opened in
+ * chrome://tracing or ui.perfetto.dev.
+ *
+ * Usage: trace2json TRACE [JSON]   (JSON defaults to stdout)
+ ******************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+#include "errors.h"
+
+/**
+ * @brief An event and where it was in the file, to keep the sort stable
+ */
+typedef struct {
+    TraceEvent event; //!< the event
+    long index;       //!< position in the file
+} SortedEvent;
+
+/**
+ * @brief Orders events by philosopher, then by time
+ */
+static int compare_events(const void *a, const void *b) {
+    const SortedEvent *x = a;
+    const SortedEvent *y = b;
+    if (x->event.philo != y->event.philo) {
+        return x->event.philo < y->event.philo ? -1 : 1;
+    }
+    if (x->event.ticks != y->event.ticks) {
+        return x->event.ticks < y->event.ticks ? -1 : 1;
+    }
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/**
+ * @brief Gets the name of a state
+ *
+ * @param[in] state the state letter
+ * @return the name, NULL for the undefined state
+ */
+static const char* state_name(int state) {
+    switch (state) {
+        case 'G':
+            return "get weights";
+        case 'W':
+            return "workout";
+        case 'P':
+            return "return weights";
+        case 'R':
+            return "rest";
+        default:
+            return NULL;
+    }
+}
+
+/**
+ * @brief Gets the name of a command
+ *
+ * @param[in] command the command letter
+ * @return the name
+ */
+static const char* command_name(int command) {
+    switch (command) {
+        case 'n':
+            return "normal";
+        case 'b':
+            return "block";
+        case 'p':
+            return "proceed";
+        case 'q':
+            return "quit";
+        default:
+            return "unknown";
+    }
+}
+
+/**
+ * @brief Program entry
+ */
+int main(int argc, char **argv) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s TRACE [JSON]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *in = fopen(argv[1], "rb");
+    FATAL_ERROR_HANDLING(in == NULL, "Failed to open trace")
+    TraceFileHeader header;
+    if (fread(&header, sizeof(header), 1, in) != 1
+            || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "%s is not a trace\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    // read the rings of all threads into one array
+    long count = 0;
+    long capacity = 0;
+    long overwritten = 0;
+    SortedEvent *events = NULL;
+    for (uint32_t t = 0; t < header.threads; t++) {
+        TraceThreadHeader thread;
+        if (fread(&thread, sizeof(thread), 1, in) != 1) {
+            fprintf(stderr, "%s is truncated\n", argv[1]);
+            return EXIT_FAILURE;
+        }
+        overwritten += thread.recorded - thread.events;
+        if (count + thread.events > capacity) {
+            capacity = (count + thread.events) * 2;
+            events = realloc(events, sizeof(SortedEvent) * capacity);
+            FATAL_ERROR_HANDLING(events == NULL, "Failed to allocate events")
+        }
+        for (uint32_t e = 0; e < thread.events; e++, count++) {
+            if (fread(&events[count].event, sizeof(TraceEvent), 1, in) != 1) {
+                fprintf(stderr, "%s is truncated\n", argv[1]);
+                return EXIT_FAILURE;
+            }
+            events[count].index = count;
+        }
+    }
+    fclose(in);
+    qsort(events, count, sizeof(SortedEvent), compare_events);
+
+    FILE *out = argc == 3 ? fopen(argv[2], "w") : stdout;
+    FATAL_ERROR_HANDLING(out == NULL, "Failed to open JSON file")
+
+    // ticks to microseconds since trace_init
+    double ticks = header.end_ticks - header.start_ticks;
+    double us_per_tick = ticks > 0 ?
+            (header.end_ns - header.start_ns) / 1000.0 / ticks : 0.0;
+    double end_us = (header.end_ns - header.start_ns) / 1000.0;
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+            "\"args\":{\"name\":\"philosophers\"}}");
+    for (long i = 0; i < count; i++) {
+        const TraceEvent *event = &events[i].event;
+        double us = ((double) event->ticks - header.start_ticks)
+                * us_per_tick;
+
+        switch (event->type) {
+        case TRACE_PHILOSOPHER:
+            fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\","
+                    "\"pid\":1,\"tid\":%u,\"args\":{\"name\":"
+                    "\"philosopher %u (%u)\"}}", event->philo, event->philo,
+                    event->value);
+            fprintf(out, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\","
+                    "\"pid\":1,\"tid\":%u,\"args\":{\"sort_index\":%u}}",
+                    event->philo, event->philo);
+            break;
+        case TRACE_STATE: {
+            const char *name = state_name(event->value);
+            if (name == NULL) {
+                break;
+            }
+            // the state lasts until the next state of the philosopher
+            double end = end_us;
+            for (long next = i + 1; next < count
+                    && events[next].event.philo == event->philo; next++) {
+                if (events[next].event.type == TRACE_STATE) {
+                    end = ((double) events[next].event.ticks
+                            - header.start_ticks) * us_per_tick;
+                    break;
+                }
+            }
+            fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,"
+                    "\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", name,
+                    event->philo, us, end - us);
+            break;
+        }
+        case TRACE_COMMAND:
+            fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\","
+                    "\"pid\":1,\"tid\":%u,\"ts\":%.3f}",
+                    command_name(event->value), event->philo, us);
+            break;
+        }
+    }
+    fprintf(out, "\n]}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    fprintf(stderr, "%ld events from %u threads", count, header.threads);
+    if (overwritten > 0) {
+        fprintf(stderr, ", %ld older events were overwritten", overwritten);
+    }
+    fprintf(stderr, "\n");
+    free(events);
+    return 0;
+}
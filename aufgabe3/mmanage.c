@@ -4,11 +4,25 @@
  * This is the memory manager process that works together with the vmaccess
  * process to mimic virtual memory management.
  *
- * The memory manager process will be invoked via a SIGUSR1 signal. It
- * maintains the page table and provides the data pages in shared memory
+ * The memory manager process serves any number of client processes (up to
+ * VMEM_MAX_CLIENTS at a time), each with an address space of its own. All
+ * clients share the frames, the replacement algorithm picks from all of them.
+ *
+ * The page faults posted to the fault slots in shared memory are handled by a
+ * thread of its own. A page fault can also be signalled with SIGUSR1
+ * (fallback for clients that do not use the slots).
+ * Signals are not handled asynchronously but fetched by the main loop, so the
+ * handling may use stdio. mmanage maintains the page table and provides the
+ * data pages in shared memory
  *
  * This process is initiating the shared memory, so it has to be started prior
- * to the vmaccess process.
+ * to the vmaccess process. The sizes of the address spaces, the pages and the
+ * physical memory are set at startup:
+ *
+ *     mmanage [-v VIRTMEMSIZE] [-f FRAMES] [-p PAGESIZE] FIFO|LRU|CLOCK
+ *
+ * The page tables are sparse, so large address spaces only cost memory for
+ * the pages in use.
  *
  * @author  Prof. Dr. Wolfgang Fohl, HAW Hamburg (original author)
  * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
@@ -19,8 +33,13 @@
  ******************************************************************
  */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include "mmanage.h"
 
 /**
@@ -28,6 +47,66 @@
  */
 static struct vmem_struct *vmem = NULL;
 
+/**
+ * @brief sizes and layout of the shared memory
+ */
+static struct vmem_layout layout;
+
+/**
+ * @brief pages on frame (shared memory)
+ */
+static int *framepage = NULL;
+
+/**
+ * @brief client of the page on frame (shared memory)
+ */
+static int *frameclient = NULL;
+
+/**
+ * @brief page table entry of the page on frame, NULL if none
+ */
+static struct pt_entry **frame_entries = NULL;
+
+/**
+ * @brief page table directories (shared memory)
+ */
+static struct pt_dir *dirs = NULL;
+
+/**
+ * @brief page table leaves (shared memory)
+ */
+static struct pt_leaf *leaves = NULL;
+
+/**
+ * @brief the frames (shared memory)
+ */
+static int *data = NULL;
+
+/**
+ * @brief frames not in use, the lowest one on top
+ */
+static int *free_frames = NULL;
+
+/**
+ * @brief number of frames not in use
+ */
+static int free_count = 0;
+
+/**
+ * @brief frames in use by time of last access
+ */
+static struct lru_heap lru;
+
+/**
+ * @brief directories that are not a root
+ */
+static struct node_pool dir_pool;
+
+/**
+ * @brief leaves
+ */
+static struct node_pool leaf_pool;
+
 /**
  * @brief the pagefile
  */
@@ -43,6 +122,16 @@ static FILE *logfile = NULL;
  */
 static int signal_number = 0;
 
+/**
+ * @brief serializes page fault handling and dumps (fault thread and main loop)
+ */
+static pthread_mutex_t fault_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief the thread servicing the fault ring
+ */
+static pthread_t fault_thread;
+
 /**
  * @brief function pointer for switching page replacement algorithm.
  */
@@ -57,19 +146,43 @@ static int (*get_frame_to_replace)(void);
  * @return exit code
  */
 int main(int argc, char** argv) {
-	struct sigaction sigact;
+	sigset_t signals;
+	int virtmemsize = VMEM_VIRTMEMSIZE;
+	int nframes = VMEM_NFRAMES;
+	int pagesize = VMEM_PAGESIZE;
+	int opt;
+
+	/* sizes */
+	while ((opt = getopt(argc, argv, "v:f:p:")) != -1) {
+		switch (opt) {
+		case 'v':
+			virtmemsize = atoi(optarg);
+			break;
+		case 'f':
+			nframes = atoi(optarg);
+			break;
+		case 'p':
+			pagesize = atoi(optarg);
+			break;
+		default:
+			printf("Usage: %s [-v VIRTMEMSIZE] [-f FRAMES] [-p PAGESIZE] "
+					"FIFO|LRU|CLOCK\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	init_layout(virtmemsize, pagesize, nframes);
 
 	/* set algorithm for replacement */
-	if(argc < 2){
+	if(optind >= argc){
 		printf("Please specify algorithm (FIFO, LRU, CLOCK)!\n");
 		return EXIT_FAILURE;
 	}
 
-	if(strcmp(argv[1], "LRU") == 0){
+	if(strcmp(argv[optind], "LRU") == 0){
 		get_frame_to_replace = get_frame_lru;
-	} else if(strcmp(argv[1], "CLOCK") == 0){
+	} else if(strcmp(argv[optind], "CLOCK") == 0){
 		get_frame_to_replace = get_frame_clock;
-	} else if(strcmp(argv[1], "FIFO") == 0){
+	} else if(strcmp(argv[optind], "FIFO") == 0){
 		get_frame_to_replace = get_frame_fifo;
 	} else {
 		printf("Invalid algorithm! Please select (FIFO, LRU, CLOCK)!\n");
@@ -89,37 +202,30 @@ int main(int argc, char** argv) {
 	/* Create shared memory and init vmem structure */
 	vmem_init();
 
-	/* Setup signal handler */
-	/* Handler for USR1 */
-	sigact.sa_handler = sighandler;
-	sigemptyset(&sigact.sa_mask);
-	sigact.sa_flags = 0;
-	if (sigaction(SIGUSR1, &sigact, NULL) == -1) {
-		perror("Error installing signal handler for USR1");
+	/* Block the signals in all threads, the main loop fetches them */
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGUSR1);
+	sigaddset(&signals, SIGUSR2);
+	sigaddset(&signals, SIGINT);
+	if (pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0) {
+		perror("Error blocking signals");
 		exit(EXIT_FAILURE);
 	} else {
-		PDEBUG("USR1 handler successfully installed\n")
+		PDEBUG("USR1, USR2 and INT blocked\n");
 	}
 
-	if (sigaction(SIGUSR2, &sigact, NULL) == -1) {
-		perror("Error installing signal handler for USR2");
-		exit(EXIT_FAILURE);
-	} else {
-		PDEBUG("USR2 handler successfully installed\n");
-	}
-
-	if (sigaction(SIGINT, &sigact, NULL) == -1) {
-		perror("Error installing signal handler for INT");
-		exit(EXIT_FAILURE);
-	} else {
-		PDEBUG("INT handler successfully installed\n");
-	}
+	/* Service the fault ring */
+	start_fault_service();
 
 	/* Signal processing loop */
 	signal_number = 0;
 	while (signal_number != SIGINT) {
+		int signo;
 		signal_number = 0;
-		pause();
+		if (sigwait(&signals, &signo) != 0) {
+			continue;
+		}
+		sighandler(signo);
 		if (signal_number == SIGUSR1) { /* Page fault */
 			PDEBUG("Processed SIGUSR1\n");
 			signal_number = 0;
@@ -131,12 +237,21 @@ int main(int argc, char** argv) {
 		}
 	}
 
+	/* Signals that came together with SIGINT are fetched in order of number */
+	struct timespec no_wait = { 0, 0 };
+	int signo;
+	while ((signo = sigtimedwait(&signals, NULL, &no_wait)) > 0) {
+		sighandler(signo);
+	}
+
 	/* Cleanup */
+	stop_fault_service();
 	fclose(pagefile);
 	fclose(logfile);
 	vmem_cleanup();
 	return 0;
 }
+
 /*
  * Initializes the pagefile for swapping pages out of memory
  *
@@ -154,10 +269,118 @@ void init_pagefile(const char *pfname) {
 		exit(EXIT_FAILURE);
 	}
 
-	// initialize pagefile with random junk
-	for (int i = 0; i < VMEM_VIRTMEMSIZE; i++) {
-		fwrite(&i, sizeof(int), 1, pagefile);
+	// one region per client, only the stored pages take disk space
+	off_t size = (off_t) VMEM_MAX_CLIENTS * layout.virtmemsize * sizeof(int);
+	if (ftruncate(fileno(pagefile), size) == -1) {
+		perror("Error resizing pagefile");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/*
+ * Discards the pagefile region of a client, all pages read as zeros
+ */
+void reset_pagefile(int client) {
+	off_t size = (off_t) layout.virtmemsize * sizeof(int);
+
+	// pending writes must not end up in the hole
+	fflush(pagefile);
+	int res = fallocate(fileno(pagefile),
+			FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, client * size, size);
+	if (res == 0) {
+		return;
+	}
+	if (errno != EOPNOTSUPP) {
+		perror("Failed to reset pagefile");
+		vmem_cleanup();
+		exit(EXIT_FAILURE);
+	}
+
+	// file system can not punch holes - overwrite the region with zeros
+	int *zeros = calloc(layout.pagesize, sizeof(int));
+	if (zeros == NULL || fseeko(pagefile, client * size, SEEK_SET) != 0) {
+		perror("Failed to reset pagefile");
+		vmem_cleanup();
+		exit(EXIT_FAILURE);
+	}
+	for (int page = 0; page < layout.npages; page++) {
+		int written = fwrite(zeros, sizeof(int), layout.pagesize, pagefile);
+		if (written != layout.pagesize) {
+			perror("Failed to reset pagefile");
+			vmem_cleanup();
+			exit(EXIT_FAILURE);
+		}
 	}
+	free(zeros);
+}
+
+/*
+ * Checks the sizes and computes the layout of the shared memory
+ */
+void init_layout(int virtmemsize, int pagesize, int nframes) {
+	if (virtmemsize <= 0 || pagesize <= 0 || nframes <= 0
+			|| (pagesize & (pagesize - 1)) != 0
+			|| virtmemsize % pagesize != 0
+			|| (long) nframes * pagesize > INT_MAX) {
+		fprintf(stderr, "Invalid sizes: VIRTMEMSIZE must be a multiple of "
+				"PAGESIZE (a power of 2), FRAMES * PAGESIZE at most %d\n",
+				INT_MAX);
+		exit(EXIT_FAILURE);
+	}
+
+	layout.virtmemsize = virtmemsize;
+	layout.pagesize = pagesize;
+	layout.page_shift = 0;
+	while ((1 << layout.page_shift) < pagesize) {
+		layout.page_shift++;
+	}
+	layout.npages = virtmemsize / pagesize;
+	layout.nframes = nframes;
+
+	// enough directory levels for the page number (at least the root)
+	int page_bits = 0;
+	while ((1L << page_bits) < layout.npages) {
+		page_bits++;
+	}
+	layout.pt_levels = 1;
+	while ((layout.pt_levels + 1) * VMEM_PT_BITS < page_bits) {
+		layout.pt_levels++;
+	}
+
+	// the roots and the most nodes the other levels can need
+	long span = VMEM_PT_FANOUT;
+	layout.nleaves = node_capacity(span);
+	layout.ndirs = VMEM_MAX_CLIENTS;
+	for (int level = layout.pt_levels - 1; level > 0; level--) {
+		span *= VMEM_PT_FANOUT;
+		layout.ndirs += node_capacity(span);
+	}
+
+	size_t end = sizeof(struct vmem_struct);
+	layout.framepage = place_part(&end, nframes * sizeof(int));
+	layout.frameclient = place_part(&end, nframes * sizeof(int));
+	layout.dirs = place_part(&end, layout.ndirs * sizeof(struct pt_dir));
+	layout.leaves = place_part(&end, layout.nleaves * sizeof(struct pt_leaf));
+	layout.data = place_part(&end, (size_t) nframes * pagesize * sizeof(int));
+	layout.shmsize = end;
+}
+
+/*
+ * Gets the most nodes one level of the page tables can need
+ */
+int node_capacity(long span) {
+	long nodes = VMEM_MAX_CLIENTS * ((layout.npages + span - 1) / span);
+	return nodes < layout.nframes ? nodes : layout.nframes;
+}
+
+/*
+ * Places a part in the shared memory
+ */
+size_t place_part(size_t *end, size_t size) {
+	// parts start on a cache line of their own
+	size_t offset = (*end + 63) & ~(size_t) 63;
+	*end = offset + size;
+	return offset;
 }
 
 /*
@@ -178,7 +401,7 @@ void vmem_init(void) {
 	}
 
 	// resize
-	int res = ftruncate(shm_fd, SHMSIZE);
+	int res = ftruncate(shm_fd, layout.shmsize);
 	if (res == -1) {
 		perror("Error resizing vmem");
 		exit(EXIT_FAILURE);
@@ -187,9 +410,9 @@ void vmem_init(void) {
 	}
 
 	// map
-	vmem = (struct vmem_struct*) mmap(NULL, SHMSIZE, PROT_READ | PROT_WRITE,
-			MAP_SHARED, shm_fd, 0);
-	if (!vmem) {
+	vmem = (struct vmem_struct*) mmap(NULL, layout.shmsize,
+			PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+	if (vmem == MAP_FAILED) {
 		perror("Error mapping vmem");
 		exit(EXIT_FAILURE);
 	} else {
@@ -197,6 +420,7 @@ void vmem_init(void) {
 	}
 
 	// init administration structure
+	vmem->adm.layout = layout;
 	res = sem_init(&(vmem->adm.sema), 1, 0);
 	if (res == -1) {
 		perror("Error initialising semaphore");
@@ -204,20 +428,46 @@ void vmem_init(void) {
 	} else {
 		PDEBUG("semaphore successfully initialized\n")
 	}
+	res = sem_init(&(vmem->adm.signal_lock), 1, 1);
+	if (res == -1) {
+		perror("Error initialising semaphore");
+		exit(EXIT_FAILURE);
+	}
 	vmem->adm.mmanage_pid = getpid();
 	vmem->adm.pf_count = 0;
+	vmem->adm.req_client = 0;
 	vmem->adm.req_pageno = 0;
+	memset(&(vmem->adm.service), 0, sizeof(vmem->adm.service));
+	memset(vmem->adm.clients, 0, sizeof(vmem->adm.clients));
 
 	PDEBUG("Administration initialized\n");
 
-	// init pagetable
-	for (int i = 0; i < VMEM_NPAGES; i++) {
-		vmem->pt.entries[i].last_used = 0;
-		vmem->pt.entries[i].flags = 0;
-		vmem->pt.entries[i].frame = VOID_IDX;
+	// init pagetables, the nodes are touched when they are first used
+	framepage = VMEM_AT(vmem, layout.framepage);
+	frameclient = VMEM_AT(vmem, layout.frameclient);
+	dirs = VMEM_AT(vmem, layout.dirs);
+	leaves = VMEM_AT(vmem, layout.leaves);
+	data = VMEM_AT(vmem, layout.data);
+	frame_entries = calloc(layout.nframes, sizeof(struct pt_entry*));
+	if (frame_entries == NULL) {
+		perror("Error allocating frame table");
+		exit(EXIT_FAILURE);
 	}
-	for (int i = 0; i < VMEM_NFRAMES; i++) {
-		vmem->pt.framepage[i] = VOID_IDX;
+	init_lru();
+	init_pool(&dir_pool, VMEM_MAX_CLIENTS, layout.ndirs);
+	init_pool(&leaf_pool, 0, layout.nleaves);
+	for (int client = 0; client < VMEM_MAX_CLIENTS; client++) {
+		init_dir(client);
+	}
+	free_frames = malloc(layout.nframes * sizeof(int));
+	if (free_frames == NULL) {
+		perror("Error allocating frame table");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = layout.nframes - 1; i >= 0; i--) {
+		framepage[i] = VOID_IDX;
+		frameclient[i] = VOID_IDX;
+		free_frames[free_count++] = i;
 	}
 
 	PDEBUG("Pagetable initialized\n");
@@ -231,16 +481,249 @@ void vmem_init(void) {
  */
 void vmem_cleanup(void) {
 	sem_destroy(&(vmem->adm.sema));
-	munmap(vmem, SHMSIZE);
+	sem_destroy(&(vmem->adm.signal_lock));
+	munmap(vmem, layout.shmsize);
 	vmem = NULL;
 	shm_unlink(SHMNAME);
+	free(frame_entries);
+	free(free_frames);
+	free(lru.frames);
+	free(lru.keys);
+	free(lru.slots);
+	free(dir_pool.next);
+	free(leaf_pool.next);
 	PDEBUG("cleaned up shared memory\n");
 }
 
+/*
+ * Resets the page table of a client, all pages not present
+ */
+void reset_pagetable(int client) {
+	free_subtree(client, 0);
+	init_dir(client);
+}
+
+/*
+ * Prepares a node pool
+ */
+void init_pool(struct node_pool *pool, int first, int capacity) {
+	pool->end = first;
+	pool->capacity = capacity;
+	pool->in_use = 0;
+	pool->free = VOID_IDX;
+	pool->next = malloc(capacity * sizeof(int));
+	if (pool->next == NULL) {
+		perror("Error allocating node pool");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/*
+ * Takes a node from a pool
+ */
+int alloc_node(struct node_pool *pool) {
+	int node = pool->free;
+	if (node != VOID_IDX) {
+		pool->free = pool->next[node];
+	} else if (pool->end < pool->capacity) {
+		node = pool->end++;
+	} else {
+		// the capacity is the worst case, see init_layout
+		fprintf(stderr, "Out of page table nodes\n");
+		vmem_cleanup();
+		exit(EXIT_FAILURE);
+	}
+	pool->in_use++;
+	return node;
+}
+
+/*
+ * Returns a node that no client can reach anymore to its pool
+ */
+void free_node(struct node_pool *pool, int node) {
+	pool->next[node] = pool->free;
+	pool->free = node;
+	pool->in_use--;
+}
+
+/*
+ * Clears a page table directory, no children
+ */
+void init_dir(int dir) {
+	dirs[dir].count = 0;
+	for (int i = 0; i < VMEM_PT_FANOUT; i++) {
+		dirs[dir].children[i] = VMEM_PT_NONE;
+	}
+}
+
+/*
+ * Clears a page table leaf, all pages not present
+ */
+void init_leaf(int leaf) {
+	leaves[leaf].present = 0;
+	for (int i = 0; i < VMEM_PT_FANOUT; i++) {
+		leaves[leaf].entries[i].last_used = 0;
+		leaves[leaf].entries[i].flags = 0;
+		leaves[leaf].entries[i].frame = VOID_IDX;
+	}
+}
+
+/*
+ * Frees all nodes below a directory (not the directory itself)
+ */
+void free_subtree(int dir, int level) {
+	for (int i = 0; i < VMEM_PT_FANOUT; i++) {
+		int child = dirs[dir].children[i];
+		if (child == VMEM_PT_NONE) {
+			continue;
+		}
+		if (level + 1 < layout.pt_levels) {
+			free_subtree(child, level + 1);
+			free_node(&dir_pool, child);
+		} else {
+			free_node(&leaf_pool, child);
+		}
+	}
+}
+
+/*
+ * Gets the page table entry of a page that is about to be loaded
+ */
+struct pt_entry* map_entry(int client, int page) {
+	int node = client; /* root directory */
+	for (int level = 0; level < layout.pt_levels; level++) {
+		struct pt_dir *dir = &dirs[node];
+		int *child = &dir->children[vmem_pt_index(page, level,
+				layout.pt_levels)];
+		if (*child == VMEM_PT_NONE) {
+			int created;
+			if (level + 1 < layout.pt_levels) {
+				created = alloc_node(&dir_pool);
+				init_dir(created);
+			} else {
+				created = alloc_node(&leaf_pool);
+				init_leaf(created);
+			}
+			// the client may walk into the node right away
+			__atomic_store_n(child, created, __ATOMIC_RELEASE);
+			dir->count++;
+		}
+		node = *child;
+	}
+	leaves[node].present++;
+	return &(leaves[node].entries[vmem_pt_index(page, layout.pt_levels,
+			layout.pt_levels)]);
+}
+
+/*
+ * Accounts for a page that is not present anymore
+ */
+void release_entry(int client, int page) {
+	int levels = layout.pt_levels;
+	int path[levels + 1]; /* nodes from the root to the leaf */
+	path[0] = client;
+	for (int level = 0; level < levels; level++) {
+		path[level + 1] = dirs[path[level]].children[vmem_pt_index(page,
+				level, levels)];
+	}
+	if (--leaves[path[levels]].present > 0) {
+		return;
+	}
+
+	// unlink the nodes left empty, from the leaf up to the root
+	int top = levels; /* level of the topmost empty node */
+	while (1) {
+		struct pt_dir *parent = &dirs[path[top - 1]];
+		__atomic_store_n(&parent->children[vmem_pt_index(page, top - 1,
+				levels)], VMEM_PT_NONE, __ATOMIC_SEQ_CST);
+		if (--parent->count > 0 || top - 1 == 0) {
+			break;
+		}
+		top--;
+	}
+
+	// the client may still be walking through them (see pt_dir)
+	long span = 1L << ((levels - top + 1) * VMEM_PT_BITS);
+	wait_for_client(client, page - page % span, span);
+	free_node(&leaf_pool, path[levels]);
+	for (int level = top; level < levels; level++) {
+		free_node(&dir_pool, path[level]);
+	}
+}
+
+/*
+ * Waits until a client does not access one of some pages
+ */
+void wait_for_client(int client, long first, long count) {
+	int page;
+	while ((page = __atomic_load_n(&(vmem->adm.clients[client].accessing),
+			__ATOMIC_SEQ_CST)) >= first && page < first + count) {
+		sched_yield();
+	}
+}
+
+/*
+ * Handles a request of a client: a page fault or its detach
+ */
+void handle_request(int client, int page) {
+	if (page == VMEM_DETACH) {
+		detach_client(client);
+	} else {
+		pagefault(client, page);
+	}
+}
+
+/*
+ * Frees the frames of a client that leaves and resets its address space
+ */
+void detach_client(int client) {
+	PDEBUG("Detach client %d\n", client);
+#ifdef DEBUG_MESSAGES
+	dump();
+#endif
+	for (int i = layout.nframes - 1; i >= 0; i--) {
+		if (frameclient[i] == client) {
+			framepage[i] = VOID_IDX;
+			frameclient[i] = VOID_IDX;
+			frame_entries[i] = NULL;
+			lru_remove(i);
+			free_frames[free_count++] = i;
+		}
+	}
+	reset_pagetable(client);
+	reset_pagefile(client);
+}
+
+/*
+ * Gets the page table entry of the page on a frame
+ */
+struct pt_entry* frame_entry(int frame) {
+	return frame_entries[frame];
+}
+
+/*
+ * Takes the page on a frame out of the address space of its client
+ */
+int unmap_frame(int frame) {
+	int client = frameclient[frame];
+	int page = framepage[frame];
+	struct pt_entry *entry = frame_entry(frame);
+
+	// the client may be accessing the page right now (see pt_entry)
+	__atomic_fetch_and(&entry->flags, ~PTF_PRESENT, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&(vmem->adm.clients[client].generation), 1,
+			__ATOMIC_SEQ_CST); /* TLB shootdown (see tlb_entry) */
+	wait_for_client(client, page, 1);
+	int flags = __atomic_exchange_n(&entry->flags, 0, __ATOMIC_ACQUIRE);
+	frame_entries[frame] = NULL;
+	release_entry(client, page);
+	return flags;
+}
+
 /*
  * performs the necessary actions to handle a pagefault
  */
-void pagefault() {
+void pagefault(int client, int page) {
 	PDEBUG("Pagefault\n");
 	vmem->adm.pf_count++;
 	struct logevent le;
@@ -250,21 +733,31 @@ void pagefault() {
 	// no free frame ==> replace one
 	if(frame_to_replace == VOID_IDX){
 		frame_to_replace = get_frame_to_replace();
-		int page_to_replace = vmem->pt.framepage[frame_to_replace];
+		int page_to_replace = framepage[frame_to_replace];
 
-		if((page_to_replace != VOID_IDX) && (vmem->pt.entries[page_to_replace].flags & PTF_DIRTY)){
-			store_page(page_to_replace, frame_to_replace);
+		if(page_to_replace != VOID_IDX){
+			int client_to_replace = frameclient[frame_to_replace];
+			if(unmap_frame(frame_to_replace) & PTF_DIRTY){ /* not present, not dirty, not used */
+				store_page(client_to_replace, page_to_replace, frame_to_replace);
+			}
 		}
-		vmem->pt.entries[page_to_replace].flags = 0; /* not present, not dirty, not used */
 		le.replaced_page = page_to_replace;
 	}
 
-	int page_to_load = vmem->adm.req_pageno;
-	load_page(page_to_load, frame_to_replace);
+	int page_to_load = page;
+	load_page(client, page_to_load, frame_to_replace);
 
-	vmem->pt.entries[page_to_load].flags = PTF_PRESENT; /* present, not dirty, not used */
-	vmem->pt.entries[page_to_load].frame = frame_to_replace;
-	vmem->pt.framepage[frame_to_replace] = page_to_load;
+	// used right now, so other clients' faults do not evict it before the
+	// client got to access it
+	struct pt_entry *entry = map_entry(client, page_to_load);
+	entry->frame = frame_to_replace;
+	entry->last_used = __atomic_load_n(&(vmem->adm.g_count), __ATOMIC_RELAXED);
+	framepage[frame_to_replace] = page_to_load;
+	frameclient[frame_to_replace] = client;
+	frame_entries[frame_to_replace] = entry;
+	lru_update(frame_to_replace, entry->last_used);
+	__atomic_store_n(&entry->flags, PTF_PRESENT | PTF_USED,
+			__ATOMIC_RELEASE); /* present, not dirty, used */
 
 	/* logging */
 	le.alloc_frame = frame_to_replace;
@@ -273,28 +766,95 @@ void pagefault() {
 
 	le.req_pageno = page_to_load;
 	logger(le);
+}
+
+/*
+ * Starts the thread servicing the fault slots
+ */
+void start_fault_service(void) {
+	// before the thread runs, it stops as soon as it sees ready unset
+	__atomic_store_n(&(vmem->adm.service.ready), 1, __ATOMIC_RELEASE);
+	int res = pthread_create(&fault_thread, NULL, fault_service, NULL);
+	if (res != 0) {
+		fprintf(stderr, "Error starting fault service: %s\n", strerror(res));
+		exit(EXIT_FAILURE);
+	}
+	PDEBUG("fault service started\n");
+}
+
+/*
+ * Stops the thread servicing the fault slots
+ */
+void stop_fault_service(void) {
+	struct fault_service *service = &(vmem->adm.service);
+	__atomic_store_n(&service->ready, 0, __ATOMIC_SEQ_CST);
+	__atomic_fetch_add(&service->posted, 1, __ATOMIC_SEQ_CST);
+	vmem_futex_wake(&service->posted);
+	pthread_join(fault_thread, NULL);
+	PDEBUG("fault service stopped\n");
+}
 
-	// wakeup vmappl
-	sem_post(&(vmem->adm.sema));
+/*
+ * Handles the requests posted to the fault slots of the clients, round robin
+ */
+void* fault_service(void *arg) {
+	struct fault_service *service = &(vmem->adm.service);
+	int next = 0; /* client to look at first */
+
+	while (1) {
+		// read before the slots, so a request posted after that ends the wait
+		int posted = __atomic_load_n(&service->posted, __ATOMIC_SEQ_CST);
+		int client = VOID_IDX;
+		for (int i = 0; i < VMEM_MAX_CLIENTS && client == VOID_IDX; i++) {
+			int candidate = (next + i) % VMEM_MAX_CLIENTS;
+			if (__atomic_load_n(&(vmem->adm.clients[candidate].fault.state),
+					__ATOMIC_ACQUIRE) == FAULT_REQUESTED) {
+				client = candidate;
+			}
+		}
+
+		if (client != VOID_IDX) {
+			struct fault_slot *slot = &(vmem->adm.clients[client].fault);
+			pthread_mutex_lock(&fault_mutex);
+			handle_request(client, slot->pageno);
+			pthread_mutex_unlock(&fault_mutex);
+
+			// wakeup the client
+			__atomic_store_n(&slot->state, FAULT_DONE, __ATOMIC_RELEASE);
+			vmem_futex_wake(&slot->state);
+			next = (client + 1) % VMEM_MAX_CLIENTS;
+			continue;
+		}
+		if (!__atomic_load_n(&service->ready, __ATOMIC_SEQ_CST)) {
+			break;
+		}
+
+		__atomic_store_n(&service->sleeping, 1, __ATOMIC_SEQ_CST);
+		vmem_futex_wait(&service->posted, posted);
+		__atomic_store_n(&service->sleeping, 0, __ATOMIC_SEQ_CST);
+	}
+	return NULL;
 }
 
 /*
  * Stores a page to disk.
  *
  * Precondition:
- * page is between 0 and VMEM_NPAGES
- * frame is between 0 and VMEM_NFRAMES
+ * client is between 0 and VMEM_MAX_CLIENTS
+ * page is between 0 and npages
+ * frame is between 0 and nframes
  *
  * Postcondition:
  * data stored in frame will be written to disk
  */
-void store_page(int page, int frame){
+void store_page(int client, int page, int frame){
 	// TODO: Range checking?
-	int *pagedata = vmem->data + frame * VMEM_PAGESIZE;
-	int offset = page * VMEM_PAGESIZE * sizeof(int);
+	int *pagedata = data + ((size_t) frame << layout.page_shift);
+	off_t offset = ((off_t) client * layout.npages + page) * layout.pagesize
+			* sizeof(int);
 
 	// go to page in pagefile
-	int res = fseek(pagefile, offset, SEEK_SET);
+	int res = fseeko(pagefile, offset, SEEK_SET);
 	if(res != 0){
 		perror("Failed to seek to file while storing page\n");
 		vmem_cleanup();
@@ -302,8 +862,8 @@ void store_page(int page, int frame){
 	}
 
 	// write data
-	int size = fwrite(pagedata, sizeof(int), VMEM_PAGESIZE, pagefile);
-	if(size != VMEM_PAGESIZE){
+	int size = fwrite(pagedata, sizeof(int), layout.pagesize, pagefile);
+	if(size != layout.pagesize){
 		perror("Failed to write file while storing page\n");
 		vmem_cleanup();
 		exit(EXIT_FAILURE);
@@ -317,19 +877,21 @@ void store_page(int page, int frame){
  * Will change (overwrite) the data associated with frame.
  *
  * Precondition:
- * page is between 0 and VMEM_NPAGES
- * frame is between 0 and VMEM_NFRAMES
+ * client is between 0 and VMEM_MAX_CLIENTS
+ * page is between 0 and npages
+ * frame is between 0 and nframes
  *
  * Postcondition:
  * data stored in frame will be overwritten
  */
-void load_page(int page, int frame){
+void load_page(int client, int page, int frame){
 	// TODO: Range check?
-	int *pagedata = vmem->data + frame * VMEM_PAGESIZE;
-	int offset = page * VMEM_PAGESIZE * sizeof(int);
+	int *pagedata = data + ((size_t) frame << layout.page_shift);
+	off_t offset = ((off_t) client * layout.npages + page) * layout.pagesize
+			* sizeof(int);
 
 	// go to page in pagefile
-	int res = fseek(pagefile, offset, SEEK_SET);
+	int res = fseeko(pagefile, offset, SEEK_SET);
 	if(res != 0){
 		perror("Failed to seek to file while fetching page\n");
 		vmem_cleanup();
@@ -337,8 +899,8 @@ void load_page(int page, int frame){
 	}
 
 	// read data
-	int size = fread(pagedata, sizeof(int), VMEM_PAGESIZE, pagefile);
-	if(size != VMEM_PAGESIZE){
+	int size = fread(pagedata, sizeof(int), layout.pagesize, pagefile);
+	if(size != layout.pagesize){
 		perror("Failed to read while fetching page\n");
 		vmem_cleanup();
 		exit(EXIT_FAILURE);
@@ -346,7 +908,8 @@ void load_page(int page, int frame){
 }
 
 /*
- * prints out the contents of the administration section and the page table.
+ * prints out the contents of the administration section, the page tables of
+ * the clients and the frames.
  */
 void dump() {
 	PDEBUG("Dump\n");
@@ -357,46 +920,92 @@ void dump() {
 	printf("Pagefaults = %d\n", vmem->adm.pf_count);
 	printf("Requested Page = %d\n", vmem->adm.req_pageno);
 
-	printf("====================================\n");
-	printf("            Pagetable\n");
-	printf("====================================\n");
-	int i;
-	for (i = 0; i < VMEM_NPAGES / 4; i++) {
-		int index = i;
-		printf("%3d --> %3d (%d) | ", index, vmem->pt.entries[index].frame, vmem->pt.entries[index].flags);
-		index += VMEM_NPAGES / 4;
-		printf("%3d --> %3d (%d) | ", index, vmem->pt.entries[index].frame, vmem->pt.entries[index].flags);
-		index += VMEM_NPAGES / 4;
-		printf("%3d --> %3d (%d) | ", index, vmem->pt.entries[index].frame, vmem->pt.entries[index].flags);
-		index += VMEM_NPAGES / 4;
-		printf("%3d --> %3d (%d)\n", index, vmem->pt.entries[index].frame, vmem->pt.entries[index].flags);
+	printf("Address space = %d items, %d pages of %d items\n",
+			layout.virtmemsize, layout.npages, layout.pagesize);
+	printf("Frames = %d\n", layout.nframes);
+	printf("Pagetable nodes = %d of %d directories, %d of %d leaves\n",
+			VMEM_MAX_CLIENTS + dir_pool.in_use, layout.ndirs,
+			leaf_pool.in_use, layout.nleaves);
+
+	for (int client = 0; client < VMEM_MAX_CLIENTS; client++) {
+		if (vmem->adm.clients[client].pid == 0) {
+			continue;
+		}
+		printf("====================================\n");
+		printf("   Pagetable client %d (PID %d)\n", client,
+				vmem->adm.clients[client].pid);
+		printf("====================================\n");
+		int hits = vmem->adm.clients[client].tlb_hits;
+		int accesses = hits + vmem->adm.clients[client].tlb_misses;
+		printf("TLB hits = %d of %d accesses (%.1f%%)\n", hits, accesses,
+				accesses > 0 ? 100.0 * hits / accesses : 0.0);
+		int column = 0;
+		dump_dir(client, 0, 0, &column);
+		if (column % 4 != 0) {
+			printf("\n");
+		}
+		printf("\n");
 	}
 
-	printf("\n");
+	/* frame --> client:page */
+	for (int i = 0; i < layout.nframes; i++) {
+		printf("%2d --> %2d:%3d", i, frameclient[i], framepage[i]);
+		dump_column(i);
+	}
+	if (layout.nframes % 4 != 0) {
+		printf("\n");
+	}
+}
 
-	for (i = 0; i < VMEM_NFRAMES / 4; i++) {
-		int index = i;
-		printf("%2d --> %3d | ", index, vmem->pt.framepage[index]);
-		index += VMEM_NFRAMES / 4;
-		printf("%2d --> %3d | ", index, vmem->pt.framepage[index]);
-		index += VMEM_NFRAMES / 4;
-		printf("%2d --> %3d | ", index, vmem->pt.framepage[index]);
-		index += VMEM_NFRAMES / 4;
-		printf("%2d --> %3d\n", index, vmem->pt.framepage[index]);
+/*
+ * Prints the present pages below a page table directory
+ */
+void dump_dir(int dir, int level, int first, int *column) {
+	int span = 1 << ((layout.pt_levels - level) * VMEM_PT_BITS);
+	for (int i = 0; i < VMEM_PT_FANOUT; i++) {
+		int child = dirs[dir].children[i];
+		if (child == VMEM_PT_NONE) {
+			continue;
+		}
+		if (level + 1 < layout.pt_levels) {
+			dump_dir(child, level + 1, first + i * span, column);
+			continue;
+		}
+		for (int j = 0; j < VMEM_PT_FANOUT; j++) {
+			struct pt_entry *entry = &(leaves[child].entries[j]);
+			if (entry->flags & PTF_PRESENT) {
+				printf("%3d --> %3d (%d)", first + i * span + j, entry->frame,
+						entry->flags);
+				dump_column((*column)++);
+			}
+		}
 	}
 }
 
 /*
- * custom signal handler
+ * Ends an item of a table that is printed in 4 columns
+ */
+void dump_column(int column) {
+	printf("%s", (column + 1) % 4 != 0 ? " | " : "\n");
+}
+
+/*
+ * handles a signal fetched by the main loop
  */
 void sighandler(int signo) {
 	signal_number = signo;
 	switch (signo) {
 	case SIGUSR1:
-		pagefault();
+		pthread_mutex_lock(&fault_mutex);
+		handle_request(vmem->adm.req_client, vmem->adm.req_pageno);
+		pthread_mutex_unlock(&fault_mutex);
+		// wakeup vmappl
+		sem_post(&(vmem->adm.sema));
 		break;
 	case SIGUSR2:
+		pthread_mutex_lock(&fault_mutex);
 		dump();
+		pthread_mutex_unlock(&fault_mutex);
 		break;
 	case SIGINT:
 		break;
@@ -407,12 +1016,10 @@ void sighandler(int signo) {
  * finds a free frame
  */
 int get_free_frame(){
-	for(int i = 0; i < VMEM_NFRAMES; i++){
-		if(vmem->pt.framepage[i] == VOID_IDX){
-			return i;
-		}
+	if(free_count == 0){
+		return VOID_IDX;
 	}
-	return VOID_IDX;
+	return free_frames[--free_count];
 }
 
 /*
@@ -420,7 +1027,7 @@ int get_free_frame(){
  */
 int get_frame_fifo(){ /* 557 */
 	static int next = -1;
-	next = (next + 1) % VMEM_NFRAMES;
+	next = (next + 1) % layout.nframes;
 	return next;
 }
 
@@ -428,18 +1035,112 @@ int get_frame_fifo(){ /* 557 */
  * Gets a frame to be replaced according to LRU principle.
  */
 int get_frame_lru(){ /* 531 */
-	int frame = 0;
-	int min = vmem->pt.entries[vmem->pt.framepage[0]].last_used;
-
-	for(int i = 1; i < VMEM_NFRAMES; i++){
-		int current = vmem->pt.entries[vmem->pt.framepage[i]].last_used;
-		if(current < min){
-			min = current;
-			frame = i;
+	while(1){
+		int frame = lru.frames[0];
+		int last_used = __atomic_load_n(&(frame_entry(frame)->last_used),
+				__ATOMIC_RELAXED);
+		if(last_used == lru.keys[frame]){
+			return frame;
+		}
+		// used since we looked last
+		lru.keys[frame] = last_used;
+		lru_sift_down(0);
+	}
+}
+
+/*
+ * Prepares the LRU heap, no frames in it
+ */
+void init_lru(void){
+	lru.size = 0;
+	lru.frames = malloc(layout.nframes * sizeof(int));
+	lru.keys = malloc(layout.nframes * sizeof(int));
+	lru.slots = malloc(layout.nframes * sizeof(int));
+	if(lru.frames == NULL || lru.keys == NULL || lru.slots == NULL){
+		perror("Error allocating LRU heap");
+		exit(EXIT_FAILURE);
+	}
+	for(int i = 0; i < layout.nframes; i++){
+		lru.slots[i] = VOID_IDX;
+	}
+}
+
+/*
+ * Puts a frame into the LRU heap or changes its key
+ */
+void lru_update(int frame, int key){
+	lru.keys[frame] = key;
+	if(lru.slots[frame] == VOID_IDX){
+		lru_place(lru.size++, frame);
+	}
+	lru_sift_up(lru.slots[frame]);
+	lru_sift_down(lru.slots[frame]);
+}
+
+/*
+ * Takes a frame that is freed out of the LRU heap
+ */
+void lru_remove(int frame){
+	int slot = lru.slots[frame];
+	if(slot == VOID_IDX){
+		return;
+	}
+	lru.slots[frame] = VOID_IDX;
+	int last = lru.frames[--lru.size];
+	if(last != frame){
+		lru_place(slot, last);
+		lru_sift_up(slot);
+		lru_sift_down(lru.slots[last]);
+	}
+}
+
+/*
+ * Checks whether a frame has to come before another in the LRU heap
+ */
+int lru_before(int a, int b){
+	return lru.keys[a] < lru.keys[b] || (lru.keys[a] == lru.keys[b] && a < b);
+}
+
+/*
+ * Moves the frame at a position of the LRU heap to the front as far as its
+ * key allows
+ */
+void lru_sift_up(int slot){
+	int frame = lru.frames[slot];
+	while(slot > 0 && lru_before(frame, lru.frames[(slot - 1) / 2])){
+		lru_place(slot, lru.frames[(slot - 1) / 2]);
+		slot = (slot - 1) / 2;
+	}
+	lru_place(slot, frame);
+}
+
+/*
+ * Moves the frame at a position of the LRU heap to the back as far as its
+ * key requires
+ */
+void lru_sift_down(int slot){
+	int frame = lru.frames[slot];
+	while(2 * slot + 1 < lru.size){
+		int child = 2 * slot + 1;
+		if(child + 1 < lru.size
+				&& lru_before(lru.frames[child + 1], lru.frames[child])){
+			child++;
 		}
+		if(!lru_before(lru.frames[child], frame)){
+			break;
+		}
+		lru_place(slot, lru.frames[child]);
+		slot = child;
 	}
+	lru_place(slot, frame);
+}
 
-	return frame;
+/*
+ * Puts a frame at a position of the LRU heap
+ */
+void lru_place(int slot, int frame){
+	lru.frames[slot] = frame;
+	lru.slots[frame] = slot;
 }
 
 /*
@@ -447,10 +1148,10 @@ int get_frame_lru(){ /* 531 */
  */
 int get_frame_clock(){ /* 536 */
 	static int current =  -1;
-	current = (current + 1) % VMEM_NFRAMES;
-	while(vmem->pt.entries[vmem->pt.framepage[current]].flags & PTF_USED){
-		vmem->pt.entries[vmem->pt.framepage[current]].flags &= ~PTF_USED;
-		current = (current + 1) % VMEM_NFRAMES;
+	current = (current + 1) % layout.nframes;
+	while(__atomic_fetch_and(&(frame_entry(current)->flags), ~PTF_USED,
+			__ATOMIC_RELAXED) & PTF_USED){
+		current = (current + 1) % layout.nframes;
 	}
 	return current;
 }
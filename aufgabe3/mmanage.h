@@ -26,6 +26,66 @@ struct logevent {
     int g_count;
 };
 
+/**
+ * @brief Frames in use ordered by the time of their last access, as far as
+ *        mmanage knows it (a binary min-heap)
+ *
+ * The clients only store the time of an access in pt_entry.last_used. The
+ * key of a frame is the last_used mmanage has seen last, so it is never
+ * later than the real one. If the key of the first frame is still up to
+ * date, no other frame can have been used before, so it is the least
+ * recently used one. Otherwise its key is refreshed and it moves down.
+ */
+struct lru_heap {
+    int size; /* Frames in the heap */
+    int *frames; /* The heap, least recently used frame first */
+    int *keys; /* Key of a frame */
+    int *slots; /* Position of a frame in frames, VOID_IDX if none */
+};
+
+/**
+ * @brief Pool of page table nodes (directories or leaves) in shared memory
+ *
+ * Only mmanage allocates nodes, so the pool itself is private to mmanage.
+ */
+struct node_pool {
+    int end; /* Nodes up to here have been handed out before */
+    int capacity; /* Nodes in shared memory */
+    int in_use; /* Nodes handed out right now */
+    int free; /* First freed node, VOID_IDX if none */
+    int *next; /* Next freed node */
+};
+
+/**
+ * @brief Checks the sizes and computes the layout of the shared memory
+ *
+ * Exits if the sizes are invalid.
+ *
+ * @param[in] virtmemsize items of an address space, a multiple of pagesize
+ * @param[in] pagesize    items per page, a power of 2
+ * @param[in] nframes     number of frames
+ */
+void init_layout(int virtmemsize, int pagesize, int nframes);
+
+/**
+ * @brief Gets the most nodes one level of the page tables can need
+ *
+ * A node only exists while a page below it is present.
+ *
+ * @param[in] span pages below a node of the level
+ * @return number of nodes
+ */
+int node_capacity(long span);
+
+/**
+ * @brief Places a part in the shared memory
+ *
+ * @param[in,out] end  end of the parts placed before, moved behind the part
+ * @param[in]     size size of the part in bytes
+ * @return offset of the part
+ */
+size_t place_part(size_t *end, size_t size);
+
 /**
  * @brief Initialize virtual memory.
  *
@@ -46,16 +106,18 @@ void vmem_cleanup(void);
  * @brief Stores a page to disk.
  *
  * Precondition:
- * page is between 0 and VMEM_NPAGES
- * frame is between 0 and VMEM_NFRAMES
+ * client is between 0 and VMEM_MAX_CLIENTS
+ * page is between 0 and npages
+ * frame is between 0 and nframes
  *
  * Postcondition:
- * data stored in frame will be written to disk
+ * data stored in frame will be written to the pagefile region of client
  *
- * @param[in] page  the page number to store
- * @param[in] frame the frame number where page is currently mapped to
+ * @param[in] client the client the page belongs to
+ * @param[in] page   the page number to store
+ * @param[in] frame  the frame number where page is currently mapped to
  */
-void store_page(int page, int frame);
+void store_page(int client, int page, int frame);
 
 /**
  * @brief Loads a page from disk.
@@ -64,16 +126,18 @@ void store_page(int page, int frame);
  * Will change (overwrite) the data associated with frame.
  *
  * Precondition:
- * page is between 0 and VMEM_NPAGES
- * frame is between 0 and VMEM_NFRAMES
+ * client is between 0 and VMEM_MAX_CLIENTS
+ * page is between 0 and npages
+ * frame is between 0 and nframes
  *
  * Postcondition:
  * data stored in frame will be overwritten
  *
- * @param[in] page  the page to load
- * @param[in] frame the frame to load into
+ * @param[in] client the client the page belongs to
+ * @param[in] page   the page to load
+ * @param[in] frame  the frame to load into
  */
-void load_page(int page, int frame);
+void load_page(int client, int page, int frame);
 
 /**
  * @brief Gets a frame to be replaced according to FIFO principle.
@@ -85,10 +149,69 @@ int get_frame_fifo(void);
 /**
  * @brief Gets a frame to be replaced according to LRU principle.
  *
+ * Refreshes the keys of the frames in front of the LRU heap until the first
+ * one is up to date, so every access since its last fault costs O(log
+ * nframes) once, not every frame on every fault.
+ *
  * @return index of the frame to be replaced
  */
 int get_frame_lru(void);
 
+/**
+ * @brief Prepares the LRU heap, no frames in it
+ */
+void init_lru(void);
+
+/**
+ * @brief Puts a frame into the LRU heap or changes its key
+ *
+ * @param[in] frame the frame
+ * @param[in] key   last_used of the page on the frame
+ */
+void lru_update(int frame, int key);
+
+/**
+ * @brief Takes a frame that is freed out of the LRU heap
+ *
+ * @param[in] frame the frame
+ */
+void lru_remove(int frame);
+
+/**
+ * @brief Checks whether a frame has to come before another in the LRU heap
+ *
+ * Older keys first, lower frames first for the same key (like a scan).
+ *
+ * @param[in] a a frame
+ * @param[in] b another frame
+ * @return 1 if a comes first, 0 otherwise
+ */
+int lru_before(int a, int b);
+
+/**
+ * @brief Moves the frame at a position of the LRU heap to the front as far
+ *        as its key allows
+ *
+ * @param[in] slot the position
+ */
+void lru_sift_up(int slot);
+
+/**
+ * @brief Moves the frame at a position of the LRU heap to the back as far
+ *        as its key requires
+ *
+ * @param[in] slot the position
+ */
+void lru_sift_down(int slot);
+
+/**
+ * @brief Puts a frame at a position of the LRU heap
+ *
+ * @param[in] slot  the position
+ * @param[in] frame the frame
+ */
+void lru_place(int slot, int frame);
+
 /**
  * @brief Gets a frame to be replaced according to CLOCK algorithm.
  *
@@ -104,26 +227,205 @@ int get_frame_clock(void);
 int get_free_frame(void);
 
 /**
- * @brief custom signal handler
+ * @brief handles a signal fetched by the main loop
+ *
+ * SIGUSR1: request adm.req_pageno of client adm.req_client (see
+ * handle_request), SIGUSR2: dump, SIGINT: quit
  *
  * @param[in] signo the signal(number) to be handled
  */
 void sighandler(int signo);
 
+/**
+ * @brief Handles a request of a client: a page fault or its detach
+ *
+ * The caller has to hold the fault mutex and wake up the client afterwards.
+ *
+ * @param[in] client the client
+ * @param[in] page   the page that is not present or VMEM_DETACH
+ */
+void handle_request(int client, int page);
+
 /**
  * @brief performs the necessary actions to handle a pagefault
+ *
+ * Replaces a frame of any client if there is no free one.
+ *
+ * @param[in] client the client the page belongs to
+ * @param[in] page   the page to load
+ */
+void pagefault(int client, int page);
+
+/**
+ * @brief Frees the frames of a client that leaves and resets its address
+ *        space (page table and pagefile region)
+ *
+ * @param[in] client the client
+ */
+void detach_client(int client);
+
+/**
+ * @brief Resets the page table of a client, all pages not present
+ *
+ * Frees all nodes but the root directory.
+ *
+ * @param[in] client the client
+ */
+void reset_pagetable(int client);
+
+/**
+ * @brief Prepares a node pool
+ *
+ * @param[out] pool     the pool
+ * @param[in]  first    first node to hand out
+ * @param[in]  capacity nodes in shared memory
+ */
+void init_pool(struct node_pool *pool, int first, int capacity);
+
+/**
+ * @brief Takes a node from a pool
+ *
+ * @param[in] pool the pool
+ * @return index of the node
+ */
+int alloc_node(struct node_pool *pool);
+
+/**
+ * @brief Returns a node that no client can reach anymore to its pool
+ *
+ * @param[in] pool the pool
+ * @param[in] node index of the node
+ */
+void free_node(struct node_pool *pool, int node);
+
+/**
+ * @brief Clears a page table directory, no children
+ *
+ * @param[in] dir index of the directory
+ */
+void init_dir(int dir);
+
+/**
+ * @brief Clears a page table leaf, all pages not present
+ *
+ * @param[in] leaf index of the leaf
+ */
+void init_leaf(int leaf);
+
+/**
+ * @brief Frees all nodes below a directory (not the directory itself)
+ *
+ * Only for page tables of clients that do not access them.
+ *
+ * @param[in] dir   index of the directory
+ * @param[in] level level of the directory, 0 for the root
+ */
+void free_subtree(int dir, int level);
+
+/**
+ * @brief Gets the page table entry of a page that is about to be loaded
+ *
+ * Creates the nodes on the path to the entry that are missing.
+ *
+ * @param[in] client the client the page belongs to
+ * @param[in] page   the page
+ * @return the entry
+ */
+struct pt_entry* map_entry(int client, int page);
+
+/**
+ * @brief Accounts for a page that is not present anymore
+ *
+ * Unlinks and frees the nodes that are left without present pages, once the
+ * client does not access a page below them.
+ *
+ * @param[in] client the client the page belongs to
+ * @param[in] page   the page
+ */
+void release_entry(int client, int page);
+
+/**
+ * @brief Waits until a client does not access one of some pages
+ *
+ * @param[in] client the client
+ * @param[in] first  the first of the pages
+ * @param[in] count  number of pages
+ */
+void wait_for_client(int client, long first, long count);
+
+/**
+ * @brief Gets the page table entry of the page on a frame
+ *
+ * @param[in] frame a frame that is in use
+ * @return the entry in the page table of the client owning the frame
+ */
+struct pt_entry* frame_entry(int frame);
+
+/**
+ * @brief Takes the page on a frame out of the address space of its client
+ *
+ * Waits until the client is done with an access to the page that may have
+ * begun before.
+ *
+ * @param[in] frame a frame that is in use
+ * @return the flags the page had
+ */
+int unmap_frame(int frame);
+
+/**
+ * @brief Starts the thread servicing the fault slots
+ *
+ * Clients use their slots from then on instead of SIGUSR1.
+ */
+void start_fault_service(void);
+
+/**
+ * @brief Stops the thread servicing the fault slots
+ *
+ * Clients fall back to SIGUSR1 afterwards.
  */
-void pagefault(void);
+void stop_fault_service(void);
 
 /**
- * @brief prints out the contents of the administration section and the page
- *        table.
+ * @brief Handles the requests posted to the fault slots of the clients,
+ *        round robin
+ *
+ * Sleeps on the futex word posted while there are none.
+ *
+ * @param arg unused
+ * @return NULL once the service is stopped
+ */
+void* fault_service(void *arg);
+
+/**
+ * @brief prints out the contents of the administration section, the page
+ *        tables of the clients and the frames.
  */
 void dump(void);
 
+/**
+ * @brief Prints the present pages below a page table directory
+ *
+ * @param[in]     dir    index of the directory
+ * @param[in]     level  level of the directory, 0 for the root
+ * @param[in]     first  first page below the directory
+ * @param[in,out] column pages printed so far
+ */
+void dump_dir(int dir, int level, int first, int *column);
+
+/**
+ * @brief Ends an item of a table that is printed in 4 columns
+ *
+ * @param[in] column index of the item
+ */
+void dump_column(int column);
+
 /**
  * @brief Initializes the pagefile for swapping pages out of memory
  *
+ * The pagefile has a region of virtmemsize items for every client. It is
+ * sparse, pages that were never stored read as zeros.
+ *
  * Precondition:
  * pfname must be a valid filename
  *
@@ -134,6 +436,13 @@ void dump(void);
  */
 void init_pagefile(const char *pfname);
 
+/**
+ * @brief Discards the pagefile region of a client, all pages read as zeros
+ *
+ * @param client the client
+ */
+void reset_pagefile(int client);
+
 /**
  * @brief Logs a message to the logfile for later analysis
  *
@@ -1,5 +1,5 @@
 /** ****************************************************************
- * @file    vmaccess.c 
+ * @file    vmaccess.c
  * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
  * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
  * @version 1.0
@@ -8,6 +8,7 @@
  ******************************************************************
  */
 
+#include <sched.h>
 #include "vmaccess.h"
 #include "vmem.h"
 
@@ -16,11 +17,220 @@
  */
 static struct vmem_struct *vmem = NULL;
 
+/**
+ * @brief index of this process in the clients of mmanage
+ */
+static int client = -1;
+
+/**
+ * @brief sizes and layout of the shared memory
+ */
+static struct vmem_layout layout;
+
+/**
+ * @brief page table directories, the root of this process is dirs[client]
+ */
+static struct pt_dir *dirs = NULL;
+
+/**
+ * @brief page table leaves
+ */
+static struct pt_leaf *leaves = NULL;
+
+/**
+ * @brief the frames
+ */
+static int *frames = NULL;
+
+/**
+ * @brief translations of the pages used last (see tlb_entry)
+ */
+static struct tlb_entry tlb[VMEM_TLB_SIZE];
+
+#ifndef VMEM_SIGNAL_FAULTS
+/**
+ * @brief Lets mmanage handle a request through the fault slot of the client
+ *
+ * @param[in] page the page that is not present or VMEM_DETACH
+ */
+static void request_page_slot(int page){
+    struct fault_service *service = &(vmem->adm.service);
+    struct fault_slot *slot = &(vmem->adm.clients[client].fault);
+
+    slot->pageno = page;
+    __atomic_store_n(&slot->state, FAULT_REQUESTED, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&service->posted, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&service->sleeping, __ATOMIC_SEQ_CST)){
+        vmem_futex_wake(&service->posted);
+    }
+
+    while(__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) == FAULT_REQUESTED){
+        vmem_futex_wait(&slot->state, FAULT_REQUESTED);
+    }
+    __atomic_store_n(&slot->state, FAULT_FREE, __ATOMIC_RELEASE);
+}
+#endif
+
+/**
+ * @brief Lets mmanage handle a page fault (or the detach of the client)
+ *
+ * Uses the fault slot while mmanage services it, SIGUSR1 otherwise (or
+ * always, if built with VMEM_SIGNAL_FAULTS).
+ *
+ * Postcondition:
+ * page is present
+ *
+ * @param[in] page the page that is not present or VMEM_DETACH
+ */
+static void request_page(int page){
+#ifndef VMEM_SIGNAL_FAULTS
+    if(__atomic_load_n(&(vmem->adm.service.ready), __ATOMIC_ACQUIRE)){
+        request_page_slot(page);
+        return;
+    }
+#endif
+    // the request fields are shared by all clients
+    sem_wait(&(vmem->adm.signal_lock));
+    vmem->adm.req_client = client;
+    vmem->adm.req_pageno = page;
+    kill(vmem->adm.mmanage_pid, SIGUSR1);
+    sem_wait(&(vmem->adm.sema));
+    sem_post(&(vmem->adm.signal_lock));
+}
+
+/**
+ * @brief Takes a free client slot
+ *
+ * Postcondition:
+ * client is set
+ */
+static void attach(void){
+    pid_t self = getpid();
+    for(int i = 0; i < VMEM_MAX_CLIENTS; i++){
+        pid_t unused = 0;
+        if(__atomic_compare_exchange_n(&(vmem->adm.clients[i].pid), &unused,
+                self, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+            client = i;
+            vmem->adm.clients[i].accessing = -1;
+            vmem->adm.clients[i].tlb_hits = 0;
+            vmem->adm.clients[i].tlb_misses = 0;
+            for(int j = 0; j < VMEM_TLB_SIZE; j++){
+                tlb[j].page = -1;
+            }
+            PDEBUG("attached as client %d\n", client)
+            return;
+        }
+    }
+    fprintf(stderr, "Error attaching to vmem: more than %d clients\n",
+            VMEM_MAX_CLIENTS);
+    munmap(vmem, layout.shmsize);
+    vmem = NULL;
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Looks up the page table entry of a page
+ *
+ * The page has to be announced as accessed first, so the nodes on the way
+ * are not reused meanwhile (see pt_dir).
+ *
+ * @param[in] page the page
+ * @return the entry or NULL if the page is not present
+ */
+static struct pt_entry* find_entry(int page){
+    int node = client; /* root directory */
+    for(int level = 0; level < layout.pt_levels; level++){
+        node = __atomic_load_n(&dirs[node].children[vmem_pt_index(page, level,
+                layout.pt_levels)], __ATOMIC_SEQ_CST);
+        if(node == VMEM_PT_NONE){
+            return NULL;
+        }
+    }
+    return &(leaves[node].entries[vmem_pt_index(page, layout.pt_levels,
+            layout.pt_levels)]);
+}
+
+/**
+ * @brief Makes a page present and keeps it from being evicted until
+ *        release_page
+ *
+ * @param[in] page the page to access
+ * @return the TLB entry of the page
+ */
+static struct tlb_entry* acquire_page(int page){
+    struct vmem_client *self = &(vmem->adm.clients[client]);
+    struct tlb_entry *cached = &tlb[page & (VMEM_TLB_SIZE - 1)];
+
+    __atomic_store_n(&self->accessing, page, __ATOMIC_SEQ_CST);
+    int generation = __atomic_load_n(&self->generation, __ATOMIC_SEQ_CST);
+    if(cached->page == page && cached->generation == generation){
+        __atomic_store_n(&self->tlb_hits, self->tlb_hits + 1,
+                __ATOMIC_RELAXED);
+        return cached;
+    }
+    __atomic_store_n(&self->tlb_misses, self->tlb_misses + 1,
+            __ATOMIC_RELAXED);
+
+    while(1){
+        struct pt_entry *entry = find_entry(page);
+        if(entry != NULL && (__atomic_load_n(&entry->flags, __ATOMIC_SEQ_CST)
+                & PTF_PRESENT)){
+            // an eviction since generation was read makes this stale
+            cached->page = page;
+            cached->generation = generation;
+            cached->frame = entry->frame;
+            cached->entry = entry;
+            return cached;
+        }
+        /* page is not present. mmanage may have to wait for us to leave the
+           page while we wait for it, so leave it first */
+        __atomic_store_n(&self->accessing, -1, __ATOMIC_RELEASE);
+        request_page(page);
+        __atomic_store_n(&self->accessing, page, __ATOMIC_SEQ_CST);
+        generation = __atomic_load_n(&self->generation, __ATOMIC_SEQ_CST);
+    }
+}
+
+/**
+ * @brief Updates a page after an access, it may be evicted afterwards
+ *
+ * @param[in] cached  the TLB entry of the page that was accessed
+ * @param[in] flags   the flags to set (PTF_USED, PTF_DIRTY)
+ * @param[in] g_count timestamp of the access
+ */
+static void release_page(struct tlb_entry *cached, int flags, int g_count){
+    struct pt_entry *entry = cached->entry;
+    __atomic_store_n(&entry->last_used, g_count, __ATOMIC_RELAXED);
+    // the flags are usually set already, that needs no locked instruction
+    if((__atomic_load_n(&entry->flags, __ATOMIC_RELAXED) & flags) != flags){
+        __atomic_fetch_or(&entry->flags, flags, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&(vmem->adm.clients[client].accessing), -1,
+            __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Gets the page an address is in, checks the bounds
+ *
+ * @param[in] address the address
+ * @return the page number
+ */
+static int get_page(int address){
+    int page = address >> layout.page_shift;
+    if(address < 0 || page >= layout.npages){
+        perror("Index out of bounds!");
+        vmem_cleanup();
+        exit(EXIT_FAILURE);
+    }
+    return page;
+}
+
 /*
  * Connect to virtual memory.
  *
  * Will request shared memory and then map it to a vmem_struct.
  * Assumes that the shared memory already exists and has been initialized.
+ * Attaches this process as a client with an address space of its own.
  */
 void vmem_init(void){
     // connect to shared memory
@@ -32,22 +242,35 @@ void vmem_init(void){
         PDEBUG("vmem successfully opened\n")
     }
 
-    // map
-    vmem = (struct vmem_struct*) mmap(NULL, SHMSIZE, PROT_READ | PROT_WRITE,
-            MAP_SHARED, shm_fd, 0);
-    if (!vmem) {
+    // map, mmanage has sized the shared memory
+    struct stat shm_stat;
+    if (fstat(shm_fd, &shm_stat) == -1) {
+        perror("Error connecting to vmem");
+        exit(EXIT_FAILURE);
+    }
+    vmem = (struct vmem_struct*) mmap(NULL, shm_stat.st_size,
+            PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (vmem == MAP_FAILED) {
         perror("Error mapping vmem");
         exit(EXIT_FAILURE);
     } else {
         PDEBUG("vmem successfully mapped\n")
     }
+    close(shm_fd);
+
+    layout = vmem->adm.layout;
+    dirs = VMEM_AT(vmem, layout.dirs);
+    leaves = VMEM_AT(vmem, layout.leaves);
+    frames = VMEM_AT(vmem, layout.data);
+
+    attach();
 }
 
 /*
  * Read from "virtual" address
  *
  * Precondition:
- * address must be in process address space (between 0 and VMEM_VIRTMEMSIZE)
+ * address must be in process address space (between 0 and virtmemsize)
  *
  * Postcondition:
  * will return the value stored at address
@@ -57,37 +280,25 @@ int vmem_read(int address){
         vmem_init();
     }
 
-    // increase access counter
-    vmem->adm.g_count++;
+    // increase access counter (shared by all clients)
+    int g_count = __atomic_add_fetch(&(vmem->adm.g_count), 1, __ATOMIC_RELAXED);
 
-    int page = address / VMEM_PAGESIZE;
-    if(page < 0 || page >= VMEM_NPAGES){
-        perror("Index out of bounds!");
-        vmem_cleanup();
-        exit(EXIT_FAILURE);
-    }
-    if((vmem->pt.entries[page].flags & PTF_PRESENT) == 0){ /* page is not present */
-        // pagefault
-        vmem->adm.req_pageno = page;
-        kill(vmem->adm.mmanage_pid, SIGUSR1);
-        sem_wait(&(vmem->adm.sema));
-    }
+    int page = get_page(address);
+    int data_offset = address & (layout.pagesize - 1);
+    struct tlb_entry *cached = acquire_page(page);
 
-    int data_offset = address - page * VMEM_PAGESIZE;
-    int frame_offset = vmem->pt.entries[page].frame * VMEM_PAGESIZE;
+    int data = frames[(cached->frame << layout.page_shift) + data_offset];
 
     // update flags on page
-    vmem->pt.entries[page].last_used = vmem->adm.g_count;
-    vmem->pt.entries[page].flags |= PTF_USED;
-
-    return vmem->data[frame_offset + data_offset];
+    release_page(cached, PTF_USED, g_count);
+    return data;
 }
 
 /*
  * Write data to "virtual" address
  *
  * Precondition:
- * address must be in process address space (between 0 and VMEM_VIRTMEMSIZE)
+ * address must be in process address space (between 0 and virtmemsize)
  *
  * Postcondition:
  * will write the value stored in data to address
@@ -97,43 +308,53 @@ void vmem_write(int address, int data){
         vmem_init();
     }
 
-    // increase access counter
-    vmem->adm.g_count++;
+    // increase access counter (shared by all clients)
+    int g_count = __atomic_add_fetch(&(vmem->adm.g_count), 1, __ATOMIC_RELAXED);
 
-    int page = address / VMEM_PAGESIZE;
-    if(page < 0 || page >= VMEM_NPAGES){
-        perror("Index out of bounds!");
-        vmem_cleanup();
-        exit(EXIT_FAILURE);
-    }
-    if((vmem->pt.entries[page].flags & PTF_PRESENT) == 0){ /* page is not present */
-        // pagefault
-        vmem->adm.req_pageno = page;
-        kill(vmem->adm.mmanage_pid, SIGUSR1);
-        sem_wait(&(vmem->adm.sema));
-    }
+    int page = get_page(address);
+    int data_offset = address & (layout.pagesize - 1);
+    struct tlb_entry *cached = acquire_page(page);
 
-    int data_offset = address - page * VMEM_PAGESIZE;
-    int frame_offset = vmem->pt.entries[page].frame * VMEM_PAGESIZE;
-
-    vmem->data[frame_offset + data_offset] = data;
+    frames[(cached->frame << layout.page_shift) + data_offset] = data;
 
     // update flags
-    vmem->pt.entries[page].last_used = vmem->adm.g_count;
-    vmem->pt.entries[page].flags |= PTF_DIRTY;
-    vmem->pt.entries[page].flags |= PTF_USED;
+    release_page(cached, PTF_DIRTY | PTF_USED, g_count);
+}
+
+/*
+ * Gets the sizes mmanage was started with
+ */
+void vmem_sizes(int *virtmemsize, int *pagesize, int *nframes){
+    if(vmem == NULL){
+        vmem_init();
+    }
+    *virtmemsize = layout.virtmemsize;
+    *pagesize = layout.pagesize;
+    *nframes = layout.nframes;
 }
 
 /*
- * Unmap and unlink shared memory
+ * Detach from and unmap shared memory
  */
 void vmem_cleanup(void){
-    // DEBUG!
-    kill(vmem->adm.mmanage_pid, SIGUSR2);
-    // DEBUG!
+    if(vmem == NULL){
+        return;
+    }
+
+    PDEBUG("TLB hits: %d of %d accesses\n", vmem->adm.clients[client].tlb_hits,
+            vmem->adm.clients[client].tlb_hits
+            + vmem->adm.clients[client].tlb_misses);
+
+    // mmanage frees our frames (and dumps the page table, if debugging)
+    request_page(VMEM_DETACH);
+    __atomic_store_n(&(vmem->adm.clients[client].pid), 0, __ATOMIC_RELEASE);
 
-    munmap(vmem, SHMSIZE);
+    munmap(vmem, layout.shmsize);
     vmem = NULL;
+    client = -1;
+    dirs = NULL;
+    leaves = NULL;
+    frames = NULL;
     PDEBUG("disconnected shared memory\n");
 
 }
@@ -16,7 +16,8 @@
  * @brief Read from "virtual" address
  *
  * Precondition:
- * address must be in process address space (between 0 and VMEM_VIRTMEMSIZE)
+ * address must be in process address space (between 0 and the virtmemsize
+ * mmanage was started with, VMEM_VIRTMEMSIZE by default)
  *
  * Postcondition:
  * will return the value stored at address
@@ -31,7 +32,8 @@ int vmem_read(int address);
  * @brief Write data to "virtual" address
  *
  * Precondition:
- * address must be in process address space (between 0 and VMEM_VIRTMEMSIZE)
+ * address must be in process address space (between 0 and the virtmemsize
+ * mmanage was started with, VMEM_VIRTMEMSIZE by default)
  *
  * Postcondition:
  * will write the value stored in data to address
@@ -46,11 +48,26 @@ void vmem_write(int address, int data);
  *
  * Will request shared memory and then map it to a vmem_struct.
  * Assumes that the shared memory already exists and has been initialized.
+ * Attaches this process as a client with an address space of its own, the
+ * first access does this automatically.
  */
 void vmem_init(void);
 
 /**
- * @brief Unmap and unlink shared memory
+ * @brief Gets the sizes mmanage was started with
+ *
+ * Connects to virtual memory first if necessary.
+ *
+ * @param[out] virtmemsize items of the address space
+ * @param[out] pagesize    items per page
+ * @param[out] nframes     number of frames
+ */
+void vmem_sizes(int *virtmemsize, int *pagesize, int *nframes);
+
+/**
+ * @brief Detach from and unmap shared memory
+ *
+ * mmanage frees the frames of this process and discards its address space.
  */
 void vmem_cleanup(void);
 
@@ -0,0 +1,75 @@
+/** ****************************************************************
+ * @file    aufgabe3/vmbench.c
+ * @author  Moritz Hoewer (Moritz.Hoewer@haw-hamburg.de)
+ * @author  Jesko Treffler (Jesko.Treffler@haw-hamburg.de)
+ * @version 1.0
+ * @date    16.12.2016
+ * @brief   Page fault round trip benchmark
+ *
+ * Reads one item of nframes + 1 pages in turn, so with FIFO or LRU every
+ * read is a page fault. Prints
+ * "binary,faults,microseconds_per_fault". Needs a running mmanage.
+ ******************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "vmaccess.h"
+
+/**
+ * @brief page faults measured if nothing else is given
+ */
+#define VMBENCH_FAULTS 20000
+
+/**
+ * @brief Gets a monotonic timestamp
+ *
+ * @return the time in microseconds
+ */
+static double now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+/**
+ * @brief program entry point for vmbench
+ *
+ * @param argc command line argument count
+ * @param argv command line arguments: [FAULTS]
+ *
+ * @return exit code
+ */
+int main(int argc, char **argv) {
+    int faults = argc > 1 ? atoi(argv[1]) : VMBENCH_FAULTS;
+    if (faults <= 0) {
+        fprintf(stderr, "Usage: %s [FAULTS]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int virtmemsize, pagesize, nframes;
+    vmem_sizes(&virtmemsize, &pagesize, &nframes);
+    int pages = nframes + 1;
+    if (pages > virtmemsize / pagesize) {
+        fprintf(stderr, "%s: address space smaller than physical memory\n",
+                argv[0]);
+        vmem_cleanup();
+        return EXIT_FAILURE;
+    }
+
+    // fill all frames first
+    for (int page = 0; page < nframes; page++) {
+        vmem_read(page * pagesize);
+    }
+
+    double start = now_us();
+    for (int i = 0; i < faults; i++) {
+        vmem_read(((nframes + i) % pages) * pagesize);
+    }
+    double elapsed = now_us() - start;
+
+    printf("%s,%d,%.2f\n", argv[0], faults, elapsed / faults);
+    vmem_cleanup();
+    return 0;
+}
@@ -23,13 +23,16 @@
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/shm.h>
+#include <sys/syscall.h>
+#include <limits.h>
+#include <linux/futex.h>
 
 /**
  * @brief common name for the shared memory
  */
 #define SHMNAME "/shm-bsp3"
 
-/* memory sizes */
+/* memory sizes (defaults, mmanage takes others at startup) */
 /**
  * @brief process address space (items)
  */
@@ -55,7 +58,6 @@
  */
 #define VMEM_NFRAMES (VMEM_PHYSMEMSIZE / VMEM_PAGESIZE)
 
-
 /* Page Table */
 
 /**
@@ -80,6 +82,12 @@
 
 /**
  * @brief structure for a page table entry
+ *
+ * flags and last_used are changed by the client and by mmanage at the same
+ * time, so they are only accessed atomically. A client announces the page it
+ * accesses in vmem_client.accessing before it checks PTF_PRESENT, mmanage
+ * clears PTF_PRESENT before it waits for the client to leave the page it
+ * evicts.
  */
 struct pt_entry {
     int flags; /* see defines above */
@@ -87,40 +95,223 @@ struct pt_entry {
     int last_used; /* Global counter as quasi-timestamp for LRU */
 };
 
+/**
+ * @brief bits of the page number resolved by one page table node
+ */
+#define VMEM_PT_BITS 8
+
+/**
+ * @brief children of a directory, entries of a leaf
+ */
+#define VMEM_PT_FANOUT (1 << VMEM_PT_BITS)
+
+/**
+ * @brief index of a node that does not exist
+ */
+#define VMEM_PT_NONE -1
+
+/**
+ * @brief structure for a directory of a page table
+ *
+ * The page table of a client is a tree: its root directory, more directories
+ * if the address space is large and leaves with the entries. A node only
+ * exists while a page below it is present, so the page table takes memory
+ * for the pages in use only, not for the whole address space.
+ *
+ * Only mmanage changes the tree. It publishes a new node with a release
+ * store of its index. Before a node is reused, mmanage unlinks it and waits
+ * until its client does not access a page below it, like for an evicted page
+ * (see pt_entry).
+ */
+struct pt_dir {
+    int count; /* Children in use */
+    int children[VMEM_PT_FANOUT]; /* Directories or leaves, VMEM_PT_NONE */
+};
+
+/**
+ * @brief structure for a leaf of a page table
+ */
+struct pt_leaf {
+    int present; /* Present pages */
+    struct pt_entry entries[VMEM_PT_FANOUT];
+};
+
+/**
+ * @brief Gets the index of the child to take at one level of a page table
+ *
+ * @param[in] page   the page number
+ * @param[in] level  the level of the node, 0 for the root, levels for a leaf
+ * @param[in] levels the directory levels of the page table
+ * @return index into pt_dir.children or pt_leaf.entries
+ */
+static inline int vmem_pt_index(int page, int level, int levels) {
+    return (page >> ((levels - level) * VMEM_PT_BITS)) & (VMEM_PT_FANOUT - 1);
+}
+
+/* Clients */
+
+/**
+ * @brief number of processes that can use the virtual memory at the same time
+ *
+ * Every client gets its own address space (page table and pagefile region)
+ * and its own fault slot. The frames are shared.
+ */
+#define VMEM_MAX_CLIENTS 16
+
+/**
+ * @brief pageno of the request a client leaves with
+ *
+ * mmanage frees the frames of the client and resets its address space.
+ */
+#define VMEM_DETACH -1
+
+/**
+ * @brief slot is unused
+ */
+#define FAULT_FREE 0
+
+/**
+ * @brief slot holds a page fault that has not been handled yet
+ */
+#define FAULT_REQUESTED 1
+
+/**
+ * @brief page fault in slot has been handled, the page is present
+ */
+#define FAULT_DONE 2
+
+/**
+ * @brief structure for a page fault request
+ */
+struct fault_slot {
+    int state; /* see defines above, futex word of the client */
+    int pageno; /* Number of requested page or VMEM_DETACH */
+};
+
+/**
+ * @brief structure for a client
+ */
+struct vmem_client {
+    pid_t pid; /* 0 while the client slot is unused */
+    int accessing; /* Page the client is accessing right now, -1 for none */
+    int generation; /* Changed when a page of the client is evicted */
+    int tlb_hits; /* Accesses translated by the TLB */
+    int tlb_misses; /* Accesses that walked the page table */
+    struct fault_slot fault; /* Page fault request of the client */
+};
+
+/* TLB */
+
+/**
+ * @brief entries of the TLB of a client (a power of 2)
+ */
+#define VMEM_TLB_SIZE 64
+
+/**
+ * @brief structure for an entry of the TLB of a client
+ *
+ * Every client caches the translations of the pages it used last, direct
+ * mapped by page number. An entry is only valid while the generation of the
+ * client is still the one it was filled in: mmanage changes the generation
+ * after it cleared PTF_PRESENT of an evicted page and before it waits for
+ * the client to leave the page. The client announces the page it accesses
+ * before it compares the generation, so it either misses or mmanage waits.
+ */
+struct tlb_entry {
+    int page; /* Page number, -1 if unused */
+    int generation; /* Generation of the client when filled */
+    int frame; /* Frame idx */
+    struct pt_entry *entry; /* Page table entry of the page */
+};
+
+/**
+ * @brief state of the page fault service
+ *
+ * A client posts its page fault in its fault slot and sleeps on the state of
+ * the slot. A thread of mmanage handles the slots round robin and sleeps on
+ * posted while there is nothing to do.
+ */
+struct fault_service {
+    int ready; /* 1 while the slots are serviced, otherwise use SIGUSR1 */
+    int posted; /* Counts requests, futex word of mmanage */
+    int sleeping; /* 1 if mmanage may be sleeping on posted */
+};
+
+/**
+ * @brief sizes mmanage was started with and the layout of the shared memory
+ *
+ * The shared memory starts with the vmem_struct. The other parts follow at
+ * the offsets (bytes) given here.
+ */
+struct vmem_layout {
+    int virtmemsize; /* Items of an address space */
+    int pagesize; /* Items per page, a power of 2 */
+    int page_shift; /* log2(pagesize) */
+    int npages; /* Pages of an address space */
+    int nframes; /* Number of frames */
+    int pt_levels; /* Directory levels of a page table */
+    int ndirs; /* Directories in the pool, the first ones are the roots */
+    int nleaves; /* Leaves in the pool */
+    size_t framepage; /* int[nframes]: pages on frame */
+    size_t frameclient; /* int[nframes]: client of the page on frame */
+    size_t dirs; /* struct pt_dir[ndirs] */
+    size_t leaves; /* struct pt_leaf[nleaves] */
+    size_t data; /* int[nframes * pagesize]: the frames */
+    size_t shmsize; /* Size of shared memory area */
+};
+
 /**
  * @brief structure for administration of memory
  */
 struct vmem_adm_struct {
+    struct vmem_layout layout; /* Set up before anything else */
     pid_t mmanage_pid;
-    sem_t sema; /* Coordinate acces to shm */
+    sem_t sema; /* Coordinate acces to shm (SIGUSR1 page faults) */
+    sem_t signal_lock; /* One SIGUSR1 page fault at a time */
+    struct fault_service service; /* Page fault service */
+    struct vmem_client clients[VMEM_MAX_CLIENTS];
+    int req_client; /* Client of requested page (SIGUSR1) */
     int req_pageno; /* Number of requested page */
     int pf_count; /* Page fault counter */
     int g_count; /* Global access counter as quasi-timestamp */
 };
 
-/**
- * @brief structure for the page table
- */
-struct pt_struct {
-    struct pt_entry entries[VMEM_NPAGES];
-    int framepage[VMEM_NFRAMES]; /* pages on frame */
-};
-
 /**
  * @brief root structure for the shared memory
  *
- * Contains administration structure, page table and frames (data)
+ * Contains the administration structure. The page tables and frames (data)
+ * follow as described by adm.layout.
  */
 struct vmem_struct {
     struct vmem_adm_struct adm;
-    struct pt_struct pt;
-    int data[VMEM_NFRAMES * VMEM_PAGESIZE];
 };
 
 /**
- * @brief size of root structure and therefore size of shared memory area
+ * @brief Gets a part of the shared memory
+ *
+ * @param vmem   the root structure
+ * @param offset offset of the part, see vmem_layout
+ */
+#define VMEM_AT(vmem, offset) ((void *) ((char *) (vmem) + (offset)))
+
+/**
+ * @brief Sleeps as long as a futex word in shared memory contains expected
+ *
+ * @param[in] word     the futex word
+ * @param[in] expected the value that was observed before sleeping
+ */
+static inline void vmem_futex_wait(int *word, int expected) {
+    syscall(SYS_futex, word, FUTEX_WAIT, expected, NULL, NULL, 0);
+}
+
+/**
+ * @brief Wakes everybody sleeping on a futex word in shared memory
+ *
+ * @param[in] word the futex word
  */
-#define SHMSIZE (sizeof(struct vmem_struct))
+static inline void vmem_futex_wake(int *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
 
 #undef PDEBUG             /* undef it, just in case */
 #ifdef DEBUG_MESSAGES